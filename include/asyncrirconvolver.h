@@ -0,0 +1,115 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#ifndef SAL_ASYNCRIRCONVOLVER_H
+#define SAL_ASYNCRIRCONVOLVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+
+#include "partitionedconvolver.h"
+#include "saltypes.h"
+
+namespace sal {
+
+/**
+ Convolves a signal with a room impulse response (RIR) that is recomputed on
+ a background thread. The RIR is produced by `rir_generator`, which can wrap
+ any of the room models (e.g. `Ism`, `Fdtd` or `TdBem`).
+
+ While a new RIR is being computed, `ProcessBlock` keeps convolving with the
+ old one. When the worker thread is done, the new RIR is handed over to the
+ audio thread through an atomic flag (no locks are taken and no memory is
+ allocated or released by the audio thread) and the convolver crossfades to
+ it. The frequency-domain partitions of the RIR are also computed by the
+ worker thread.
+ */
+class AsyncRirConvolver {
+ public:
+  /**
+   @param[in] rir_generator Function computing the RIR. It is only ever called
+   by the worker thread.
+   @param[in] initial_rir RIR used until the first update is swapped in.
+   @param[in] crossfade_length How many samples it takes to crossfade from the
+   old to the new RIR (0 means instantaneous).
+   */
+  AsyncRirConvolver(std::function<Signal()> rir_generator,
+                    const Signal& initial_rir, const Int crossfade_length);
+
+  ~AsyncRirConvolver();
+
+  AsyncRirConvolver(const AsyncRirConvolver&) = delete;
+  AsyncRirConvolver& operator=(const AsyncRirConvolver&) = delete;
+
+  /** Asks the worker thread to recompute the RIR. This can be called from the
+   audio thread: it neither blocks nor allocates. Requests arriving while the
+   worker is busy are merged into a single recomputation. */
+  void RequestUpdate() noexcept;
+
+  /** Returns true if an update has been requested and the new RIR has not
+   been swapped in yet. */
+  bool IsUpdating() const noexcept;
+
+  /** Filters `input_data` with the current RIR and writes the result into
+   `output_data`. If a new RIR is ready, it is swapped in at the beginning of
+   the call. */
+  void ProcessBlock(std::span<const Sample> input_data,
+                    std::span<Sample> output_data) noexcept;
+
+  /** Resets the state of the convolution filter */
+  void ResetState() noexcept { convolver_.ResetState(); }
+
+  static bool Test();
+
+ private:
+  /** Worker thread loop */
+  void Run();
+
+  std::function<Signal()> rir_generator_;
+  Int crossfade_length_;
+
+  dsp::PartitionedConvolver convolver_;
+
+  /** RIR handed over from the worker to the audio thread, already split into
+   partitions. The worker only accesses it while computing, and the audio
+   thread only while it is ready. */
+  dsp::PartitionedConvolver::Partitions staging_;
+  /** Largest number of partitions handed over so far. Longer RIRs are handed
+   over with a delay line allocated by the worker thread. Only accessed by
+   the worker thread. */
+  Int max_num_partitions_;
+
+  /** State of the update, shared by the audio and the worker threads. Every
+   transition is a single atomic operation. A request received while the
+   RIR is being computed or waits to be swapped in is kept in the
+   `...Requested` states, and served afterwards. */
+  enum State : int {
+    kIdle,
+    kRequested,
+    kComputing,
+    kComputingRequested,
+    kReady,
+    kReadyRequested
+  };
+  std::atomic<int> state_;
+  std::atomic<bool> stop_;
+
+  // Only used to put the worker to sleep when there is nothing to do
+  std::mutex mutex_;
+  std::condition_variable condition_;
+
+  std::thread worker_;
+};
+
+}  // namespace sal
+
+#endif
@@ -54,13 +54,23 @@ class CuboidRoom : public Room {
         dimensions_(room_dimensions),
         origin_position_(origin_position) {}
 
+  using Room::CalculateBoundaryPoints;
+
   virtual std::vector<dsp::Point> CalculateBoundaryPoints(
       const dsp::Point& source, const dsp::Point& destination) const noexcept;
 
+  virtual void CalculateBoundaryPoints(
+      const dsp::Point& source, const dsp::Point& destination,
+      std::span<dsp::Point> boundary_points) const noexcept;
+
   virtual std::vector<dsp::Filter> GetBoundaryFilters(
       const dsp::Point& source_point,
       const dsp::Point& mic_point) const noexcept;
 
+  virtual void GetBoundaryWallIds(const dsp::Point& source_point,
+                                  const dsp::Point& mic_point,
+                                  std::span<sal::Int> wall_ids) const noexcept;
+
   virtual dsp::Int num_boundary_points() const noexcept;
 
   dsp::Point ImageSourcePosition(const dsp::Point& source_position,
@@ -71,9 +81,26 @@ class CuboidRoom : public Room {
 
   sal::Time SabineRt60() const;
 
+  /** Returns Sabine's reverberation time at `frequency`, with the wall
+   absorption obtained from the frequency responses of the wall filters. */
+  sal::Time SabineRt60(const sal::Time frequency,
+                       const sal::Time sampling_frequency) const;
+
+  /** Returns an estimate of the mixing time, i.e. the time after which the
+   reflections can be considered diffuse: sqrt(V) ms, with V the volume in
+   cubic metres. */
+  sal::Time MixingTime() const;
+
   Triplet dimensions() const noexcept { return dimensions_; }
 
   static Sample GetFilterResponse(dsp::Filter filter);
+
+  /** Returns the magnitude of the frequency response of `filter` at
+   `frequency`, obtained from the first `length` samples of its impulse
+   response. */
+  static Sample GetFilterResponse(dsp::Filter filter, const Time frequency,
+                                  const Time sampling_frequency,
+                                  const Int length = 1024);
   
   void SetDimensions(const Triplet& dimensions) noexcept {
     dimensions_ = dimensions;
@@ -119,6 +146,19 @@ class CuboidRoom : public Room {
   //
   // 4: floor
   // 5: ceiling
+  /** Returns Sabine's reverberation time for the given reflection gains of
+   the walls (in the order of `CuboidWallId`). */
+  sal::Time SabineRt60(const std::vector<Sample>& betas) const;
+
+  /** Returns the wall of the first reflection of the `index`-th (0 to 3)
+   second-order path between the x and y walls, and writes the reflection
+   point on it into `point`. Positions are relative to the origin of the
+   room. */
+  CuboidWallId SecondOrderReflection(const Int index,
+                                     const dsp::Point& source_pos,
+                                     const dsp::Point& observation_pos,
+                                     dsp::Point& point) const noexcept;
+
   dsp::Point ReflectionPoint(const CuboidWallId face_index,
                              const dsp::Point& source_pos,
                              const dsp::Point& observation_pos) const;
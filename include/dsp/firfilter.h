@@ -123,6 +123,18 @@ class FirFilter {
   size_t length_;
 };
 
+/**
+ Returns the impulse responses of a bank of linear-phase FIR filters that
+ splits the spectrum at `crossover_frequencies` (in increasing order) into
+ `crossover_frequencies.size()+1` bands. All filters have odd length `length`
+ and a delay of (length-1)/2 samples. The bands are differences of
+ Blackman-windowed sinc low-pass filters, so they add up to a pure delay:
+ splitting a signal and summing the bands reconstructs it exactly.
+ */
+std::vector<std::vector<Real>> LinearPhaseCrossover(
+    const std::vector<Real>& crossover_frequencies,
+    const Real sampling_frequency, const Int length);
+
 class GainFilter {
  public:
   GainFilter(const Real gain) : gain_(gain) {}
@@ -0,0 +1,161 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2012-24, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#ifndef SAL_DSP_PARTITIONEDCONVOLVER_H
+#define SAL_DSP_PARTITIONEDCONVOLVER_H
+
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "dsptypes.h"
+
+namespace sal {
+
+namespace dsp {
+
+/**
+ Zero-latency uniformly-partitioned convolution, suitable for long impulse
+ responses such as room impulse responses.
+
+ The impulse response is split into partitions of `partition_size` samples.
+ The first partition is applied in the time domain, so that there is no
+ input-output latency, while the remaining ones are applied in the frequency
+ domain with overlap-save and a frequency-domain delay line. The state is
+ preserved across calls, and input blocks can have any length. Apart from
+ the cases documented below, processing does not allocate memory.
+ */
+class PartitionedConvolver {
+ public:
+  /**
+   Impulse response split into partitions and transformed to the frequency
+   domain. This is the expensive part of an impulse response update, so it
+   can be computed on another thread and then handed over to the convolver
+   with `SwapImpulseResponse`.
+   */
+  class Partitions {
+   public:
+    Partitions() noexcept : partition_size_(0), num_partitions_(0) {}
+
+    Partitions(const std::vector<Real>& impulse_response,
+               const Int partition_size);
+
+    Int partition_size() const noexcept { return partition_size_; }
+
+    Int num_partitions() const noexcept { return num_partitions_; }
+
+    /** Allocates a delay line long enough for these partitions, which
+     `SwapImpulseResponse` takes over if the one of the convolver is shorter,
+     so that the swap does not allocate memory. */
+    void AllocateDelayLine();
+
+   private:
+    friend class PartitionedConvolver;
+
+    Int partition_size_;
+    Int num_partitions_;
+
+    /** First partition, time-reversed */
+    std::vector<Real> head_;
+
+    /** Spectra of the partitions after the first, each of 2*partition_size
+     bins and scaled by the inverse transform normalisation */
+    std::vector<Complex> spectra_;
+
+    /** Delay line handed over to the convolver (empty if not allocated) */
+    std::vector<Complex> delay_line_;
+  };
+
+  PartitionedConvolver(
+      const std::vector<Real>& impulse_response = std::vector<Real>(1, 1.0),
+      const Int partition_size = 256);
+
+  ~PartitionedConvolver();
+
+  PartitionedConvolver(PartitionedConvolver&&) noexcept;
+  PartitionedConvolver& operator=(PartitionedConvolver&&) noexcept;
+
+  Real ProcessSample(const Real input_sample) noexcept;
+
+  void ProcessBlock(std::span<const Real> input_data,
+                    std::span<Real> output_data) noexcept;
+
+  /**
+   Sets a new impulse response, computing its partitions on the calling
+   thread. The output is crossfaded linearly from the old to the new impulse
+   response over `crossfade_length` samples (0 means instantaneous).
+   */
+  void SetImpulseResponse(const std::vector<Real>& impulse_response,
+                          const Int crossfade_length = 0);
+
+  /**
+   Same as `SetImpulseResponse`, for partitions computed in advance. They must
+   have the same partition size as the convolver. On return, `partitions`
+   holds a previous impulse response, so that it is released by the caller.
+   This does not allocate memory unless the new impulse response has more
+   partitions than any previous one and no delay line was allocated with
+   `Partitions::AllocateDelayLine`. In that case the delay line is grown,
+   keeping the input it already holds.
+   */
+  void SwapImpulseResponse(Partitions& partitions,
+                           const Int crossfade_length = 0);
+
+  /** Resets the state of the filter */
+  void ResetState() noexcept;
+
+  Int partition_size() const noexcept { return partition_size_; }
+
+  static bool Test();
+
+ private:
+  struct FftState;
+
+  /** Called when a full partition of input samples has been collected. */
+  void ProcessPartition() noexcept;
+
+  /** Writes the output of partitions after the first for the next
+   `partition_size_` samples into `tail`. */
+  void ComputeTail(const Partitions& partitions, std::span<Real> tail) noexcept;
+
+  /** Makes sure the delay line is long enough for `num_partitions`. */
+  void Reserve(const Int num_partitions);
+
+  /** Replaces the delay line with `delay_line`, which has to be longer,
+   after copying the input spectra into it. On return, `delay_line` holds the
+   previous delay line. */
+  void GrowDelayLine(std::vector<Complex>& delay_line) noexcept;
+
+  Int partition_size_;
+
+  Partitions current_;
+  Partitions previous_;
+
+  Int crossfade_length_;
+  Int crossfade_index_;
+
+  /** Previous and current partition of input samples */
+  std::vector<Real> input_;
+  Int position_;
+
+  /** Frequency-domain delay line of input spectra (circular) */
+  std::vector<Complex> delay_line_;
+  Int delay_line_length_;
+  Int delay_line_index_;
+
+  /** Output of partitions after the first for the current input partition */
+  std::vector<Real> tail_;
+  std::vector<Real> previous_tail_;
+
+  std::unique_ptr<FftState> fft_;
+};
+
+}  // namespace dsp
+
+}  // namespace sal
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#ifndef SAL_FDN_H
+#define SAL_FDN_H
+
+#include <span>
+#include <vector>
+
+#include "delayfilter.h"
+#include "digitalfilter.h"
+#include "saltypes.h"
+
+namespace sal {
+
+enum FdnMatrixType {
+  /** Normalised Hadamard matrix, applied with a fast Walsh-Hadamard
+   transform in O(N log N). The number of lines has to be a power of 2. */
+  kHadamardMatrix,
+  /** Householder matrix I - 2/N 1 1^T, applied in O(N) */
+  kHouseholderMatrix
+};
+
+/**
+ Feedback delay network (FDN) late reverberator. Each line is a `DelayFilter`
+ followed by an absorption filter, and the outputs of the absorption filters
+ are fed back to the lines through an orthogonal (lossless) matrix, so that
+ the decay is set by the absorption filters alone. The input is fed to all
+ lines with gain 1/sqrt(N), and the output is the sum of the outputs of the
+ absorption filters with gain 1/sqrt(N).
+
+ Processing is done in chunks of up to the shortest delay, over which the
+ lines do not depend on each other: each step operates on whole chunks
+ (filtering, feedback matrix butterflies, gains), which keeps the inner
+ loops contiguous and vectorisable. Processing does not allocate memory.
+ */
+class Fdn {
+ public:
+  /**
+   @param[in] delays Lengths of the delay lines in samples (e.g. from
+   `CoprimeDelays`).
+   @param[in] matrix_type Type of the feedback matrix.
+   */
+  Fdn(const std::vector<Int>& delays, const Time sampling_frequency,
+      const FdnMatrixType matrix_type = kHadamardMatrix);
+
+  /**
+   Sets frequency-independent absorption, so that the output decays by 60 dB
+   in `rt60` seconds.
+   */
+  void SetReverberationTime(const Time rt60);
+
+  /**
+   Sets frequency-dependent absorption: the absorption filter of each line is
+   a graphic equaliser with the gains that give a decay of 60 dB in
+   `rt60s[i]` seconds at `centre_frequencies[i]` (e.g. the octave bands with
+   `CuboidRoom::SabineRt60` evaluated at each of them). At least two bands are
+   needed.
+   */
+  void SetReverberationTime(const std::vector<Time>& centre_frequencies,
+                            const std::vector<Time>& rt60s);
+
+  Sample ProcessSample(const Sample input_sample) noexcept;
+
+  void ProcessBlock(std::span<const Sample> input_data,
+                    std::span<Sample> output_data) noexcept;
+
+  /** Resets the state of the lines and of the absorption filters */
+  void ResetState() noexcept;
+
+  Int num_lines() const noexcept { return num_lines_; }
+
+  /**
+   Returns `num_lines` mutually co-prime delays (in samples), spread
+   geometrically between `min_delay` and about `max_delay`.
+   */
+  static std::vector<Int> CoprimeDelays(const Int num_lines,
+                                        const Int min_delay,
+                                        const Int max_delay);
+
+  static bool Test();
+
+ private:
+  /** Processes `num_samples` samples, which cannot be more than
+   `chunk_length_`. */
+  void ProcessChunk(std::span<const Sample> input_data,
+                    std::span<Sample> output_data) noexcept;
+
+  /** Applies the feedback matrix in place to the chunks of all lines */
+  void ApplyFeedbackMatrix(const Int num_samples) noexcept;
+
+  /** Returns the gain of a line of `delay` samples for a decay of 60 dB in
+   `rt60` seconds. */
+  Sample LineGain(const Int delay, const Time rt60) const noexcept;
+
+  Int num_lines_;
+  Time sampling_frequency_;
+  FdnMatrixType matrix_type_;
+  std::vector<Int> delays_;
+
+  /** Maximum number of samples processed at once, i.e. the shortest delay */
+  Int chunk_length_;
+
+  std::vector<DelayFilter> lines_;
+  std::vector<dsp::Filter> absorption_filters_;
+
+  /** Output of the lines and of the absorption filters for the current
+   chunk, one line after the other (`chunk_length_` samples each) */
+  std::vector<Sample> delayed_;
+  std::vector<Sample> absorbed_;
+};
+
+}  // namespace sal
+
+#endif
@@ -11,12 +11,215 @@
 #ifndef SAL_FDTD_H
 #define SAL_FDTD_H
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
 #include "cuboidroom.h"
+#include "meshroom.h"
 #include "microphone.h"
+#include "rircache.h"
 #include "source.h"
+#include "threadpool.h"
 
 namespace sal {
 
+/**
+ Field on a grid of `size_x` x `size_y` x `size_z` points, stored in a single
+ contiguous buffer with z as the fastest varying index. Each z row is padded
+ to a multiple of `kAlignment` bytes and starts at an aligned address, so that
+ the points along z can be processed with aligned vector instructions, and
+ neighbours along x and y are at a constant offset (`stride_x()` and
+ `stride_y()`) from each point. All points are initialised to zero.
+ */
+class FdtdGrid {
+ public:
+  static constexpr size_t kAlignment = 64;
+
+  FdtdGrid(const Int size_x, const Int size_y, const Int size_z);
+
+  FdtdGrid(const FdtdGrid&) = delete;
+  FdtdGrid& operator=(const FdtdGrid&) = delete;
+  FdtdGrid(FdtdGrid&&) noexcept = default;
+  FdtdGrid& operator=(FdtdGrid&&) noexcept = default;
+
+  /** Linear index of the point (x, y, z) */
+  Int Index(const Int x, const Int y, const Int z) const noexcept {
+    return (x * size_y_ + y) * stride_y_ + z;
+  }
+
+  Sample& at(const Int x, const Int y, const Int z) noexcept {
+    return data_[Index(x, y, z)];
+  }
+
+  Sample* data() noexcept { return data_; }
+  const Sample* data() const noexcept { return data_; }
+
+  Int stride_x() const noexcept { return size_y_ * stride_y_; }
+  Int stride_y() const noexcept { return stride_y_; }
+
+  /** Number of elements in the buffer, including padding */
+  Int size() const noexcept { return size_x_ * stride_x(); }
+
+ private:
+  Int size_x_;
+  Int size_y_;
+  Int stride_y_;
+  std::vector<Sample> storage_;
+  /** First aligned element of `storage_` */
+  Sample* data_;
+};
+
+/** Indices of a point of an FDTD grid */
+struct FdtdGridPoint {
+  Int x;
+  Int y;
+  Int z;
+};
+
+/**
+ Geometry of an FDTD simulation on a grid of `size_x` x `size_y` x `size_z`
+ points. Each point has a number of neighbours in air K: K = 6 for air, 0 < K
+ < 6 for boundary points (K = 5 on faces, 4 on edges and 3 on corners of a
+ cuboid) and K = 0 for points that are not updated (outside the domain).
+
+ Air points are not stored individually: each row along z only stores the
+ runs of consecutive air points, which are updated with a branch-free
+ stencil. Boundary points are stored in a separate, compact list per row,
+ together with their K and their specific admittance `xi`. Memory is then
+ proportional to the number of rows and boundary points, rather than to the
+ number of points in the grid.
+ */
+class FdtdGeometry {
+ public:
+  struct BoundaryPoint {
+    Int z;
+    Int num_neighbours;
+    Sample xi;
+  };
+
+  /** Range [begin, end) of air points along z */
+  struct AirRun {
+    Int begin;
+    Int end;
+  };
+
+  /** Creates a geometry where no point is updated */
+  FdtdGeometry(const Int size_x, const Int size_y, const Int size_z);
+
+  /**
+   Creates a geometry from the K of each point, e.g. from
+   `Fdtd::CreateGeometry`, with the same `xi` for all boundary points. Points
+   on the outer layer of the grid are never updated, irrespective of `G`.
+   */
+  FdtdGeometry(const std::vector<std::vector<std::vector<Int> > >& G,
+               const Sample xi);
+
+  /**
+   Geometry of a cuboid room of `Nx` x `Ny` x `Nz` points, with an outer
+   layer of points that are not updated (i.e. the grid has `Nx + 2` x
+   `Ny + 2` x `Nz + 2` points). It is the same as
+   `FdtdGeometry(Fdtd::CreateGeometry(Nx, Ny, Nz), xi)`.
+   */
+  static FdtdGeometry Cuboid(const Int Nx, const Int Ny, const Int Nz,
+                             const Sample xi);
+
+  /**
+   Geometry of the inside of a closed `mesh`, on a grid with `spacing`
+   between neighbouring points, where point (x, y, z) is at
+   `MeshOrigin(mesh, spacing) + spacing * (x, y, z)`. Points inside the mesh
+   are updated, with K the number of their neighbours that are also inside,
+   and the grid has an outer layer of points outside of the mesh. The `xi`
+   of each boundary point is `xi[material]`, for the material of the
+   triangle crossed on the way to its closest neighbour outside of the mesh.
+   Compact schemes assume air points to have all 26 neighbours in the
+   domain, which may not be the case near concave edges of the mesh.
+   */
+  static FdtdGeometry FromMesh(const TriangleMesh& mesh, const Length spacing,
+                               std::span<const Sample> xi);
+
+  /** Position of point (0, 0, 0) of `FromMesh(mesh, spacing, xi)`, which is
+   on the grid of points at integer multiples of `spacing` */
+  static dsp::Point MeshOrigin(const TriangleMesh& mesh,
+                               const Length spacing) noexcept;
+
+  /**
+   Sets the points of row (x, y), replacing the previous ones.
+   `num_neighbours[z]` is the K of point (x, y, z) and `xi[z]` its specific
+   admittance (only used for boundary points).
+   */
+  void SetRow(const Int x, const Int y, std::span<const Int> num_neighbours,
+              std::span<const Sample> xi);
+
+  const std::vector<AirRun>& air_runs(const Int x, const Int y) const {
+    return air_runs_[RowIndex(x, y)];
+  }
+
+  const std::vector<BoundaryPoint>& boundary_points(const Int x,
+                                                    const Int y) const {
+    return boundary_points_[RowIndex(x, y)];
+  }
+
+  /** Returns the K of point (x, y, z) */
+  Int NumNeighbours(const Int x, const Int y, const Int z) const;
+
+  Int size_x() const noexcept { return size_x_; }
+  Int size_y() const noexcept { return size_y_; }
+  Int size_z() const noexcept { return size_z_; }
+
+  Int num_boundary_points() const noexcept;
+
+ private:
+  Int RowIndex(const Int x, const Int y) const noexcept {
+    ASSERT(x >= 0 && x < size_x_ && y >= 0 && y < size_y_);
+    return x * size_y_ + y;
+  }
+
+  Int size_x_;
+  Int size_y_;
+  Int size_z_;
+  std::vector<std::vector<AirRun> > air_runs_;
+  std::vector<std::vector<BoundaryPoint> > boundary_points_;
+};
+
+/**
+ Compact explicit FDTD schemes, as described in K. Kowalczyk and M. van
+ Walstijn, "Room acoustics simulation using 3-D compact explicit FDTD
+ schemes", IEEE Trans. Audio, Speech, Language Process., 2011. The schemes
+ differ in how the Laplacian is approximated on the 27-point cube around
+ each point, which sets their dispersion and their maximum Courant number
+ (see `Fdtd::CourantNumber`). With a larger Courant number, the grid can be
+ coarser for the same sampling frequency: e.g. `kInterpolatedWideband` needs
+ about 5 times fewer points than `kStandardRectilinear`, and it has lower
+ and more isotropic dispersion error.
+ */
+enum FdtdScheme {
+  /** Standard rectilinear (7-point) scheme, with Courant number 1/sqrt(3) */
+  kStandardRectilinear,
+  /** Interpolated isotropic scheme, with Courant number sqrt(3/4) */
+  kInterpolatedIsotropic,
+  /** Interpolated wideband scheme, with Courant number 1 */
+  kInterpolatedWideband
+};
+
+/** Settings for checkpointing FDTD simulations (see `Fdtd::SetCheckpoint`) */
+struct FdtdCheckpointSettings {
+  /** File checkpoints are written to and resumed from. If empty,
+   checkpointing is disabled. */
+  std::string path;
+
+  /** Number of time steps between checkpoints */
+  Int interval = 0;
+
+  /** If set, it is called at every time step: when it returns true, a
+   checkpoint is written and the simulation stops. */
+  std::function<bool()> stop;
+};
+
 class Fdtd {
  private:
   Room* const room_;
@@ -29,12 +232,101 @@ class Fdtd {
 
   std::vector<sal::Sample> rir_;
 
+  RirCache* rir_cache_;
+
+  std::unique_ptr<ThreadPool> thread_pool_;
+
+  FdtdScheme scheme_;
+
+  FdtdCheckpointSettings checkpoint_;
+
+  /** Generation of the runs (from the third bit on), and whether a run is
+   in progress (`kRunning`) and has to stop (`kStopRequested`) */
+  std::atomic<uint64_t> run_state_;
+  static constexpr uint64_t kStopRequested = 1;
+  static constexpr uint64_t kRunning = 2;
+
+  /** Marks the start of a run, with a new generation */
+  void BeginRun() noexcept;
+
+  /** Marks the end of a run. Returns true if it was stopped. */
+  bool EndRun() noexcept;
+
+  /** Size in bytes of the part of the grid the stencil is applied to at
+   once (see `RunFdtd`), which should fit in the L2 cache */
+  static constexpr sal::Int kTileBytes = 128 * 1024;
+
+  /**
+   Runs the simulation for `Nt` samples and returns the pressure at each of
+   `microphones` (one signal per microphone), all from the same run. Each of
+   `sources` is a soft source driven by the corresponding signal in
+   `source_signals`. Since the simulation is linear, the output is the
+   superposition of the responses to each source. Sources outside of the
+   domain (points that are not updated) are ignored. At each time step, air
+   points are updated first and boundary points are updated in a separate
+   pass. If `thread_pool` is not null, each time step is split into slabs
+   along x, which are processed in parallel. The result does not depend on
+   the number of threads.
+
+   If `checkpoint.path` is not empty, the state of the simulation (pressure
+   at the last two time steps and outputs so far) is written there every
+   `checkpoint.interval` time steps. Checkpoints are written by a separate
+   thread from a copy of the state, so that the simulation does not wait for
+   the file system (a checkpoint is skipped if the previous one is still
+   being written). If the file exists when the simulation starts, and it was
+   written by a simulation with the same parameters, the simulation resumes
+   from it. The file is removed when the simulation completes.
+
+   With a compact scheme (other than `kStandardRectilinear`), air points are
+   updated with the 27-point stencil of the scheme, and boundary points with
+   the same stencil where neighbours outside of the domain are replaced by
+   their mirror images across the boundary, with a loss term for each
+   boundary direction. Air points are assumed to have all their 26
+   neighbours in the domain (which is the case e.g. for cuboid rooms).
+   */
+  static std::vector<sal::Signal> RunFdtd(
+      const FdtdGeometry& geometry, sal::Int Nt,
+      const std::vector<FdtdGridPoint>& sources,
+      const std::vector<std::span<const Sample> >& source_signals,
+      const std::vector<FdtdGridPoint>& microphones, sal::Sample lmb,
+      ThreadPool* thread_pool = nullptr,
+      const FdtdCheckpointSettings& checkpoint = FdtdCheckpointSettings(),
+      const FdtdScheme scheme = kStandardRectilinear);
+
+  /** Parameters a and b of the compact scheme, which weigh the edge and
+   corner neighbours in the Laplacian */
+  static void SchemeParameters(const FdtdScheme scheme, sal::Sample& a,
+                               sal::Sample& b) noexcept;
+
+  /** Same as above, with a single source and a single microphone */
+  static sal::Signal RunFdtd(const FdtdGeometry& geometry, sal::Int Nt,
+                             std::span<const Sample> signal, sal::Sample lmb,
+                             sal::Int source_x, sal::Int source_y,
+                             sal::Int source_z, sal::Int microphone_x,
+                             sal::Int microphone_y, sal::Int microphone_z,
+                             ThreadPool* thread_pool = nullptr);
+
+  /**
+   Same as above, for a room of `Nx` x `Ny` x `Nz` points with geometry `G`
+   (which includes the outer layer of points). Positions are counted from 1,
+   i.e. `position_x` is at index `position_x - 1` of `G`.
+   */
   static sal::Signal RunFdtd(
       sal::Int Nx, sal::Int Ny, sal::Int Nz, sal::Int Nt,
       std::vector<std::vector<std::vector<sal::Int> > > G, sal::Sample xi,
       std::span<const Sample> signal, sal::Sample lmb, sal::Int position_x,
       sal::Int position_y, sal::Int position_z, sal::Int position_m_x,
-      sal::Int position_m_y, sal::Int position_m_z);
+      sal::Int position_m_y, sal::Int position_m_z,
+      ThreadPool* thread_pool = nullptr);
+
+  /** Distance between neighbouring points of the grid */
+  sal::Length GridSpacing() const noexcept;
+
+  /** Returns the grid point closest to `position` */
+  FdtdGridPoint GridPoint(const dsp::Point& position) const noexcept;
+
+  /** Geometry of the room */
+  FdtdGeometry RoomGeometry() const;
 
   template <class T>
   static void Initialise3DArray(
@@ -50,14 +342,78 @@ class Fdtd {
   }
 
  public:
+  /**
+   `room` is either a `CuboidRoom`, whose walls all have normalised
+   impedance `xi`, or a `MeshRoom`, which is voxelized with `FdtdGeometry::FromMesh`
+   and whose walls have the impedances of their filters (`xi` is then not
+   used).
+   */
   Fdtd(Room* const room, sal::Source* const source,
        sal::Microphone* const microphone, const sal::Time sampling_frequency,
        sal::Sample xi, sal::Sample lmb);
 
   void Run(const MonoBuffer& input_buffer, Buffer& output_buffer);
 
+  /**
+   Runs a single simulation with sources at `source_positions`, each driven
+   by the corresponding signal in `source_signals` (the responses to the
+   sources are superposed), and returns the pressure at each of
+   `microphone_positions`. With a single source driven by an impulse, this
+   gives the RIRs of all microphones for the cost of one simulation. The
+   source and the microphones of the constructor are not used. The outputs
+   have the length of the longest source signal.
+   */
+  std::vector<sal::Signal> Run(
+      const std::vector<dsp::Point>& source_positions,
+      const std::vector<sal::Signal>& source_signals,
+      const std::vector<dsp::Point>& microphone_positions);
+
   sal::Signal rir() const { return rir_; }
 
+  /**
+   Looks up results in `cache` before running the simulation, and adds new
+   ones to it. Positions are quantised to the simulation grid, and the key
+   includes the input signal. Pass `nullptr` to disable caching.
+   */
+  void SetRirCache(RirCache* cache) { rir_cache_ = cache; }
+
+  /**
+   Sets the number of threads used by `Run`. With 0, the number of hardware
+   threads is used. The default is 1 (no worker threads).
+   */
+  void SetNumThreads(const sal::Int num_threads);
+
+  /**
+   Enables checkpointing of the simulations run by `Run`: every `interval`
+   time steps the state is written to `path` without stalling the
+   simulation, and a simulation that is run again with the same parameters
+   (e.g. after a crash) resumes from the last checkpoint. The file is removed
+   when the simulation completes. An empty `path` disables checkpointing.
+   */
+  void SetCheckpoint(const std::string& path, const sal::Int interval);
+
+  /**
+   Sets the scheme used by `Run`, together with its Courant number (which
+   replaces `lmb` of the constructor). The grid spacing is c / (lambda * fs),
+   so schemes with a larger Courant number run on coarser grids. The default
+   is `kStandardRectilinear`.
+   */
+  void SetScheme(const FdtdScheme scheme);
+
+  /** Largest Courant number for which `scheme` is stable, which is also the
+   one with the lowest dispersion error */
+  static sal::Sample CourantNumber(const FdtdScheme scheme) noexcept;
+
+  /**
+   Stops the simulation that is currently running, after writing a
+   checkpoint (if enabled). It can be called from another thread, e.g. when
+   the process is about to be preempted. The outputs of the stopped `Run`
+   only contain the samples computed so far, and they are not added to the
+   RIR cache. It has no effect if no simulation is running, and it never
+   stops a simulation started after the call.
+   */
+  void Stop() noexcept;
+
   static std::vector<std::vector<std::vector<sal::Int> > > CreateGeometry(
       sal::Int Nx, sal::Int Ny, sal::Int Nz);
 
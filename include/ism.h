@@ -9,10 +9,15 @@
 #ifndef SAL_ISM_H
 #define SAL_ISM_H
 
+#include <memory>
+
+#include "asyncrirconvolver.h"
 #include "cuboidroom.h"
 #include "delayfilter.h"
 #include "firfilter.h"
 #include "microphone.h"
+#include "partitionedconvolver.h"
+#include "rircache.h"
 #include "source.h"
 
 namespace sal {
@@ -36,26 +41,166 @@ class Ism {
   std::vector<sal::Time> images_delay_;
   std::vector<dsp::Point> images_position_;
 
-  std::vector<sal::DelayFilter> images_int_delay_filter_;
-  std::vector<dsp::FirFilter> images_frac_delay_filter_;
+  /** Windowed sinc used by the Peterson interpolation, sampled at
+   `kPetersonOversampling` fractional delays (one row per fractional delay,
+   plus one for a delay of one sample). */
+  std::vector<sal::Sample> peterson_table_;
+  sal::Int peterson_table_width_;
+  /** Offset with respect to the integer delay of the first tap in a row */
+  sal::Int peterson_table_offset_;
+  sal::Time peterson_table_window_;
+  sal::Time peterson_table_sampling_frequency_;
+
+  static const sal::Int kPetersonOversampling = 128;
 
   bool modified_;
 
+  /** Convolution engine, updated only when the RIR changes */
+  dsp::PartitionedConvolver convolver_;
+  std::unique_ptr<AsyncRirConvolver> async_convolver_;
+
+  /** Positions, dimensions of the room and settings of an asynchronous
+   update, from which the RIR is computed without accessing this object */
+  struct AsyncScene;
+  /** Shared with the worker thread: the scenes handed over by `Update()` */
+  struct AsyncState;
+  std::shared_ptr<AsyncState> async_state_;
+
+  /** Output of the convolution before it is passed on to the microphone */
+  std::vector<sal::Sample> scratch_;
+
+  /** Directions (unit vectors) onto which images are binned for directional
+   microphones */
+  std::vector<dsp::Point> direction_bins_;
+  dsp::Point direct_direction_;
+  /** One RIR and one convolver per direction bin, plus one for the direct
+   path (the last one) */
+  std::vector<std::vector<sal::Sample>> bin_rirs_;
+  std::vector<dsp::PartitionedConvolver> bin_convolvers_;
+
+  static const sal::Int kDefaultNumDirectionBins = 64;
+
+  RirCache* rir_cache_;
+  sal::Length cache_tolerance_;
+
+  /** Centre frequencies of the bands (empty for broadband synthesis) */
+  std::vector<sal::Time> band_frequencies_;
+  /** Linear-phase crossover filters, one per band */
+  std::vector<std::vector<sal::Sample>> crossover_filters_;
+  /** Sparse RIRs of each band, for the omnidirectional RIR first and then for
+   each direction bin */
+  std::vector<std::vector<sal::Sample>> band_rirs_;
+
+  /** Time after which images are replaced by a statistical tail (0 to
+   compute images over the whole RIR) */
+  sal::Time mixing_time_;
+
+  /** Energy threshold (in dB) at which the expansion of the image lattice
+   stops (0 to disable) */
+  sal::Sample energy_threshold_;
+  /** Whether `rir_length_` is derived from the decay of the room */
+  bool automatic_length_;
+
   void CalculateRir();
 
-  void WriteSample(const sal::Time& delay_norm, const sal::Sample& gid);
+  /** Recomputes `peterson_table_` if the window or sampling frequency have
+   changed since it was last computed. */
+  void UpdatePetersonTable();
+
+  void WriteSample(const sal::Time& delay_norm, const sal::Sample& gid,
+                   std::span<sal::Sample> rir);
+
+  /**
+   Adds the statistical tail from `mixing_sample` to the end of the RIRs (or
+   of the band RIRs in multi-band mode). `window_energies` holds, for each
+   band, the energy of the images (sum of their squared amplitudes, except
+   for the direct path) between half the mixing time and the mixing time,
+   which the tail is matched to.
+   */
+  void AddLateReverberation(std::span<const sal::Sample> window_energies,
+                            const sal::Int mixing_sample,
+                            const bool directional);
+
+  /** Returns the RIR length at which the decay of the room, according to
+   Sabine's formula, reaches `energy_threshold_`. */
+  sal::Int AutomaticLength() const;
+
+  /** Filters each of `bands` with its crossover filter and writes their sum
+   into `rir`, compensating for the delay of the filters. */
+  void MergeBands(std::span<const std::vector<sal::Sample>> bands,
+                  std::vector<sal::Sample>& rir) const;
+
+  /** Returns the key identifying the current scene in `rir_cache_` */
+  uint64_t CacheKey() const;
+
+  /** Returns the index of the direction bin closest to `direction` */
+  sal::Int NearestDirectionBin(const dsp::Point& direction) const noexcept;
 
  public:
   Ism(Room* const room, sal::Source* const source,
       sal::Microphone* const microphone, IsmInterpolation interpolation,
       sal::Int rir_length, const sal::Time sampling_frequency);
 
+  /** Waits for an asynchronous update in progress, if any */
+  ~Ism();
+
   void ProcessBlock(std::span<const Sample> input_data, Buffer& output_buffer);
 
   // Triggers a self-update of the network. Has to be called after microphone,
   // room or source (not including stream push) is updated.
   void Update();
 
+  /**
+   Enables or disables the asynchronous mode. In asynchronous mode, `Update()`
+   hands the positions of the source and of the microphone, the dimensions of
+   the room and the settings over to a background thread (without taking
+   locks or allocating memory), which recomputes the RIR from them, while
+   `ProcessBlock` keeps filtering with the previous RIR. Once ready, the new
+   RIR is crossfaded in over `crossfade_length` samples. The scene can
+   therefore be modified while an update is in progress. The wall filters,
+   the frequency bands and the RIR cache are those set when the asynchronous
+   mode was enabled, and `rir()` and `images_delay()` are those computed at
+   that time. Only cuboid rooms and omnidirectional microphones are supported
+   in asynchronous mode.
+   */
+  void SetAsynchronous(const bool asynchronous,
+                       const Int crossfade_length = 512);
+
+  /** Returns true if an asynchronous RIR update is in progress */
+  bool IsUpdating() const {
+    return async_convolver_ && async_convolver_->IsUpdating();
+  }
+
+  /**
+   Sets the directions (in the world reference system) onto which the images
+   are binned when the microphone is not omnidirectional. Each bin gets its
+   own RIR and the microphone is applied once per bin, so that the cost
+   scales with the number of bins rather than the number of images. The
+   direct path always gets a bin of its own, with its exact direction.
+   Directions do not need to be normalised. By default, 64 directions
+   uniformly distributed on the sphere are used.
+   */
+  void SetDirectionBins(const std::vector<dsp::Point>& directions);
+
+  /** Returns `num_directions` unit vectors approximately uniformly distributed
+   on the sphere (Fibonacci lattice). */
+  static std::vector<dsp::Point> UniformDirections(const sal::Int num_directions);
+
+  /**
+   Computes the RIRs between each of `source_positions` and each of
+   `receiver_positions` (omnidirectional) in the room of this object, with
+   its RIR length, sampling frequency and interpolation. The image lattice
+   and the reflection gains are computed once for all pairs. The RIRs are
+   returned in a contiguous vector, where sample `n` of the RIR from source
+   `s` to receiver `r` is at index `(s * num_receivers + r) * rir_length + n`.
+   The wall filters are treated as frequency independent, and frequency
+   bands, randomisation, the statistical tail and pruning are not applied.
+   */
+  std::vector<sal::Sample> CalculateRirs(
+      const std::vector<dsp::Point>& source_positions,
+      const std::vector<dsp::Point>& receiver_positions);
+
+  /** Returns the RIR, including all directions. */
   std::vector<sal::Sample> rir() { return rir_; }
   std::vector<sal::Time> images_delay() { return images_delay_; }
 
@@ -63,6 +208,61 @@ class Ism {
 
   void SetRandomDistance(sal::Length distance) { random_distance_ = distance; }
 
+  /**
+   Enables multi-band synthesis. The reflection gain of each image is
+   evaluated at each of `centre_frequencies` (e.g. `OctaveBands(fs)`) from
+   the frequency responses of the wall filters, one sparse RIR is
+   accumulated per band, and the bands are merged with a linear-phase
+   crossover bank (with crossovers halfway between adjacent centre
+   frequencies, on a log scale). An empty vector restores broadband
+   synthesis, where the wall filters are treated as frequency independent.
+   */
+  void SetFrequencyBands(const std::vector<sal::Time>& centre_frequencies);
+
+  /** Returns the octave-band centre frequencies from 125 Hz whose upper edge
+   is below the Nyquist frequency. */
+  static std::vector<sal::Time> OctaveBands(const sal::Time sampling_frequency);
+
+  /**
+   Enables hybrid synthesis: images are only computed up to `mixing_time`
+   (e.g. `CuboidRoom::MixingTime()`), and the rest of the RIR is filled with
+   exponentially decaying Gaussian noise. The decay of each band follows
+   `CuboidRoom::SabineRt60` (evaluated at the band centre in multi-band mode,
+   and with the broadband wall gains otherwise), and the level is matched to
+   the energy of the images just before the mixing time. The noise is
+   seeded, so that the RIR is reproducible. For directional microphones, the
+   tail is spread over the direction bins as a diffuse field. A mixing time
+   of 0 disables the statistical tail.
+   */
+  void SetLateReverberation(const sal::Time mixing_time);
+
+  /**
+   Enables energy-based pruning of the images. The image lattice is expanded
+   in shells of increasing reflection order (Chebyshev norm of the lattice
+   indices), and the expansion stops at the first shell whose energy is
+   below `threshold_db` (e.g. -60) relative to the energy of the images
+   computed so far. If `automatic_length` is true, the RIR length is set to
+   the time it takes the Sabine decay of the room (the slowest band in
+   multi-band mode) to reach `threshold_db`, starting from the direct path.
+   A threshold of 0 disables pruning.
+   */
+  void SetEnergyThreshold(const sal::Sample threshold_db,
+                          const bool automatic_length = false);
+
+  sal::Int rir_length() const noexcept { return rir_length_; }
+
+  /**
+   Looks up RIRs in `cache` before computing them, and adds newly computed
+   ones to it. Scenes whose positions and dimensions differ by less than
+   `tolerance` (after quantisation) share the same RIR. When a RIR is taken
+   from the cache, `images_delay()` is empty. Only omnidirectional
+   microphones are cached. Pass `nullptr` to disable caching.
+   */
+  void SetRirCache(RirCache* cache, const sal::Length tolerance = 0.001) {
+    rir_cache_ = cache;
+    cache_tolerance_ = tolerance;
+  }
+
   static bool Test();
 };
 
@@ -0,0 +1,219 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#ifndef SAL_MESHROOM_H
+#define SAL_MESHROOM_H
+
+#include <array>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "iirfilter.h"
+#include "point.h"
+#include "room.h"
+#include "saltypes.h"
+
+namespace sal {
+
+/**
+ Closed triangle mesh describing the surface of a room. Each triangle has a
+ material, which indexes the wall filters of a `MeshRoom`. Meshes can be
+ loaded from Wavefront OBJ files (with one material per `usemtl` name) and
+ from ASCII PLY files (with the material from an optional integer
+ `material` property of the faces).
+ */
+class TriangleMesh {
+ public:
+  struct Triangle {
+    /** Indices of the vertices, counter-clockwise when seen from the side
+     the normal points to */
+    std::array<Int, 3> vertices;
+    Int material;
+  };
+
+  TriangleMesh() {}
+
+  TriangleMesh(const std::vector<dsp::Point>& vertices,
+               const std::vector<Triangle>& triangles,
+               const std::vector<std::string>& material_names);
+
+  /**
+   Loads the mesh in the OBJ file at `path`. Polygons with more than three
+   vertices are split in triangles, and materials are numbered in the order
+   of their first `usemtl` statement (faces before it use a material named
+   "default"). Returns false, leaving `mesh` unchanged, if the file cannot
+   be read or parsed.
+   */
+  static bool LoadObj(const std::string& path, TriangleMesh& mesh);
+
+  /** Same as `LoadObj`, for an ASCII PLY file. Material `k` is named
+   "material_k". */
+  static bool LoadPly(const std::string& path, TriangleMesh& mesh);
+
+  /** Loads an OBJ or PLY file, depending on its extension */
+  static bool Load(const std::string& path, TriangleMesh& mesh);
+
+  /** Cuboid with a corner at the origin, with outward normals. The
+   materials are the walls in the order of `CuboidWallId`. */
+  static TriangleMesh Cuboid(const Length x, const Length y, const Length z);
+
+  const std::vector<dsp::Point>& vertices() const noexcept {
+    return vertices_;
+  }
+  const std::vector<Triangle>& triangles() const noexcept {
+    return triangles_;
+  }
+  const std::vector<std::string>& material_names() const noexcept {
+    return material_names_;
+  }
+  Int num_triangles() const noexcept { return (Int)triangles_.size(); }
+  Int num_materials() const noexcept { return (Int)material_names_.size(); }
+
+  const dsp::Point& Vertex(const Int triangle, const Int k) const noexcept {
+    return vertices_[triangles_[triangle].vertices[k]];
+  }
+
+  /** Unit normal of a triangle, from the order of its vertices */
+  dsp::Point Normal(const Int triangle) const noexcept;
+
+  Length Area(const Int triangle) const noexcept;
+
+  /** Volume enclosed by the mesh. It is negative if the normals point
+   inwards. */
+  Length Volume() const noexcept;
+
+  /** Corners of the bounding box */
+  dsp::Point min_corner() const noexcept { return min_corner_; }
+  dsp::Point max_corner() const noexcept { return max_corner_; }
+
+  /** Returns true if `point` is inside the (closed) mesh, from the parity
+   of the number of triangles crossed by a ray along z */
+  bool IsPointInside(const dsp::Point& point) const noexcept;
+
+  /** Distance from `point` to the closest triangle, whose index is written
+   into `triangle` */
+  Length Distance(const dsp::Point& point, Int& triangle) const noexcept;
+
+  /** Point of `triangle` closest to `point` */
+  dsp::Point ClosestPoint(const Int triangle,
+                          const dsp::Point& point) const noexcept;
+
+  /**
+   Offset applied to points before classifying them as inside or outside of
+   the mesh (relative to the grid spacing, for grids). Points exactly on a
+   face, edge or vertex are then consistently on one side, e.g. for grids
+   aligned with axis-parallel walls.
+   */
+  static dsp::Point InsideTestOffset(const Length spacing) noexcept {
+    return dsp::Point(1.1E-7 * spacing, 1.3E-7 * spacing, 1.7E-7 * spacing);
+  }
+
+  /**
+   If the line parallel to `axis` (0, 1 or 2 for x, y or z) through the
+   point with coordinates `u` and `v` along the next two axes (in cyclic
+   order) crosses the triangle (a, b, c), writes the coordinate of the
+   crossing along `axis` into `w` and returns true. Triangles parallel to
+   the line are not crossed.
+   */
+  static bool LineCrossing(const dsp::Point& a, const dsp::Point& b,
+                           const dsp::Point& c, const Int axis,
+                           const Length u, const Length v,
+                           Length& w) noexcept;
+
+  /** Coordinate of `point` along `axis` (0, 1 or 2 for x, y or z) */
+  static Length Coordinate(const dsp::Point& point, const Int axis) noexcept {
+    return (axis == 0) ? point.x() : ((axis == 1) ? point.y() : point.z());
+  }
+
+  static bool Test();
+
+ private:
+  static bool ReadObj(std::istream& stream, TriangleMesh& mesh);
+  static bool ReadPly(std::istream& stream, TriangleMesh& mesh);
+
+  std::vector<dsp::Point> vertices_;
+  std::vector<Triangle> triangles_;
+  std::vector<std::string> material_names_;
+  dsp::Point min_corner_;
+  dsp::Point max_corner_;
+};
+
+/**
+ Room of arbitrary shape, described by a closed triangle mesh. There is one
+ wall filter per material of the mesh. The boundary points are the points of
+ specular reflection on each triangle (moved to the closest point of the
+ triangle when the reflection falls outside of it), so that the room can
+ also be used with the geometrical models, e.g. `Sdn`.
+ */
+class MeshRoom : public Room {
+ public:
+  MeshRoom(const TriangleMesh& mesh,
+           const std::vector<dsp::Filter>& wall_filters);
+
+  MeshRoom(const TriangleMesh& mesh, const dsp::Filter& wall_filter);
+
+  const TriangleMesh& mesh() const noexcept { return mesh_; }
+
+  /**
+   Normalised specific acoustic impedance of each material, from the
+   reflection coefficient R of its wall filter at DC: (1 + R) / (1 - R).
+   Rigid walls (R = 1) are given a large finite impedance.
+   */
+  std::vector<Sample> WallImpedances() const;
+
+  /** Unit normal of `triangle`, pointing into the room */
+  dsp::Point InwardNormal(const Int triangle) const noexcept;
+
+  using Room::CalculateBoundaryPoints;
+
+  virtual std::vector<dsp::Point> CalculateBoundaryPoints(
+      const dsp::Point& source, const dsp::Point& destination) const noexcept;
+
+  virtual void CalculateBoundaryPoints(
+      const dsp::Point& source, const dsp::Point& destination,
+      std::span<dsp::Point> boundary_points) const noexcept;
+
+  virtual std::vector<dsp::Filter> GetBoundaryFilters(
+      const dsp::Point& source_point,
+      const dsp::Point& mic_point) const noexcept;
+
+  virtual void GetBoundaryWallIds(const dsp::Point& source_point,
+                                  const dsp::Point& mic_point,
+                                  std::span<sal::Int> wall_ids) const noexcept;
+
+  virtual sal::Int num_boundary_points() const noexcept {
+    return mesh_.num_triangles();
+  }
+
+  virtual sal::Int num_faces() const noexcept {
+    return mesh_.num_materials();
+  }
+
+  /** Diagonal of the bounding box, which is an upper bound */
+  virtual sal::Length max_distance() const noexcept;
+
+  virtual bool IsPointInRoom(
+      const dsp::Point& point,
+      const sal::Length wall_distance = 0.0) const noexcept;
+
+  virtual std::string ShapeDescription() const noexcept;
+
+  virtual ~MeshRoom() {}
+
+  static bool Test();
+
+ private:
+  TriangleMesh mesh_;
+  /** +1 if the normals of the mesh point out of the room, -1 otherwise */
+  Sample orientation_;
+};
+
+}  // namespace sal
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#ifndef SAL_RIRCACHE_H
+#define SAL_RIRCACHE_H
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "digitalfilter.h"
+#include "point.h"
+#include "saltypes.h"
+
+namespace sal {
+
+/**
+ Cache of room impulse responses (RIRs), indexed by a hash of the parameters
+ they were computed with (see `RirCache::Key`).
+
+ RIRs are kept in memory up to `capacity`, after which the least recently
+ used ones are discarded. If a directory is given, RIRs are also written
+ there, one file per RIR, and looked up there when they are not in memory.
+ Since the directory can be shared across processes and runs, repeated
+ scenes do not need to be recomputed. The cache is thread safe.
+ */
+class RirCache {
+ public:
+  /**
+   Incremental 64-bit FNV-1a hash of the parameters identifying a RIR.
+   Real-valued parameters can be quantised, so that e.g. positions that are
+   closer than a given tolerance end up with the same key.
+   */
+  class Key {
+   public:
+    /** `tag` identifies the model the RIR is computed with (e.g. "Ism") */
+    explicit Key(const std::string& tag = "") noexcept;
+
+    Key& Add(const Int value) noexcept;
+
+    /** Adds `value` quantised to multiples of `tolerance`. If `tolerance` is
+     zero, the value is added exactly. */
+    Key& Add(const Sample value, const Sample tolerance = 0.0) noexcept;
+
+    Key& Add(const dsp::Point& point, const Sample tolerance = 0.0) noexcept;
+
+    Key& Add(std::span<const Sample> values) noexcept;
+
+    /** Adds the first `length` samples of the impulse response of `filter`
+     (its state is not affected). */
+    Key& AddImpulseResponse(const dsp::Filter& filter, const Int length = 32);
+
+    uint64_t value() const noexcept { return value_; }
+
+   private:
+    void AddBytes(const void* data, const size_t num_bytes) noexcept;
+
+    static const uint64_t kOffsetBasis = 14695981039346656037ULL;
+    static const uint64_t kPrime = 1099511628211ULL;
+
+    uint64_t value_;
+  };
+
+  /**
+   @param[in] capacity Maximum number of RIRs kept in memory.
+   @param[in] directory Directory for the on-disk tier (it must exist). If
+   empty, RIRs are only kept in memory.
+   */
+  explicit RirCache(const size_t capacity = 64,
+                    const std::string& directory = "");
+
+  /** Looks for the RIR with the given key, first in memory and then on disk.
+   Returns false if it is not found, in which case `rir` is not modified. */
+  bool Find(const uint64_t key, Signal& rir);
+
+  /** Adds a RIR to the cache (and to the on-disk tier, if enabled). */
+  void Insert(const uint64_t key, const Signal& rir);
+
+  /** Removes all RIRs from memory. Files on disk are not removed. */
+  void Clear() noexcept;
+
+  /** Returns the number of RIRs in memory */
+  size_t num_entries() const noexcept;
+
+  /** Returns a path next to `path`, not used by any other thread or
+   process, to write a file to before renaming it to `path` */
+  static std::string TemporaryFilePath(const std::string& path);
+
+  static bool Test();
+
+ private:
+  typedef std::list<std::pair<uint64_t, Signal>> EntryList;
+
+  /** Adds a RIR to the memory tier. Requires `mutex_` to be locked. */
+  void InsertInMemory(const uint64_t key, const Signal& rir);
+
+  std::string FilePath(const uint64_t key) const;
+  bool ReadFile(const uint64_t key, Signal& rir) const;
+  void WriteFile(const uint64_t key, const Signal& rir) const;
+
+  size_t capacity_;
+  std::string directory_;
+
+  /** Most recently used first */
+  EntryList entries_;
+  std::unordered_map<uint64_t, EntryList::iterator> index_;
+
+  mutable std::mutex mutex_;
+};
+
+}  // namespace sal
+
+#endif
@@ -9,6 +9,8 @@
 #ifndef SAL_ROOM_H
 #define SAL_ROOM_H
 
+#include <span>
+
 #include "comparisonop.h"
 #include "iirfilter.h"
 #include "point.h"
@@ -56,6 +58,39 @@ class Room {
       const dsp::Point& source_point,
       const dsp::Point& mic_point) const noexcept = 0;
 
+  // Same as above, but writing into `boundary_points`, which has to hold
+  // `num_boundary_points()` points. This does not allocate memory.
+  virtual void CalculateBoundaryPoints(
+      const dsp::Point& source, const dsp::Point& destination,
+      std::span<dsp::Point> boundary_points) const noexcept = 0;
+
+  // Writes into `wall_ids` the index in `wall_filters()` of the filter of
+  // each boundary point (`num_boundary_points()` of them). This replaces
+  // `GetBoundaryFilters` where filter copies should be avoided. This does
+  // not allocate memory.
+  virtual void GetBoundaryWallIds(const dsp::Point& source_point,
+                                  const dsp::Point& mic_point,
+                                  std::span<sal::Int> wall_ids) const
+      noexcept = 0;
+
+  // Batched version of `CalculateBoundaryPoints`, for the pairs
+  // (`source_points[i]`, `destination_points[i]`). The boundary points of
+  // each pair are written one pair after the other into `boundary_points`,
+  // which has to hold `num_boundary_points()` points per pair.
+  void CalculateBoundaryPoints(std::span<const dsp::Point> source_points,
+                               std::span<const dsp::Point> destination_points,
+                               std::span<dsp::Point> boundary_points) const
+      noexcept {
+    ASSERT(source_points.size() == destination_points.size());
+    const size_t num_points = num_boundary_points();
+    ASSERT(boundary_points.size() == source_points.size() * num_points);
+    for (size_t i = 0; i < source_points.size(); ++i) {
+      CalculateBoundaryPoints(source_points[i], destination_points[i],
+                              boundary_points.subspan(i * num_points,
+                                                      num_points));
+    }
+  }
+
   virtual sal::Int num_boundary_points() const noexcept = 0;
 
   // Returns the shape's number of faces.
@@ -0,0 +1,106 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#ifndef SAL_SDN_H
+#define SAL_SDN_H
+
+#include <span>
+#include <vector>
+
+#include "audiobuffer.h"
+#include "delayfilter.h"
+#include "microphone.h"
+#include "propagationline.h"
+#include "room.h"
+#include "source.h"
+
+namespace sal {
+
+/**
+ Scattering delay network (SDN) room model, as described in
+ E. De Sena, H. Hacihabiboglu, Z. Cvetkovic and J. O. Smith, "Efficient
+ synthesis of room acoustics via scattering delay networks", IEEE/ACM Trans.
+ Audio, Speech, Language Process., 2015.
+
+ One scattering node is placed at each boundary point of the room (e.g. the
+ first-order reflection points of a cuboid room). The nodes are fully
+ connected by delay lines, scatter the incoming waves with an isotropic
+ scattering matrix and apply the filter of their wall. The source feeds each
+ node, and each node feeds the microphone, which sees one plane wave from the
+ direct path (`wave_id` 0) and one from each node (`wave_id` 1 + node). The
+ first-order reflections are rendered exactly, while higher orders are
+ approximated. The cost per sample is constant and does not depend on the
+ reverberation time.
+ */
+class Sdn {
+ public:
+  Sdn(Room* const room, Source* const source, Microphone* const microphone,
+      const Time sampling_frequency);
+
+  void ProcessBlock(std::span<const Sample> input_data, Buffer& output_buffer);
+
+  /**
+   Recomputes the positions of the nodes and the lengths of the delay lines.
+   Has to be called after the source, the microphone or the room are moved.
+   The lines connected to the source and to the microphone change over
+   `ramp_time` seconds, to avoid discontinuities with moving sources, while
+   the lines between nodes change instantaneously. Nodes whose wall has
+   changed (e.g. second-order nodes of a cuboid room) get the filter of the
+   new wall, starting from a zero state.
+   */
+  void Update(const Time ramp_time = 0.0);
+
+  /** Resets the state of all delay lines and filters */
+  void ResetState() noexcept;
+
+  Int num_nodes() const noexcept { return num_nodes_; }
+
+  static bool Test();
+
+ private:
+  /** Index in `node_lines_` and `node_filters_` of the line from node `from`
+   to node `to` */
+  Int LineIndex(const Int from, const Int to) const noexcept {
+    return from * (num_nodes_ - 1) + ((to < from) ? to : to - 1);
+  }
+
+  /** Sets the lengths and attenuations of all lines */
+  void SetLines(const Time ramp_time);
+
+  Room* const room_;
+  Source* const source_;
+  Microphone* const microphone_;
+  Time sampling_frequency_;
+  Int num_nodes_;
+
+  std::vector<dsp::Point> node_positions_;
+  std::vector<Int> wall_ids_;
+  /** Wall of each node for the positions given to `Update` */
+  std::vector<Int> updated_wall_ids_;
+
+  PropagationLine direct_line_;
+  std::vector<PropagationLine> source_lines_;
+  std::vector<PropagationLine> microphone_lines_;
+
+  /** Lines between nodes, and the wall filter applied to the wave leaving a
+   node along each of them */
+  std::vector<DelayFilter> node_lines_;
+  std::vector<dsp::Filter> node_filters_;
+  /** Wall filter applied to the wave leaving each node towards the
+   microphone */
+  std::vector<dsp::Filter> microphone_filters_;
+
+  /** Waves incoming to a node */
+  std::vector<Sample> incoming_;
+  /** Output of the direct path and of each node for the current block */
+  std::vector<std::vector<Sample>> outputs_;
+};
+
+}  // namespace sal
+
+#endif
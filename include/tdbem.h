@@ -9,10 +9,17 @@
 #ifndef SAL_TDBEM_H
 #define SAL_TDBEM_H
 
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+
 #include "cuboidroom.h"
 #include "delayfilter.h"
+#include "meshroom.h"
 #include "microphone.h"
 #include "source.h"
+#include "threadpool.h"
 
 namespace sal {
 
@@ -25,56 +32,217 @@ class TdBem {
   sal::Time sampling_frequency_;
   sal::Length spatial_sampling_period_;
   sal::Sample specific_acoustic_impedance_;
+  sal::Sample far_field_ratio_;
 
   std::vector<sal::Sample> rir_;
 
   std::vector<dsp::Point> points_;  // Stores points on the bounduary
   sal::Int num_elements_;
   std::vector<dsp::Point> normal_vectors_;
-  std::vector<std::vector<sal::Length> > distances_;
-  std::vector<std::vector<sal::Sample> > weights_current_;
-  std::vector<std::vector<sal::Sample> > weights_previous_;
+  /** Area and specific acoustic impedance of each element */
+  std::vector<sal::Length> areas_;
+  std::vector<sal::Sample> impedances_;
 
-  std::vector<sal::Length> distances_mic_;
-  std::vector<sal::Sample> weights_mic_current_;
-  std::vector<sal::Sample> weights_mic_previous_;
-  std::vector<sal::Sample> weights_source_;
+  /**
+   Taps reading the pressure histories of the elements, in
+   structure-of-arrays form. The taps of row `i` are in
+   [row_begin[i], row_begin[i + 1]). Tap `k` reads the history at
+   `offsets[k]` (relative to the current write position) and at the two
+   samples before it, with weights `weights[0][k]`, `weights[1][k]` and
+   `weights[2][k]`: the fractional delays and the weights of the current and
+   previous samples are combined into these three weights. After
+   `UseSinglePrecisionWeights`, the weights are in `single_precision_weights`
+   instead.
+   */
+  struct TapTable {
+    std::vector<sal::Int> row_begin;
+    std::vector<std::int32_t> offsets;
+    std::vector<sal::Sample> weights[3];
+    std::vector<float> single_precision_weights[3];
+    bool single_precision;
+
+    TapTable() : row_begin(1, 0), single_precision(false) {}
+
+    /** Adds a tap to the last row, with delay `delay` in samples */
+    void AddTap(const sal::Int element, const sal::Time delay,
+                const sal::Sample weight_current,
+                const sal::Sample weight_previous,
+                const sal::Int history_length);
+
+    void EndRow() { row_begin.push_back((sal::Int)offsets.size()); }
+
+    sal::Int num_taps() const noexcept { return (sal::Int)offsets.size(); }
+
+    /** Converts the weights to single precision */
+    void UseSinglePrecision();
+
+    /** Weighted sum of the taps of `row`, with `history` pointing to the
+     current write position */
+    sal::Sample Accumulate(const sal::Int row,
+                           const sal::Sample* history) const noexcept;
+  };
 
-  std::vector<sal::Length> distances_source_;
+  /** Taps of the interactions between elements (one row per element) and
+   of the microphone (row `i` has the tap of element `i`) */
+  TapTable element_taps_;
+  TapTable mic_taps_;
+
+  /**
+   Groups of nearby elements, in a binary tree with the root at index 0 and
+   the children after their parents. The elements of cluster `c` are
+   `cluster_elements_[begin]` to `cluster_elements_[end - 1]`. Each cluster
+   has four rows in the histories after those of the elements (from
+   `num_elements_ + 4 * c`): the sums of A n p (one row for each component)
+   and of A p / Z over its elements, with A the area, n the normal, p the
+   pressure and Z the impedance of each element.
+   */
+  struct Cluster {
+    sal::Int begin;
+    sal::Int end;
+    sal::Int children[2];  // -1 for leaves
+    dsp::Point centre;
+    sal::Length radius;
+  };
+  std::vector<Cluster> clusters_;
+  std::vector<sal::Int> cluster_elements_;
+
+  std::vector<sal::Sample> weights_source_;
+  std::vector<sal::Time> delays_source_;
   sal::Length distance_los_;
 
-  std::vector<sal::DelayFilter> pressures_;
+  /**
+   Pressure histories of the elements. The history of element `i` is at
+   `i * 2 * history_length_` and is stored twice in a row, so that any delay
+   up to `history_length_ - 1` is read from `write_position_ +
+   history_length_ - delay` without wrapping around.
+   */
+  std::vector<sal::Sample> histories_;
+  sal::Int history_length_;
+  sal::Int write_position_;
 
   sal::DelayFilter source_delay_line_;
 
+  std::unique_ptr<ThreadPool> thread_pool_;
+
+  /** Signals of the plane waves of the elements and of the direct path
+   within a block, which only grow with the block size */
+  std::vector<std::vector<sal::Sample> > outputs_;
+
+  std::function<void(sal::Int)> progress_callback_;
+  sal::Int num_processed_samples_;
+
   bool log_;
   std::string log_file_name_;
 
   void CalculatePoints();
 
+  /** Splits each triangle of the mesh of `room` into elements with sides of
+   about `spatial_sampling_period_` */
+  void CalculateMeshPoints(const MeshRoom& room);
+
   static sal::Sample CalculateWeightCurrent(
       sal::Sample dr_dn, sal::Length distance, sal::Length sound_speed,
-      sal::Time sampling_frequency, sal::Length spatial_sampling_period,
+      sal::Time sampling_frequency, sal::Length element_area,
       sal::Sample specific_acoustic_impedance);
 
   static sal::Sample CalculateWeightPrevious(
       sal::Sample dr_dn, sal::Length distance, sal::Length sound_speed,
-      sal::Time sampling_frequency, sal::Length spatial_sampling_period,
+      sal::Time sampling_frequency, sal::Length element_area,
       sal::Sample specific_acoustic_impedance);
 
   static sal::Sample CalculateDrDn(dsp::Point point_x, dsp::Point point_y,
                                    dsp::Point normal_y);
 
+  /** Adds the clusters of the elements in [begin, end) of
+   `cluster_elements_` to `clusters_` and returns the index of the first */
+  sal::Int BuildClusters(const sal::Int begin, const sal::Int end);
+
+  /** Adds the taps of the interaction of `element` with a cluster, which is
+   approximated by that with its centre */
+  void AddClusterTaps(const sal::Int element, const sal::Int cluster_id);
+
+  /** Writes the pressures of the elements in [begin, end) at the current
+   write position */
+  void UpdateElements(const sal::Int begin, const sal::Int end) noexcept;
+
+  /** Writes the rows of the clusters at the current write position, from the
+   pressures of their elements */
+  void UpdateClusters();
+
+  /** Pressure in `row` of the histories (an element or a row of a
+   cluster), `delay` samples before the current write position */
+  sal::Sample Pressure(const sal::Int row,
+                       const sal::Int delay) const noexcept {
+    return histories_[row * 2 * history_length_ + write_position_ +
+                      history_length_ - delay];
+  }
+
  public:
+  /**
+   `room` is either a `CuboidRoom`, whose walls are sampled on a grid with
+   `spatial_sampling_period` and all have `specific_acoustic_impedance`, or
+   a `MeshRoom`, whose triangles are split into elements of about the same
+   size and whose walls have the impedances of their filters.
+
+   With a positive `far_field_ratio`, the elements are grouped in a tree of
+   clusters, and each element interacts with the clusters whose radius is
+   smaller than `far_field_ratio` times their distance as with a single
+   element at their centre, with the sums of the normals and admittances of
+   their elements. This reduces the cost and memory of the interactions from
+   O(N^2) to about O(N log N), at the expense of accuracy, in particular
+   where the clusters are large compared to the wavelength (the differences
+   of delays within a cluster are neglected). With 0 (the default), all the
+   pairs of elements are evaluated. `far_field_ratio` has to be in [0, 1),
+   which guarantees that no element interacts with a cluster containing
+   itself.
+   */
   TdBem(Room* const room, sal::Source* const source,
         sal::Microphone* const microphone, const sal::Time sampling_frequency,
         const sal::Length spatial_sampling_period,
-        const sal::Sample specific_acoustic_impedance);
+        const sal::Sample specific_acoustic_impedance,
+        const sal::Sample far_field_ratio = 0.0);
 
   void WriteOutPoints(const std::string file_name);
 
+  /** Processes the whole input, continuing from the current state. If
+   `Log` was called, the pressures of the elements are saved. */
   void Run(const MonoBuffer& input_buffer, Buffer& output_buffer);
 
+  /**
+   Processes the samples of `input_data`, continuing from the current state,
+   and adds the result to the first samples of `output_buffer`. Blocks can
+   be of any size. TdBem only allocates memory when the block size grows.
+   */
+  void ProcessBlock(std::span<const Sample> input_data, Buffer& output_buffer);
+
+  /** Resets the pressures of the elements and of the source */
+  void ResetState() noexcept;
+
+  /**
+   Sets a function called after each sample, with the number of samples
+   processed since the construction or the last `ResetState`. It is called
+   from the thread calling `Run` or `ProcessBlock`.
+   */
+  void SetProgressCallback(const std::function<void(sal::Int)>& callback) {
+    progress_callback_ = callback;
+  }
+
+  /**
+   Sets the number of threads used by `Run` and `ProcessBlock`. The elements
+   are split among the threads at each time step, which only depends on the
+   previous ones. With 0, the number of hardware threads is used. The
+   default is 1 (no worker threads).
+   */
+  void SetNumThreads(const sal::Int num_threads);
+
+  /**
+   Stores the weights of the interactions in single precision, which
+   reduces each tap (a 32-bit offset and three weights) from 28 to 16 bytes,
+   and the memory traffic of `Run` accordingly. The pressures are still
+   accumulated in double precision.
+   */
+  void UseSinglePrecisionWeights();
+
   sal::Signal rir() const { return rir_; }
 
   void Log(std::string file_name) {
@@ -82,6 +250,8 @@ class TdBem {
     log_file_name_ = file_name;
   }
 
+  static bool Test();
+
   static bool SimulationTime();
 };
 
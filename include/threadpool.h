@@ -0,0 +1,86 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#ifndef SAL_THREADPOOL_H
+#define SAL_THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "saltypes.h"
+
+namespace sal {
+
+/**
+ Fixed set of worker threads for data-parallel loops. The threads are
+ created once and wait between calls to `ParallelFor`, so that the pool can
+ be used for many short parallel sections (e.g. one per time step of a
+ simulation) without paying for thread creation each time.
+ */
+class ThreadPool {
+ public:
+  /**
+   @param[in] num_threads Total number of threads working on each loop,
+   including the calling thread (i.e. `num_threads - 1` workers are created).
+   If zero, the number of hardware threads is used.
+   */
+  explicit ThreadPool(const Int num_threads = 0);
+
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /**
+   Splits [begin, end) into up to `num_threads()` contiguous ranges of
+   (nearly) the same length and calls `task(range_begin, range_end)` for each
+   of them in parallel. The calling thread processes the first range, and the
+   function returns when all ranges are done. Calls from different threads
+   are serialised.
+   */
+  void ParallelFor(const Int begin, const Int end,
+                   const std::function<void(Int, Int)>& task);
+
+  Int num_threads() const noexcept { return (Int)workers_.size() + 1; }
+
+  static bool Test();
+
+ private:
+  /** Worker thread loop */
+  void Run(const Int thread_id);
+
+  /** Range of the loop assigned to `thread_id` */
+  void GetRange(const Int thread_id, Int& range_begin,
+                Int& range_end) const noexcept;
+
+  std::vector<std::thread> workers_;
+
+  /** Serialises calls to `ParallelFor` */
+  std::mutex call_mutex_;
+
+  /** Protects the members below */
+  std::mutex mutex_;
+  std::condition_variable start_condition_;
+  std::condition_variable done_condition_;
+
+  const std::function<void(Int, Int)>* task_;
+  Int begin_;
+  Int end_;
+  /** Incremented for each loop, so that workers know there is new work */
+  Int generation_;
+  /** Number of workers that have not finished the current loop */
+  Int num_pending_;
+  bool stop_;
+};
+
+}  // namespace sal
+
+#endif
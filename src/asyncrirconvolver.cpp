@@ -0,0 +1,122 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#include "asyncrirconvolver.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace sal {
+
+AsyncRirConvolver::AsyncRirConvolver(std::function<Signal()> rir_generator,
+                                     const Signal& initial_rir,
+                                     const Int crossfade_length)
+    : rir_generator_(std::move(rir_generator)),
+      crossfade_length_(crossfade_length),
+      convolver_(initial_rir),
+      max_num_partitions_(std::max(
+          (Int)1, ((Int)initial_rir.size() + convolver_.partition_size() - 1) /
+                      convolver_.partition_size())),
+      state_(kIdle),
+      stop_(false) {
+  ASSERT(crossfade_length >= 0);
+  worker_ = std::thread(&AsyncRirConvolver::Run, this);
+}
+
+AsyncRirConvolver::~AsyncRirConvolver() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_.store(true);
+  }
+  condition_.notify_one();
+  worker_.join();
+}
+
+void AsyncRirConvolver::RequestUpdate() noexcept {
+  int state = state_.load();
+  while (true) {
+    int next_state = state;
+    if (state == kIdle) {
+      next_state = kRequested;
+    } else if (state == kComputing) {
+      next_state = kComputingRequested;
+    } else if (state == kReady) {
+      next_state = kReadyRequested;
+    }
+    if (next_state == state ||
+        state_.compare_exchange_weak(state, next_state)) {
+      break;
+    }
+  }
+  // Not taking the lock here, since this may be called by the audio thread.
+  // A lost notification only delays the worker until its next timeout.
+  condition_.notify_one();
+}
+
+bool AsyncRirConvolver::IsUpdating() const noexcept {
+  return state_.load() != kIdle;
+}
+
+void AsyncRirConvolver::ProcessBlock(std::span<const Sample> input_data,
+                                     std::span<Sample> output_data) noexcept {
+  int state = state_.load(std::memory_order_acquire);
+  if (state == kReady || state == kReadyRequested) {
+    // After this, `staging_` holds an old RIR, which is released by the
+    // worker thread.
+    convolver_.SwapImpulseResponse(staging_, crossfade_length_);
+    // `RequestUpdate` may turn kReady into kReadyRequested in the meantime
+    while (!state_.compare_exchange_weak(
+        state, (state == kReady) ? kIdle : kRequested,
+        std::memory_order_release, std::memory_order_relaxed)) {
+    }
+    if (state == kReadyRequested) {
+      condition_.notify_one();
+    }
+  }
+  convolver_.ProcessBlock(input_data, output_data);
+}
+
+void AsyncRirConvolver::Run() {
+  const auto kTimeout = std::chrono::milliseconds(10);
+  while (!stop_.load()) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait_for(lock, kTimeout, [this] {
+        return stop_.load() || state_.load() == kRequested;
+      });
+    }
+    if (stop_.load()) {
+      break;
+    }
+    int state = kRequested;
+    if (!state_.compare_exchange_strong(state, kComputing,
+                                        std::memory_order_acquire)) {
+      continue;
+    }
+
+    dsp::PartitionedConvolver::Partitions partitions(
+        rir_generator_(), convolver_.partition_size());
+    // The audio thread then takes over the longer delay line, instead of
+    // allocating it.
+    if (partitions.num_partitions() > max_num_partitions_) {
+      partitions.AllocateDelayLine();
+      max_num_partitions_ = partitions.num_partitions();
+    }
+
+    // The previous staging RIR ends up in `partitions` and is released here,
+    // on the worker thread.
+    std::swap(staging_, partitions);
+    state = kComputing;
+    while (!state_.compare_exchange_weak(
+        state, (state == kComputing) ? kReady : kReadyRequested,
+        std::memory_order_release, std::memory_order_relaxed)) {
+    }
+  }
+}
+
+}  // namespace sal
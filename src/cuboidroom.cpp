@@ -38,11 +38,19 @@ bool CuboidRoom::IsPointInRoom(const Point& point,
 
 std::vector<Point> CuboidRoom::CalculateBoundaryPoints(
     const Point& source_point, const Point& mic_point) const noexcept {
+  std::vector<Point> reflection_points(num_boundary_points());
+  CalculateBoundaryPoints(source_point, mic_point, reflection_points);
+  return reflection_points;
+}
+
+void CuboidRoom::CalculateBoundaryPoints(
+    const Point& source_point, const Point& mic_point,
+    std::span<Point> reflection_points) const noexcept {
+  ASSERT((Int)reflection_points.size() == num_boundary_points());
   // These points are normalised such that they are between 0<x<Lx etc...
   dsp::Point shifted_source_point =
       dsp::Subtract(source_point, origin_position_);
   dsp::Point shifted_mic_point = dsp::Subtract(mic_point, origin_position_);
-  std::vector<Point> reflection_points(6);
 
   reflection_points[0] =
       ReflectionPoint(kX1, shifted_source_point, shifted_mic_point);
@@ -65,60 +73,9 @@ std::vector<Point> CuboidRoom::CalculateBoundaryPoints(
   ASSERT(dsp::IsEqual(reflection_points[5].z(), dimensions_.z()));
 
   if (boundary_set_type_ == kFirstAndSecondOrder) {
-    Point a_kX2 = IntersectionPoint(
-        kX2, dimensions_, shifted_mic_point,
-        ImageSourcePosition(shifted_source_point, 1, 0, 0, 1, 1, 0));
-    Point a_kY1 = IntersectionPoint(
-        kY1, dimensions_, shifted_mic_point,
-        ImageSourcePosition(shifted_source_point, 1, 0, 0, 1, 1, 0));
-    if (IsPointInRoom(a_kX2, EPSILON)) {
-      ASSERT(!IsPointInRoom(a_kY1, EPSILON));
-      reflection_points.push_back(a_kX2);
-    } else {
-      ASSERT(!IsPointInRoom(a_kX2, EPSILON));
-      reflection_points.push_back(a_kY1);
-    }
-
-    Point b_kX2 = IntersectionPoint(
-        kX2, dimensions_, shifted_mic_point,
-        ImageSourcePosition(shifted_source_point, 1, 1, 0, 1, 1, 0));
-    Point b_kY2 = IntersectionPoint(
-        kY2, dimensions_, shifted_mic_point,
-        ImageSourcePosition(shifted_source_point, 1, 1, 0, 1, 1, 0));
-    if (IsPointInRoom(b_kX2, EPSILON)) {
-      ASSERT(!IsPointInRoom(b_kY2, EPSILON));
-      reflection_points.push_back(b_kX2);
-    } else {
-      ASSERT(!IsPointInRoom(b_kX2, EPSILON));
-      reflection_points.push_back(b_kY2);
-    }
-
-    Point c_kX1 = IntersectionPoint(
-        kX1, dimensions_, shifted_mic_point,
-        ImageSourcePosition(shifted_source_point, 0, 1, 0, 1, 1, 0));
-    Point c_kY2 = IntersectionPoint(
-        kY2, dimensions_, shifted_mic_point,
-        ImageSourcePosition(shifted_source_point, 0, 1, 0, 1, 1, 0));
-    if (IsPointInRoom(c_kX1, EPSILON)) {
-      ASSERT(!IsPointInRoom(c_kY2, EPSILON));
-      reflection_points.push_back(c_kX1);
-    } else {
-      ASSERT(!IsPointInRoom(c_kX1, EPSILON));
-      reflection_points.push_back(c_kY2);
-    }
-
-    Point d_kX1 = IntersectionPoint(
-        kX1, dimensions_, shifted_mic_point,
-        ImageSourcePosition(shifted_source_point, 0, 0, 0, 1, 1, 0));
-    Point d_kY1 = IntersectionPoint(
-        kY1, dimensions_, shifted_mic_point,
-        ImageSourcePosition(shifted_source_point, 0, 0, 0, 1, 1, 0));
-    if (IsPointInRoom(d_kX1, EPSILON)) {
-      ASSERT(!IsPointInRoom(d_kY1, EPSILON));
-      reflection_points.push_back(d_kX1);
-    } else {
-      ASSERT(!IsPointInRoom(d_kX1, EPSILON));
-      reflection_points.push_back(d_kY1);
+    for (Int i = 0; i < 4; ++i) {
+      SecondOrderReflection(i, shifted_source_point, shifted_mic_point,
+                            reflection_points[6 + i]);
     }
   }
 
@@ -135,52 +92,67 @@ std::vector<Point> CuboidRoom::CalculateBoundaryPoints(
   ASSERT(dsp::IsEqual(reflection_points[4].z(), origin_position_.z()));
   ASSERT(dsp::IsEqual(reflection_points[5].z(),
                       dimensions_.z() + origin_position_.z()));
+}
 
-  return reflection_points;
+CuboidWallId CuboidRoom::SecondOrderReflection(
+    const Int index, const Point& source_pos, const Point& observation_pos,
+    Point& point) const noexcept {
+  // Image indices (mx, my) and candidate walls of the first reflection of
+  // each second-order path
+  static const Int kImages[4][2] = {{1, 0}, {1, 1}, {0, 1}, {0, 0}};
+  static const CuboidWallId kWalls[4][2] = {
+      {kX2, kY1}, {kX2, kY2}, {kX1, kY2}, {kX1, kY1}};
+  ASSERT(index >= 0 && index < 4);
+
+  const Point image_position = ImageSourcePosition(
+      source_pos, kImages[index][0], kImages[index][1], 0, 1, 1, 0);
+  const Point x_point = IntersectionPoint(kWalls[index][0], dimensions_,
+                                          observation_pos, image_position);
+  // The line from the observation point to the image crosses the x wall
+  // within the room, i.e. before reaching the y wall. This is not tested
+  // with `IsPointInRoom`, which expects positions that are not relative to
+  // the origin and excludes the walls themselves.
+  if (std::isgreaterequal(x_point.y(), -EPSILON) &&
+      std::islessequal(x_point.y(), dimensions_.y() + EPSILON)) {
+    point = x_point;
+    return kWalls[index][0];
+  }
+  point = IntersectionPoint(kWalls[index][1], dimensions_, observation_pos,
+                            image_position);
+  return kWalls[index][1];
 }
 
 std::vector<dsp::Filter> CuboidRoom::GetBoundaryFilters(
     const Point& source_point, const Point& mic_point) const noexcept {
-  std::vector<dsp::Filter> boundary_filters(wall_filters_);
-
-  if (boundary_set_type_ == kFirstAndSecondOrder) {
-    Point a_kX2 =
-        IntersectionPoint(kX2, dimensions_, mic_point,
-                          ImageSourcePosition(source_point, 1, 0, 0, 1, 1, 0));
-    if (IsPointInRoom(a_kX2, EPSILON)) {
-      boundary_filters.push_back(boundary_filters[kX2]);
-    } else {
-      boundary_filters.push_back(boundary_filters[kY1]);
-    }
-
-    Point b_kX2 =
-        IntersectionPoint(kX2, mic_point, dimensions_,
-                          ImageSourcePosition(source_point, 1, 1, 0, 1, 1, 0));
-    if (IsPointInRoom(b_kX2, EPSILON)) {
-      boundary_filters.push_back(boundary_filters[kX2]);
-    } else {
-      boundary_filters.push_back(boundary_filters[kY2]);
-    }
+  std::vector<Int> wall_ids(num_boundary_points());
+  GetBoundaryWallIds(source_point, mic_point, wall_ids);
+  std::vector<dsp::Filter> boundary_filters;
+  boundary_filters.reserve(wall_ids.size());
+  for (const Int wall_id : wall_ids) {
+    boundary_filters.push_back(wall_filters_[wall_id]);
+  }
+  return boundary_filters;
+}
 
-    Point c_kX1 =
-        IntersectionPoint(kX2, mic_point, dimensions_,
-                          ImageSourcePosition(source_point, 0, 1, 0, 1, 1, 0));
-    if (IsPointInRoom(c_kX1, EPSILON)) {
-      boundary_filters.push_back(boundary_filters[kX1]);
-    } else {
-      boundary_filters.push_back(boundary_filters[kY2]);
-    }
+void CuboidRoom::GetBoundaryWallIds(const Point& source_point,
+                                    const Point& mic_point,
+                                    std::span<Int> wall_ids) const noexcept {
+  ASSERT((Int)wall_ids.size() == num_boundary_points());
+  for (Int i = 0; i < 6; ++i) {
+    wall_ids[i] = i;
+  }
 
-    Point d_kX1 =
-        IntersectionPoint(kX1, mic_point, dimensions_,
-                          ImageSourcePosition(source_point, 0, 0, 0, 1, 1, 0));
-    if (IsPointInRoom(d_kX1, EPSILON)) {
-      boundary_filters.push_back(boundary_filters[kX1]);
-    } else {
-      boundary_filters.push_back(boundary_filters[kY1]);
+  if (boundary_set_type_ == kFirstAndSecondOrder) {
+    const Point shifted_source_point =
+        dsp::Subtract(source_point, origin_position_);
+    const Point shifted_mic_point = dsp::Subtract(mic_point, origin_position_);
+    Point reflection_point;
+    for (Int i = 0; i < 4; ++i) {
+      wall_ids[6 + i] = SecondOrderReflection(i, shifted_source_point,
+                                              shifted_mic_point,
+                                              reflection_point);
     }
   }
-  return boundary_filters;
 }
 
 dsp::Int CuboidRoom::num_boundary_points() const noexcept {
@@ -281,20 +253,47 @@ Sample CuboidRoom::GetFilterResponse(dsp::Filter filter) {
   return output[0];
 }
 
+Sample CuboidRoom::GetFilterResponse(dsp::Filter filter, const Time frequency,
+                                     const Time sampling_frequency,
+                                     const Int length) {
+  std::vector<Sample> impulse(length, 0.0);
+  impulse[0] = 1.0;
+  std::vector<Sample> impulse_response(length);
+  filter.ResetState();
+  filter.ProcessBlock(impulse, impulse_response);
+
+  const Angle omega = 2.0 * PI * frequency / sampling_frequency;
+  dsp::Complex response(0.0, 0.0);
+  for (Int n = 0; n < length; ++n) {
+    response += impulse_response[n] * std::polar(1.0, -omega * (Angle)n);
+  }
+  return std::abs(response);
+}
+
 Time CuboidRoom::SabineRt60() const {
+  // This assumes that the wall filters are simple gain filters
+  std::vector<Sample> betas;
+  for (const dsp::Filter& filter : wall_filters()) {
+    betas.push_back(GetFilterResponse(filter));
+  }
+  return SabineRt60(betas);
+}
+
+Time CuboidRoom::SabineRt60(const Time frequency,
+                            const Time sampling_frequency) const {
+  std::vector<Sample> betas;
+  for (const dsp::Filter& filter : wall_filters()) {
+    betas.push_back(GetFilterResponse(filter, frequency, sampling_frequency));
+  }
+  return SabineRt60(betas);
+}
+
+Time CuboidRoom::SabineRt60(const std::vector<Sample>& betas) const {
+  ASSERT(betas.size() == 6);
   Length volume = dimensions_.x() * dimensions_.y() * dimensions_.z();
   Length weighted_area = 0.0;
-
-  std::vector<dsp::Filter> wall_filters(this->wall_filters());
   for (Int i = 0; i < 6; ++i) {
-    dsp::Filter filter = wall_filters[i];
-    
-    // Assert that all of them are simple gain filters
-    // TODO: Implement for frequency dependent ones
-    std::vector<Sample> output(1);
-    filter.ProcessBlock(std::vector<Sample>(1, 1.0), output);
-    Sample beta = output[0];
-    Sample alpha = 1.0 - pow(beta, 2.0);
+    Sample alpha = 1.0 - pow(betas[i], 2.0);
 
     Length area = NAN;
     switch (i) {
@@ -319,7 +318,11 @@ Time CuboidRoom::SabineRt60() const {
   }
 
   return 0.161 * volume / weighted_area;
-  return NAN;
+}
+
+Time CuboidRoom::MixingTime() const {
+  Length volume = dimensions_.x() * dimensions_.y() * dimensions_.z();
+  return 0.001 * sqrt(volume);
 }
 
 dsp::Point CuboidRoom::ImageSourcePosition(const Point& source_position,
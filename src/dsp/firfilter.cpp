@@ -259,6 +259,49 @@ FirFilter FirFilter::GainFilter(Real gain) noexcept {
   return FirFilter(B);
 }
 
+std::vector<std::vector<Real>> LinearPhaseCrossover(
+    const std::vector<Real>& crossover_frequencies,
+    const Real sampling_frequency, const Int length) {
+  ASSERT(length > 0 && length % 2 == 1);
+  const Int num_bands = crossover_frequencies.size() + 1;
+  const Int delay = (length - 1) / 2;
+
+  // Low-pass filters at each crossover frequency, plus an all-pass (i.e. a
+  // pure delay) for the highest band.
+  std::vector<std::vector<Real>> low_pass(num_bands,
+                                          std::vector<Real>(length, 0.0));
+  for (Int k = 0; k < num_bands - 1; ++k) {
+    ASSERT(k == 0 || crossover_frequencies[k] > crossover_frequencies[k - 1]);
+    ASSERT(crossover_frequencies[k] > 0.0 &&
+           crossover_frequencies[k] < sampling_frequency / 2.0);
+    const Real cutoff = 2.0 * crossover_frequencies[k] / sampling_frequency;
+    Real dc_gain = 0.0;
+    for (Int n = 0; n < length; ++n) {
+      const Real t = (Real)(n - delay);
+      const Real sinc =
+          (n == delay) ? cutoff : sin(PI * cutoff * t) / (PI * t);
+      const Real window =
+          (length == 1) ? 1.0
+                        : 0.42 - 0.5 * cos(2.0 * PI * n / (length - 1)) +
+                              0.08 * cos(4.0 * PI * n / (length - 1));
+      low_pass[k][n] = sinc * window;
+      dc_gain += low_pass[k][n];
+    }
+    for (Int n = 0; n < length; ++n) {
+      low_pass[k][n] /= dc_gain;
+    }
+  }
+  low_pass[num_bands - 1][delay] = 1.0;
+
+  std::vector<std::vector<Real>> bands(low_pass);
+  for (Int k = 1; k < num_bands; ++k) {
+    for (Int n = 0; n < length; ++n) {
+      bands[k][n] = low_pass[k][n] - low_pass[k - 1][n];
+    }
+  }
+  return bands;
+}
+
 void FirFilter::ResetState() noexcept {
   delay_line_ = Zeros<Real>(delay_line_.size());
 }
@@ -0,0 +1,282 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2012-24, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#include "partitionedconvolver.h"
+
+#include <algorithm>
+
+#include "kissfft.hh"
+
+namespace sal {
+
+namespace dsp {
+
+namespace {
+
+/** Returns the output of the (time-reversed) `head` for the input sample at
+ `last_input` and the ones preceding it. */
+inline Real ConvolveHead(const std::vector<Real>& head,
+                         const Real* last_input) noexcept {
+  const Int head_length = head.size();
+  const Real* input = last_input + 1 - head_length;
+  Real output = 0.0;
+  for (Int k = 0; k < head_length; ++k) {
+    output += head[k] * input[k];
+  }
+  return output;
+}
+
+}  // namespace
+
+struct PartitionedConvolver::FftState {
+  FftState(const Int fft_size)
+      : forward((int)fft_size, false),
+        inverse((int)fft_size, true),
+        time(fft_size),
+        frequency(fft_size),
+        accumulator(fft_size) {}
+
+  kissfft<Real> forward;
+  kissfft<Real> inverse;
+  std::vector<Complex> time;
+  std::vector<Complex> frequency;
+  std::vector<Complex> accumulator;
+};
+
+PartitionedConvolver::Partitions::Partitions(
+    const std::vector<Real>& impulse_response, const Int partition_size)
+    : partition_size_(partition_size) {
+  ASSERT(partition_size > 0);
+  const Int length = impulse_response.size();
+  const Int fft_size = 2 * partition_size;
+  num_partitions_ =
+      std::max((Int)1, (length + partition_size - 1) / partition_size);
+
+  const Int head_length = std::min(length, partition_size);
+  head_.resize(head_length);
+  for (Int i = 0; i < head_length; ++i) {
+    head_[i] = impulse_response[head_length - 1 - i];
+  }
+
+  spectra_.resize((num_partitions_ - 1) * fft_size);
+  kissfft<Real> fft((int)fft_size, false);
+  std::vector<Complex> time(fft_size);
+  for (Int k = 1; k < num_partitions_; ++k) {
+    std::fill(time.begin(), time.end(), Complex(0.0, 0.0));
+    for (Int i = 0; i < partition_size && k * partition_size + i < length;
+         ++i) {
+      time[i] = impulse_response[k * partition_size + i];
+    }
+    Complex* spectrum = &spectra_[(k - 1) * fft_size];
+    fft.transform(time.data(), spectrum);
+    // kissfft's inverse transform is not normalised
+    for (Int i = 0; i < fft_size; ++i) {
+      spectrum[i] /= (Real)fft_size;
+    }
+  }
+}
+
+void PartitionedConvolver::Partitions::AllocateDelayLine() {
+  delay_line_.resize((num_partitions_ - 1) * 2 * partition_size_);
+}
+
+PartitionedConvolver::PartitionedConvolver(
+    const std::vector<Real>& impulse_response, const Int partition_size)
+    : partition_size_(partition_size),
+      current_(impulse_response, partition_size),
+      crossfade_length_(0),
+      crossfade_index_(0),
+      input_(2 * partition_size, 0.0),
+      position_(0),
+      delay_line_length_(0),
+      delay_line_index_(0),
+      tail_(partition_size, 0.0),
+      previous_tail_(partition_size, 0.0),
+      fft_(std::make_unique<FftState>(2 * partition_size)) {
+  Reserve(current_.num_partitions());
+}
+
+PartitionedConvolver::~PartitionedConvolver() = default;
+
+PartitionedConvolver::PartitionedConvolver(PartitionedConvolver&&) noexcept =
+    default;
+
+PartitionedConvolver& PartitionedConvolver::operator=(
+    PartitionedConvolver&&) noexcept = default;
+
+Real PartitionedConvolver::ProcessSample(const Real input_sample) noexcept {
+  Real output_sample;
+  ProcessBlock(std::span<const Real>(&input_sample, 1),
+               std::span<Real>(&output_sample, 1));
+  return output_sample;
+}
+
+void PartitionedConvolver::ProcessBlock(std::span<const Real> input_data,
+                                        std::span<Real> output_data) noexcept {
+  ASSERT(input_data.size() == output_data.size());
+  const size_t num_samples = input_data.size();
+  size_t i = 0;
+  while (i < num_samples) {
+    const size_t chunk_length =
+        std::min(num_samples - i, (size_t)(partition_size_ - position_));
+    Real* input = &input_[partition_size_ + position_];
+    std::copy(input_data.begin() + i, input_data.begin() + i + chunk_length,
+              input);
+
+    for (size_t j = 0; j < chunk_length; ++j) {
+      Real output = ConvolveHead(current_.head_, input + j) +
+                    tail_[position_ + j];
+      if (crossfade_index_ < crossfade_length_) {
+        const Real previous_output =
+            ConvolveHead(previous_.head_, input + j) +
+            previous_tail_[position_ + j];
+        const Real weight =
+            ((Real)crossfade_index_ + 1) / ((Real)crossfade_length_ + 1);
+        output = weight * output + (1.0 - weight) * previous_output;
+        crossfade_index_++;
+      }
+      output_data[i + j] = output;
+    }
+
+    position_ += chunk_length;
+    i += chunk_length;
+    if (position_ == partition_size_) {
+      ProcessPartition();
+    }
+  }
+}
+
+void PartitionedConvolver::ProcessPartition() noexcept {
+  const Int fft_size = 2 * partition_size_;
+  if (delay_line_length_ > 0) {
+    std::copy(input_.begin(), input_.end(), fft_->time.begin());
+    delay_line_index_ = (delay_line_index_ + 1) % delay_line_length_;
+    fft_->forward.transform(fft_->time.data(),
+                            &delay_line_[delay_line_index_ * fft_size]);
+  }
+
+  ComputeTail(current_, tail_);
+  if (crossfade_index_ < crossfade_length_) {
+    ComputeTail(previous_, previous_tail_);
+  }
+
+  std::copy(input_.begin() + partition_size_, input_.end(), input_.begin());
+  position_ = 0;
+}
+
+void PartitionedConvolver::ComputeTail(const Partitions& partitions,
+                                       std::span<Real> tail) noexcept {
+  if (partitions.num_partitions_ <= 1) {
+    std::fill(tail.begin(), tail.end(), 0.0);
+    return;
+  }
+  ASSERT(partitions.num_partitions_ - 1 <= delay_line_length_);
+
+  // The spectra are of real signals, so only the first half (plus Nyquist)
+  // is accumulated, and the rest is obtained by conjugate symmetry.
+  const Int fft_size = 2 * partition_size_;
+  std::vector<Complex>& accumulator = fft_->accumulator;
+  std::fill(accumulator.begin(), accumulator.end(), Complex(0.0, 0.0));
+  Int index = delay_line_index_;
+  for (Int k = 1; k < partitions.num_partitions_; ++k) {
+    const Complex* filter = &partitions.spectra_[(k - 1) * fft_size];
+    const Complex* input = &delay_line_[index * fft_size];
+    for (Int i = 0; i <= partition_size_; ++i) {
+      accumulator[i] += filter[i] * input[i];
+    }
+    index = (index == 0) ? delay_line_length_ - 1 : index - 1;
+  }
+  for (Int i = 1; i < partition_size_; ++i) {
+    accumulator[fft_size - i] = std::conj(accumulator[i]);
+  }
+
+  fft_->inverse.transform(accumulator.data(), fft_->time.data());
+  // Overlap-save: only the second half is free from circular aliasing
+  for (Int i = 0; i < partition_size_; ++i) {
+    tail[i] = fft_->time[partition_size_ + i].real();
+  }
+}
+
+void PartitionedConvolver::SetImpulseResponse(
+    const std::vector<Real>& impulse_response, const Int crossfade_length) {
+  Partitions partitions(impulse_response, partition_size_);
+  SwapImpulseResponse(partitions, crossfade_length);
+}
+
+void PartitionedConvolver::SwapImpulseResponse(Partitions& partitions,
+                                               const Int crossfade_length) {
+  ASSERT(partitions.partition_size() == partition_size_);
+  ASSERT(crossfade_length >= 0);
+  if (partitions.num_partitions() - 1 > delay_line_length_ &&
+      !partitions.delay_line_.empty()) {
+    GrowDelayLine(partitions.delay_line_);
+  } else {
+    Reserve(partitions.num_partitions());
+  }
+
+  if (crossfade_length > 0) {
+    std::swap(previous_, current_);
+    std::swap(current_, partitions);
+    std::copy(tail_.begin(), tail_.end(), previous_tail_.begin());
+    crossfade_length_ = crossfade_length;
+  } else {
+    std::swap(current_, partitions);
+    crossfade_length_ = 0;
+  }
+  crossfade_index_ = 0;
+  // The previous or unused delay line, if any, is released by the caller
+  std::swap(current_.delay_line_, partitions.delay_line_);
+
+  // The delay line already holds the input needed for the rest of the
+  // current partition.
+  ComputeTail(current_, tail_);
+}
+
+void PartitionedConvolver::Reserve(const Int num_partitions) {
+  if (num_partitions - 1 <= delay_line_length_) {
+    return;
+  }
+  std::vector<Complex> delay_line((num_partitions - 1) * 2 * partition_size_);
+  GrowDelayLine(delay_line);
+}
+
+void PartitionedConvolver::GrowDelayLine(
+    std::vector<Complex>& delay_line) noexcept {
+  const Int fft_size = 2 * partition_size_;
+  const Int length = delay_line.size() / fft_size;
+  ASSERT(length > delay_line_length_);
+  // The spectra are copied from the oldest to the latest, so that the latest
+  // ends up at `delay_line_length_ - 1`, and the spectra older than the
+  // previous length (at the end of the new delay line) are zero.
+  std::fill(delay_line.begin(), delay_line.end(), Complex(0.0, 0.0));
+  for (Int k = 0; k < delay_line_length_; ++k) {
+    const Int index = (delay_line_index_ + 1 + k) % delay_line_length_;
+    std::copy(delay_line_.begin() + index * fft_size,
+              delay_line_.begin() + (index + 1) * fft_size,
+              delay_line.begin() + k * fft_size);
+  }
+  delay_line_index_ =
+      (delay_line_length_ > 0) ? delay_line_length_ - 1 : length - 1;
+  delay_line_length_ = length;
+  std::swap(delay_line_, delay_line);
+}
+
+void PartitionedConvolver::ResetState() noexcept {
+  std::fill(input_.begin(), input_.end(), 0.0);
+  std::fill(delay_line_.begin(), delay_line_.end(), Complex(0.0, 0.0));
+  std::fill(tail_.begin(), tail_.end(), 0.0);
+  std::fill(previous_tail_.begin(), previous_tail_.end(), 0.0);
+  position_ = 0;
+  delay_line_index_ = 0;
+  crossfade_length_ = 0;
+  crossfade_index_ = 0;
+}
+
+}  // namespace dsp
+
+}  // namespace sal
@@ -0,0 +1,195 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#include "fdn.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "firfilter.h"
+#include "graphiceq.h"
+
+namespace sal {
+
+Fdn::Fdn(const std::vector<Int>& delays, const Time sampling_frequency,
+         const FdnMatrixType matrix_type)
+    : num_lines_((Int)delays.size()),
+      sampling_frequency_(sampling_frequency),
+      matrix_type_(matrix_type),
+      delays_(delays),
+      chunk_length_(0) {
+  ASSERT(num_lines_ > 0);
+  ASSERT(matrix_type_ != kHadamardMatrix ||
+         (num_lines_ & (num_lines_ - 1)) == 0);
+  chunk_length_ = *std::min_element(delays_.begin(), delays_.end());
+  ASSERT(chunk_length_ > 0);
+
+  lines_.reserve(num_lines_);
+  absorption_filters_.reserve(num_lines_);
+  for (Int i = 0; i < num_lines_; ++i) {
+    // Extra room for writing a whole chunk before ticking
+    lines_.push_back(DelayFilter(delays_[i], delays_[i] + chunk_length_));
+    absorption_filters_.push_back(dsp::GainFilter(1.0));
+  }
+  delayed_.assign(num_lines_ * chunk_length_, 0.0);
+  absorbed_.assign(num_lines_ * chunk_length_, 0.0);
+}
+
+Sample Fdn::LineGain(const Int delay, const Time rt60) const noexcept {
+  // -60 dB every `rt60` seconds, i.e. -60 * delay / (fs * rt60) dB per pass
+  return pow(10.0, -3.0 * ((Time)delay) / (sampling_frequency_ * rt60));
+}
+
+void Fdn::SetReverberationTime(const Time rt60) {
+  ASSERT(rt60 > 0.0);
+  for (Int i = 0; i < num_lines_; ++i) {
+    absorption_filters_[i] = dsp::GainFilter(LineGain(delays_[i], rt60));
+  }
+}
+
+void Fdn::SetReverberationTime(const std::vector<Time>& centre_frequencies,
+                               const std::vector<Time>& rt60s) {
+  ASSERT(centre_frequencies.size() == rt60s.size());
+  ASSERT(centre_frequencies.size() >= 2);
+  for (Int i = 0; i < num_lines_; ++i) {
+    std::vector<Sample> gains(rt60s.size());
+    for (size_t k = 0; k < rt60s.size(); ++k) {
+      ASSERT(rt60s[k] > 0.0);
+      gains[k] = LineGain(delays_[i], rt60s[k]);
+    }
+    absorption_filters_[i] = dsp::GraphicEq(gains, centre_frequencies, 0.98,
+                                            sampling_frequency_);
+  }
+}
+
+Sample Fdn::ProcessSample(const Sample input_sample) noexcept {
+  Sample output_sample;
+  ProcessChunk(std::span<const Sample>(&input_sample, 1),
+               std::span<Sample>(&output_sample, 1));
+  return output_sample;
+}
+
+void Fdn::ProcessBlock(std::span<const Sample> input_data,
+                       std::span<Sample> output_data) noexcept {
+  ASSERT(input_data.size() == output_data.size());
+  for (size_t n = 0; n < input_data.size(); n += chunk_length_) {
+    const size_t num_samples =
+        std::min((size_t)chunk_length_, input_data.size() - n);
+    ProcessChunk(input_data.subspan(n, num_samples),
+                 output_data.subspan(n, num_samples));
+  }
+}
+
+void Fdn::ProcessChunk(std::span<const Sample> input_data,
+                       std::span<Sample> output_data) noexcept {
+  const Int num_samples = (Int)input_data.size();
+  ASSERT(num_samples <= chunk_length_);
+  const Sample gain = 1.0 / sqrt((Sample)num_lines_);
+
+  // Since no line is shorter than the chunk, what is read now was written
+  // during previous chunks.
+  std::fill(output_data.begin(), output_data.end(), 0.0);
+  for (Int i = 0; i < num_lines_; ++i) {
+    std::span<Sample> delayed(&delayed_[i * chunk_length_], num_samples);
+    std::span<Sample> absorbed(&absorbed_[i * chunk_length_], num_samples);
+    lines_[i].Read(delayed);
+    absorption_filters_[i].ProcessBlock(delayed, absorbed);
+    for (Int n = 0; n < num_samples; ++n) {
+      output_data[n] += gain * absorbed[n];
+    }
+  }
+
+  ApplyFeedbackMatrix(num_samples);
+
+  for (Int i = 0; i < num_lines_; ++i) {
+    Sample* absorbed = &absorbed_[i * chunk_length_];
+    for (Int n = 0; n < num_samples; ++n) {
+      absorbed[n] += gain * input_data[n];
+    }
+    lines_[i].Write(std::span<const Sample>(absorbed, num_samples));
+    lines_[i].Tick(num_samples);
+  }
+}
+
+void Fdn::ApplyFeedbackMatrix(const Int num_samples) noexcept {
+  Sample* data = absorbed_.data();
+  if (matrix_type_ == kHadamardMatrix) {
+    // Fast Walsh-Hadamard transform, with butterflies between whole chunks
+    for (Int half = 1; half < num_lines_; half *= 2) {
+      for (Int i = 0; i < num_lines_; i += 2 * half) {
+        for (Int j = i; j < i + half; ++j) {
+          Sample* a = data + j * chunk_length_;
+          Sample* b = data + (j + half) * chunk_length_;
+          for (Int n = 0; n < num_samples; ++n) {
+            const Sample sum = a[n] + b[n];
+            b[n] = a[n] - b[n];
+            a[n] = sum;
+          }
+        }
+      }
+    }
+    const Sample normalisation = 1.0 / sqrt((Sample)num_lines_);
+    for (Int i = 0; i < num_lines_; ++i) {
+      Sample* a = data + i * chunk_length_;
+      for (Int n = 0; n < num_samples; ++n) {
+        a[n] *= normalisation;
+      }
+    }
+  } else {
+    // (I - 2/N 1 1^T) a = a - 2/N sum(a). The sum is accumulated in the
+    // scratch buffer of the delayed samples, which are not needed anymore.
+    Sample* sum = delayed_.data();
+    std::fill(sum, sum + num_samples, 0.0);
+    for (Int i = 0; i < num_lines_; ++i) {
+      const Sample* a = data + i * chunk_length_;
+      for (Int n = 0; n < num_samples; ++n) {
+        sum[n] += a[n];
+      }
+    }
+    const Sample factor = 2.0 / ((Sample)num_lines_);
+    for (Int i = 0; i < num_lines_; ++i) {
+      Sample* a = data + i * chunk_length_;
+      for (Int n = 0; n < num_samples; ++n) {
+        a[n] -= factor * sum[n];
+      }
+    }
+  }
+}
+
+void Fdn::ResetState() noexcept {
+  for (Int i = 0; i < num_lines_; ++i) {
+    lines_[i].ResetState();
+    absorption_filters_[i].ResetState();
+  }
+}
+
+std::vector<Int> Fdn::CoprimeDelays(const Int num_lines, const Int min_delay,
+                                    const Int max_delay) {
+  ASSERT(num_lines > 0);
+  ASSERT(min_delay > 1 && max_delay >= min_delay);
+  std::vector<Int> delays;
+  delays.reserve(num_lines);
+  const Time ratio = (num_lines > 1) ? ((Time)max_delay) / ((Time)min_delay)
+                                     : 1.0;
+  for (Int i = 0; i < num_lines; ++i) {
+    const Time exponent =
+        (num_lines > 1) ? ((Time)i) / ((Time)(num_lines - 1)) : 0.0;
+    Int delay = std::max(dsp::RoundToInt(min_delay * pow(ratio, exponent)),
+                         delays.empty() ? min_delay : delays.back() + 1);
+    // Moves up to the next delay that is co-prime with all previous ones
+    while (std::any_of(delays.begin(), delays.end(), [delay](const Int d) {
+      return std::gcd(delay, d) != 1;
+    })) {
+      ++delay;
+    }
+    delays.push_back(delay);
+  }
+  return delays;
+}
+
+}  // namespace sal
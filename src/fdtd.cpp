@@ -9,6 +9,15 @@
  */
 
 #include "fdtd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+
 #include "salconstants.h"
 
 using sal::dsp::IirFilter;
@@ -22,6 +31,179 @@ using sal::Time;
 
 namespace sal {
 
+namespace {
+
+/** Header of checkpoint files, followed by the pressure at the last two time
+ steps (`grid_size` samples each) and by the outputs of each microphone
+ (`num_time_steps` samples each) */
+struct CheckpointHeader {
+  char magic[8];
+  uint64_t key;
+  /** Time step the simulation resumes from */
+  uint64_t next_time_step;
+  uint64_t num_time_steps;
+  uint64_t num_microphones;
+  uint64_t grid_size;
+  uint64_t sample_size;
+};
+
+const char kCheckpointMagic[8] = {'S', 'A', 'L', 'F', 'D', 'T', '0', '1'};
+
+/** Offsets of the face, edge and corner neighbours in the 27-point cube */
+const Int kFaceOffsets[6][3] = {{1, 0, 0},  {-1, 0, 0}, {0, 1, 0},
+                                {0, -1, 0}, {0, 0, 1},  {0, 0, -1}};
+const Int kEdgeOffsets[12][3] = {
+    {1, 1, 0},  {1, -1, 0},  {-1, 1, 0},  {-1, -1, 0},
+    {1, 0, 1},  {1, 0, -1},  {-1, 0, 1},  {-1, 0, -1},
+    {0, 1, 1},  {0, 1, -1},  {0, -1, 1},  {0, -1, -1}};
+const Int kCornerOffsets[8][3] = {{1, 1, 1},   {1, 1, -1},  {1, -1, 1},
+                                  {1, -1, -1}, {-1, 1, 1},  {-1, 1, -1},
+                                  {-1, -1, 1}, {-1, -1, -1}};
+
+/** Weights of the compact scheme update
+ p_2 = d1 * faces + d2 * edges + d3 * corners + d4 * p_1 - p_0 */
+struct CompactCoefficients {
+  double d1;
+  double d2;
+  double d3;
+  double d4;
+};
+
+/** Updates the air points [begin, end) with a compact scheme. Corner
+ neighbours are only read if `kCorners` is true (i.e. if d3 != 0). */
+template <bool kCorners>
+inline void UpdateCompactRun(const Sample* p_0, const Sample* p_1,
+                             Sample* p_2, const Int begin, const Int end,
+                             const Int sx, const Int sy,
+                             const CompactCoefficients& d) noexcept {
+  for (Int i = begin; i < end; i++) {
+    const Sample faces = p_1[i + sx] + p_1[i - sx] + p_1[i + sy] +
+                         p_1[i - sy] + p_1[i + 1] + p_1[i - 1];
+    const Sample edges =
+        p_1[i + sx + sy] + p_1[i + sx - sy] + p_1[i - sx + sy] +
+        p_1[i - sx - sy] + p_1[i + sx + 1] + p_1[i + sx - 1] +
+        p_1[i - sx + 1] + p_1[i - sx - 1] + p_1[i + sy + 1] +
+        p_1[i + sy - 1] + p_1[i - sy + 1] + p_1[i - sy - 1];
+    Sample update = d.d1 * faces + d.d2 * edges + d.d4 * p_1[i] - p_0[i];
+    if constexpr (kCorners) {
+      const Sample corners =
+          p_1[i + sx + sy + 1] + p_1[i + sx + sy - 1] + p_1[i + sx - sy + 1] +
+          p_1[i + sx - sy - 1] + p_1[i - sx + sy + 1] + p_1[i - sx + sy - 1] +
+          p_1[i - sx - sy + 1] + p_1[i - sx - sy - 1];
+      update += d.d3 * corners;
+    }
+    p_2[i] = update;
+  }
+}
+
+/** Adds all points of `geometry` to `key` */
+void AddGeometry(const FdtdGeometry& geometry, RirCache::Key& key) {
+  key.Add(geometry.size_x()).Add(geometry.size_y()).Add(geometry.size_z());
+  for (Int x = 0; x < geometry.size_x(); ++x) {
+    for (Int y = 0; y < geometry.size_y(); ++y) {
+      for (const FdtdGeometry::AirRun& run : geometry.air_runs(x, y)) {
+        key.Add(run.begin).Add(run.end);
+      }
+      for (const FdtdGeometry::BoundaryPoint& point :
+           geometry.boundary_points(x, y)) {
+        key.Add(point.z).Add(point.num_neighbours).Add(point.xi);
+      }
+      key.Add((Int)-1);  // End of row
+    }
+  }
+}
+
+/** Hash of all parameters of a simulation, so that a checkpoint is only
+ resumed by the same simulation */
+uint64_t CheckpointKey(const FdtdGeometry& geometry, const Int Nt,
+                       const std::vector<Int>& source_indices,
+                       const std::vector<std::span<const Sample> >& signals,
+                       const std::vector<Int>& microphone_indices,
+                       const Sample lmb, const FdtdScheme scheme) {
+  RirCache::Key key("FdtdCheckpoint");
+  AddGeometry(geometry, key);
+  key.Add(Nt).Add(lmb);
+  for (size_t k = 0; k < source_indices.size(); ++k) {
+    key.Add(source_indices[k]).Add(signals[k].subspan(0, Nt - 1));
+  }
+  for (const Int index : microphone_indices) {
+    key.Add(index);
+  }
+  key.Add((Int)scheme);
+  return key.value();
+}
+
+/** Writes a checkpoint, first to a temporary file which is then renamed, so
+ that a crash while writing does not corrupt the previous checkpoint */
+void WriteCheckpoint(const std::string& path, const CheckpointHeader& header,
+                     const std::vector<Sample>& p_0,
+                     const std::vector<Sample>& p_1,
+                     const std::vector<Signal>& outputs) {
+  const std::string temporary_path = RirCache::TemporaryFilePath(path);
+  std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+  if (file.is_open()) {
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(p_0.data()),
+               p_0.size() * sizeof(Sample));
+    file.write(reinterpret_cast<const char*>(p_1.data()),
+               p_1.size() * sizeof(Sample));
+    for (const Signal& output : outputs) {
+      file.write(reinterpret_cast<const char*>(output.data()),
+                 output.size() * sizeof(Sample));
+    }
+    file.close();
+  }
+  if (!file || std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    std::remove(temporary_path.c_str());
+    dsp::Logger::GetInstance().LogError("Could not write FDTD checkpoint %s",
+                                        path.c_str());
+  }
+}
+
+/** Reads a checkpoint with the given parameters. Returns false if there is no
+ valid checkpoint, in which case the state may have been partially
+ overwritten. */
+bool ReadCheckpoint(const std::string& path, const CheckpointHeader& expected,
+                    Sample* p_0, Sample* p_1, std::vector<Signal>& outputs,
+                    Int& next_time_step) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  CheckpointHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, kCheckpointMagic, sizeof(kCheckpointMagic)) !=
+          0 ||
+      header.key != expected.key ||
+      header.num_time_steps != expected.num_time_steps ||
+      header.num_microphones != expected.num_microphones ||
+      header.grid_size != expected.grid_size ||
+      header.sample_size != expected.sample_size ||
+      header.next_time_step > header.num_time_steps + 1) {
+    dsp::Logger::GetInstance().LogError(
+        "The FDTD checkpoint %s does not match the simulation and is ignored",
+        path.c_str());
+    return false;
+  }
+  const std::streamsize grid_bytes = header.grid_size * sizeof(Sample);
+  bool success = (bool)file.read(reinterpret_cast<char*>(p_0), grid_bytes) &&
+                 (bool)file.read(reinterpret_cast<char*>(p_1), grid_bytes);
+  for (Signal& output : outputs) {
+    success = success &&
+              (bool)file.read(reinterpret_cast<char*>(output.data()),
+                              output.size() * sizeof(Sample));
+  }
+  if (!success) {
+    dsp::Logger::GetInstance().LogError(
+        "The FDTD checkpoint %s is truncated and is ignored", path.c_str());
+    return false;
+  }
+  next_time_step = header.next_time_step;
+  return true;
+}
+
+}  // namespace
+
 Fdtd::Fdtd(Room* const room, Source* const source, Microphone* const microphone,
            const Time sampling_frequency, sal::Sample xi, sal::Sample lmb)
     : room_(room),
@@ -29,91 +211,914 @@ Fdtd::Fdtd(Room* const room, Source* const source, Microphone* const microphone,
       microphone_(microphone),
       sampling_frequency_(sampling_frequency),
       xi_(xi),
-      lmb_(lmb) {}
+      lmb_(lmb),
+      rir_cache_(nullptr),
+      scheme_(kStandardRectilinear),
+      run_state_(0) {}
+
+void Fdtd::Stop() noexcept {
+  // Only the run in progress when `Stop()` is called is stopped: if it ends
+  // in the meantime, the state (and its generation) changes and the
+  // exchange fails.
+  uint64_t state = run_state_.load();
+  while ((state & kRunning) && !(state & kStopRequested) &&
+         !run_state_.compare_exchange_weak(state, state | kStopRequested)) {
+  }
+}
+
+void Fdtd::BeginRun() noexcept {
+  // `Stop()` does not change the state while no run is in progress
+  const uint64_t generation = (run_state_.load() >> 2) + 1;
+  run_state_.store((generation << 2) | kRunning);
+}
+
+bool Fdtd::EndRun() noexcept {
+  const uint64_t generation_state =
+      run_state_.load() & ~(kRunning | kStopRequested);
+  return (run_state_.exchange(generation_state) & kStopRequested) != 0;
+}
+
+void Fdtd::SetScheme(const FdtdScheme scheme) {
+  scheme_ = scheme;
+  lmb_ = CourantNumber(scheme);
+}
+
+Sample Fdtd::CourantNumber(const FdtdScheme scheme) noexcept {
+  switch (scheme) {
+    case kInterpolatedIsotropic:
+      return sqrt(3.0 / 4.0);
+    case kInterpolatedWideband:
+      return 1.0;
+    case kStandardRectilinear:
+    default:
+      return 1.0 / sqrt(3.0);
+  }
+}
+
+void Fdtd::SchemeParameters(const FdtdScheme scheme, Sample& a,
+                            Sample& b) noexcept {
+  switch (scheme) {
+    case kInterpolatedIsotropic:
+      a = 1.0 / 6.0;
+      b = 0.0;
+      break;
+    case kInterpolatedWideband:
+      a = 1.0 / 4.0;
+      b = 1.0 / 16.0;
+      break;
+    case kStandardRectilinear:
+    default:
+      a = 0.0;
+      b = 0.0;
+      break;
+  }
+}
+
+void Fdtd::SetCheckpoint(const std::string& path, const Int interval) {
+  ASSERT(path.empty() || interval > 0);
+  checkpoint_.path = path;
+  checkpoint_.interval = interval;
+}
+
+void Fdtd::SetNumThreads(const Int num_threads) {
+  ASSERT(num_threads >= 0);
+  if (num_threads == 1) {
+    thread_pool_.reset();
+  } else {
+    thread_pool_ = std::make_unique<ThreadPool>(num_threads);
+  }
+}
+
+FdtdGrid::FdtdGrid(const Int size_x, const Int size_y, const Int size_z)
+    : size_x_(size_x), size_y_(size_y) {
+  ASSERT(size_x > 0 && size_y > 0 && size_z > 0);
+  const Int alignment = kAlignment / sizeof(Sample);
+  stride_y_ = (size_z + alignment - 1) / alignment * alignment;
+  // Extra room to move the start of the buffer to an aligned address
+  storage_.assign(size_x_ * size_y_ * stride_y_ + alignment - 1, 0.0);
+  const uintptr_t address = reinterpret_cast<uintptr_t>(storage_.data());
+  const size_t offset =
+      ((kAlignment - address % kAlignment) % kAlignment) / sizeof(Sample);
+  data_ = storage_.data() + offset;
+}
+
+FdtdGeometry::FdtdGeometry(const Int size_x, const Int size_y,
+                           const Int size_z)
+    : size_x_(size_x),
+      size_y_(size_y),
+      size_z_(size_z),
+      air_runs_(size_x * size_y),
+      boundary_points_(size_x * size_y) {
+  ASSERT(size_x > 0 && size_y > 0 && size_z > 0);
+}
+
+FdtdGeometry::FdtdGeometry(
+    const std::vector<std::vector<std::vector<Int> > >& G, const Sample xi)
+    : FdtdGeometry((Int)G.size(), (Int)G[0].size(), (Int)G[0][0].size()) {
+  std::vector<Int> num_neighbours(size_z_);
+  const std::vector<Sample> xis(size_z_, xi);
+  for (Int x = 1; x < size_x_ - 1; ++x) {
+    for (Int y = 1; y < size_y_ - 1; ++y) {
+      std::copy(G[x][y].begin() + 1, G[x][y].end() - 1,
+                num_neighbours.begin() + 1);
+      SetRow(x, y, num_neighbours, xis);
+    }
+  }
+}
+
+FdtdGeometry FdtdGeometry::Cuboid(const Int Nx, const Int Ny, const Int Nz,
+                                  const Sample xi) {
+  FdtdGeometry geometry(Nx + 2, Ny + 2, Nz + 2);
+  std::vector<Int> num_neighbours(Nz + 2, 0);
+  const std::vector<Sample> xis(Nz + 2, xi);
+  for (Int x = 1; x <= Nx; ++x) {
+    for (Int y = 1; y <= Ny; ++y) {
+      // One neighbour less for each axis along which the point is on a wall
+      const Int num_walls_xy =
+          ((x == 1 || x == Nx) ? 1 : 0) + ((y == 1 || y == Ny) ? 1 : 0);
+      for (Int z = 1; z <= Nz; ++z) {
+        num_neighbours[z] = 6 - num_walls_xy - ((z == 1 || z == Nz) ? 1 : 0);
+      }
+      geometry.SetRow(x, y, num_neighbours, xis);
+    }
+  }
+  return geometry;
+}
+
+dsp::Point FdtdGeometry::MeshOrigin(const TriangleMesh& mesh,
+                                    const Length spacing) noexcept {
+  // One point before the mesh along each axis, for the outer layer
+  const Point min_corner = mesh.min_corner();
+  return Point((floor(min_corner.x() / spacing) - 1.0) * spacing,
+               (floor(min_corner.y() / spacing) - 1.0) * spacing,
+               (floor(min_corner.z() / spacing) - 1.0) * spacing);
+}
+
+FdtdGeometry FdtdGeometry::FromMesh(const TriangleMesh& mesh,
+                                    const Length spacing,
+                                    std::span<const Sample> xi) {
+  ASSERT(spacing > 0.0);
+  ASSERT((Int)xi.size() == mesh.num_materials());
+  // Positions in units of the grid spacing, relative to point (0, 0, 0).
+  // The mesh is moved by the opposite of the offset of the inside test, so
+  // that grid points are at integer positions.
+  const Point origin = dsp::Sum(MeshOrigin(mesh, spacing),
+                                TriangleMesh::InsideTestOffset(spacing));
+  auto grid_position = [&origin, spacing](const Point& point) {
+    return dsp::Multiply(dsp::Subtract(point, origin), 1.0 / spacing);
+  };
+  const Point max_corner = grid_position(mesh.max_corner());
+  // The last point along each axis is after the mesh
+  const Int size[3] = {(Int)ceil(max_corner.x()) + 1,
+                       (Int)ceil(max_corner.y()) + 1,
+                       (Int)ceil(max_corner.z()) + 1};
+
+  // Crossings of the triangles with the lines of grid points along each
+  // axis. The line along `axis` through the point with coordinates u and v
+  // along the next two axes (in cyclic order) has index u * size_v + v.
+  struct Crossing {
+    Length position;
+    Int triangle;
+    bool operator<(const Crossing& other) const {
+      return position < other.position;
+    }
+  };
+  std::vector<std::vector<Crossing> > lines[3];
+  for (Int axis = 0; axis < 3; ++axis) {
+    lines[axis].resize(size[(axis + 1) % 3] * size[(axis + 2) % 3]);
+  }
+  for (Int t = 0; t < mesh.num_triangles(); ++t) {
+    const Point vertices[3] = {grid_position(mesh.Vertex(t, 0)),
+                               grid_position(mesh.Vertex(t, 1)),
+                               grid_position(mesh.Vertex(t, 2))};
+    for (Int axis = 0; axis < 3; ++axis) {
+      const Int axis_u = (axis + 1) % 3;
+      const Int axis_v = (axis + 2) % 3;
+      Length min_u = INFINITY;
+      Length max_u = -INFINITY;
+      Length min_v = INFINITY;
+      Length max_v = -INFINITY;
+      for (const Point& vertex : vertices) {
+        min_u = std::min(min_u, TriangleMesh::Coordinate(vertex, axis_u));
+        max_u = std::max(max_u, TriangleMesh::Coordinate(vertex, axis_u));
+        min_v = std::min(min_v, TriangleMesh::Coordinate(vertex, axis_v));
+        max_v = std::max(max_v, TriangleMesh::Coordinate(vertex, axis_v));
+      }
+      // Only the lines through the bounding box of the triangle
+      for (Int u = std::max((Int)ceil(min_u), (Int)0);
+           u <= std::min((Int)floor(max_u), size[axis_u] - 1); ++u) {
+        for (Int v = std::max((Int)ceil(min_v), (Int)0);
+             v <= std::min((Int)floor(max_v), size[axis_v] - 1); ++v) {
+          Length position;
+          if (TriangleMesh::LineCrossing(vertices[0], vertices[1],
+                                         vertices[2], axis, (Length)u,
+                                         (Length)v, position)) {
+            lines[axis][u * size[axis_v] + v].push_back({position, t});
+          }
+        }
+      }
+    }
+  }
+  for (Int axis = 0; axis < 3; ++axis) {
+    for (std::vector<Crossing>& line : lines[axis]) {
+      std::sort(line.begin(), line.end());
+    }
+  }
+
+  // A point is inside if an odd number of triangles is crossed along z
+  // before it
+  std::vector<char> inside(size[0] * size[1] * size[2], 0);
+  auto is_inside = [&inside, &size](const Int x, const Int y, const Int z) {
+    return x >= 0 && x < size[0] && y >= 0 && y < size[1] && z >= 0 &&
+           z < size[2] && inside[(x * size[1] + y) * size[2] + z];
+  };
+  for (Int x = 0; x < size[0]; ++x) {
+    for (Int y = 0; y < size[1]; ++y) {
+      const std::vector<Crossing>& line = lines[2][x * size[1] + y];
+      size_t num_crossings = 0;
+      for (Int z = 0; z < size[2]; ++z) {
+        while (num_crossings < line.size() &&
+               line[num_crossings].position < (Length)z) {
+          num_crossings++;
+        }
+        inside[(x * size[1] + y) * size[2] + z] = num_crossings % 2;
+      }
+    }
+  }
+
+  // Triangle crossed between point (x, y, z) and its neighbour at `step`
+  // (+1 or -1) along `axis`, with its distance from the point
+  auto crossed_triangle = [&lines, &size](const Int* position,
+                                          const Int axis, const Int step,
+                                          Length& distance) {
+    const Int u = position[(axis + 1) % 3];
+    const Int v = position[(axis + 2) % 3];
+    const std::vector<Crossing>& line =
+        lines[axis][u * size[(axis + 2) % 3] + v];
+    const Length w = (Length)position[axis];
+    auto it = std::lower_bound(line.begin(), line.end(), Crossing({w, 0}));
+    if (step < 0) {
+      if (it == line.begin()) {
+        return (Int)-1;
+      }
+      --it;
+    }
+    if (it == line.end() || std::abs(it->position - w) > 1.0) {
+      return (Int)-1;
+    }
+    distance = std::abs(it->position - w);
+    return it->triangle;
+  };
+
+  FdtdGeometry geometry(size[0], size[1], size[2]);
+  std::vector<Int> num_neighbours(size[2]);
+  std::vector<Sample> xis(size[2]);
+  for (Int x = 0; x < size[0]; ++x) {
+    for (Int y = 0; y < size[1]; ++y) {
+      for (Int z = 0; z < size[2]; ++z) {
+        num_neighbours[z] = 0;
+        xis[z] = 1.0;
+        if (!is_inside(x, y, z)) {
+          continue;
+        }
+        const Int position[3] = {x, y, z};
+        Length min_distance = INFINITY;
+        Int triangle = -1;
+        for (Int axis = 0; axis < 3; ++axis) {
+          for (const Int step : {-1, 1}) {
+            Int neighbour[3] = {x, y, z};
+            neighbour[axis] += step;
+            if (is_inside(neighbour[0], neighbour[1], neighbour[2])) {
+              num_neighbours[z]++;
+              continue;
+            }
+            Length distance;
+            const Int crossed = crossed_triangle(position, axis, step,
+                                                 distance);
+            if (crossed >= 0 && distance < min_distance) {
+              min_distance = distance;
+              triangle = crossed;
+            }
+          }
+        }
+        if (num_neighbours[z] == 6) {
+          continue;
+        }
+        if (triangle < 0) {
+          // E.g. where the mesh is not closed, or with round-off errors
+          mesh.Distance(
+              dsp::Sum(origin, dsp::Multiply(Point((Length)x, (Length)y,
+                                                   (Length)z),
+                                             spacing)),
+              triangle);
+        }
+        xis[z] = xi[mesh.triangles()[triangle].material];
+      }
+      geometry.SetRow(x, y, num_neighbours, xis);
+    }
+  }
+  return geometry;
+}
+
+void FdtdGeometry::SetRow(const Int x, const Int y,
+                          std::span<const Int> num_neighbours,
+                          std::span<const Sample> xi) {
+  ASSERT((Int)num_neighbours.size() == size_z_);
+  ASSERT((Int)xi.size() == size_z_);
+  std::vector<AirRun>& runs = air_runs_[RowIndex(x, y)];
+  std::vector<BoundaryPoint>& points = boundary_points_[RowIndex(x, y)];
+  runs.clear();
+  points.clear();
+  for (Int z = 0; z < size_z_; ++z) {
+    const Int K = num_neighbours[z];
+    ASSERT(K >= 0 && K <= 6);
+    if (K == 0) {
+      continue;
+    }
+    // The outer layer is never updated, so that the stencil of the points
+    // that are does not need bounds checks.
+    ASSERT(x > 0 && x < size_x_ - 1 && y > 0 && y < size_y_ - 1 && z > 0 &&
+           z < size_z_ - 1);
+    if (K == 6) {
+      if (!runs.empty() && runs.back().end == z) {
+        runs.back().end++;
+      } else {
+        runs.push_back({z, z + 1});
+      }
+    } else {
+      ASSERT(xi[z] > 0.0);
+      points.push_back({z, K, xi[z]});
+    }
+  }
+}
+
+Int FdtdGeometry::NumNeighbours(const Int x, const Int y, const Int z) const {
+  for (const AirRun& run : air_runs(x, y)) {
+    if (z >= run.begin && z < run.end) {
+      return 6;
+    }
+  }
+  for (const BoundaryPoint& point : boundary_points(x, y)) {
+    if (point.z == z) {
+      return point.num_neighbours;
+    }
+  }
+  return 0;
+}
+
+Int FdtdGeometry::num_boundary_points() const noexcept {
+  Int num_points = 0;
+  for (const std::vector<BoundaryPoint>& points : boundary_points_) {
+    num_points += (Int)points.size();
+  }
+  return num_points;
+}
 
 sal::Signal Fdtd::RunFdtd(Int Nx, Int Ny, Int Nz, Int Nt,
                           std::vector<std::vector<std::vector<sal::Int> > > G,
                           Sample xi, std::span<const Sample> signal, Sample lmb,
                           Int pos_s_x, Int pos_s_y, Int pos_s_z, Int pos_m_x,
-                          Int pos_m_y, Int pos_m_z) {
-  std::vector<sal::Sample> p_out(Nt, 0);
+                          Int pos_m_y, Int pos_m_z, ThreadPool* thread_pool) {
+  ASSERT((Int)G.size() == Nx + 2 && (Int)G[0].size() == Ny + 2 &&
+         (Int)G[0][0].size() == Nz + 2);
+  return RunFdtd(FdtdGeometry(G, xi), Nt, signal, lmb, pos_s_x - 1,
+                 pos_s_y - 1, pos_s_z - 1, pos_m_x - 1, pos_m_y - 1,
+                 pos_m_z - 1, thread_pool);
+}
+
+sal::Signal Fdtd::RunFdtd(const FdtdGeometry& geometry, Int Nt,
+                          std::span<const Sample> signal, Sample lmb,
+                          Int source_x, Int source_y, Int source_z,
+                          Int microphone_x, Int microphone_y,
+                          Int microphone_z, ThreadPool* thread_pool) {
+  return RunFdtd(geometry, Nt, {{source_x, source_y, source_z}}, {signal},
+                 {{microphone_x, microphone_y, microphone_z}}, lmb,
+                 thread_pool)[0];
+}
+
+std::vector<sal::Signal> Fdtd::RunFdtd(
+    const FdtdGeometry& geometry, Int Nt,
+    const std::vector<FdtdGridPoint>& sources,
+    const std::vector<std::span<const Sample> >& source_signals,
+    const std::vector<FdtdGridPoint>& microphones, Sample lmb,
+    ThreadPool* thread_pool, const FdtdCheckpointSettings& checkpoint,
+    const FdtdScheme scheme) {
+  ASSERT(sources.size() == source_signals.size());
+  std::vector<sal::Signal> p_out(microphones.size(), sal::Signal(Nt, 0));
 
-  std::vector<std::vector<std::vector<double> > > p_0;
-  std::vector<std::vector<std::vector<double> > > p_1;
-  std::vector<std::vector<std::vector<double> > > p_2;
-  Fdtd::Initialise3DArray<double>(p_0, Nx + 2, Ny + 2, Nz + 2);
-  Fdtd::Initialise3DArray<double>(p_1, Nx + 2, Ny + 2, Nz + 2);
-  Fdtd::Initialise3DArray<double>(p_2, Nx + 2, Ny + 2, Nz + 2);
+  const Int size_x = geometry.size_x();
+  const Int size_y = geometry.size_y();
+  const Int size_z = geometry.size_z();
+
+  // The outer layer of the grids is never updated, and its pressure is
+  // always zero.
+  FdtdGrid grid_0(size_x, size_y, size_z);
+  FdtdGrid grid_1(size_x, size_y, size_z);
+  FdtdGrid grid_2(size_x, size_y, size_z);
 
   double lmb_2 = pow(lmb, 2.0);
 
-  for (Int n = 2; n <= Nt; n++) {
-    // std::cout<<"Running FDTD sample n."<<n<<std::endl;
-    for (Int l = 2; l <= (Nx + 1); l++) {
-      for (Int m = 2; m <= (Ny + 1); m++) {
-        for (Int i = 2; i <= (Nz + 1); i++) {
-          Int K = G[l - 1][m - 1][i - 1];
-
-          if (K != 0) {
-            double KK = (double)K;
-            double beta = (6.0 - KK) / (2.0 * xi);
-
-            p_2[l - 1][m - 1][i - 1] =
-                1.0 / (1.0 + lmb * beta) *
-                ((2.0 - KK * lmb_2) * p_1[l - 1][m - 1][i - 1] +
-                 lmb_2 * (p_1[l][m - 1][i - 1] + p_1[l - 2][m - 1][i - 1] +
-                          p_1[l - 1][m][i - 1] + p_1[l - 1][m - 2][i - 1] +
-                          p_1[l - 1][m - 1][i] + p_1[l - 1][m - 1][i - 2]) +
-                 (lmb * beta - 1.0) * p_0[l - 1][m - 1][i - 1]);
-
-            if (pos_s_x == l && pos_s_y == m && pos_s_z == i) {
-              p_2[l - 1][m - 1][i - 1] += signal[n - 2];  // Soft source
+  // Coefficient of p_1 for air points (K = 6). The coefficients of the
+  // neighbours and of p_0 are lmb^2 and -1.
+  const double air_coefficient = 2.0 - 6.0 * lmb_2;
+
+  // Weights of compact schemes
+  const bool compact = (scheme != kStandardRectilinear);
+  Sample a;
+  Sample b;
+  SchemeParameters(scheme, a, b);
+  const CompactCoefficients compact_coefficients = {
+      lmb_2 * (1.0 - 4.0 * a + 4.0 * b), lmb_2 * (a - 2.0 * b), lmb_2 * b,
+      2.0 * (1.0 - 3.0 * lmb_2 + 6.0 * a * lmb_2 - 4.0 * b * lmb_2)};
+
+  auto in_domain = [&geometry, size_x, size_y, size_z](
+                       const Int x, const Int y, const Int z) {
+    return x >= 0 && x < size_x && y >= 0 && y < size_y && z >= 0 &&
+           z < size_z && geometry.NumNeighbours(x, y, z) != 0;
+  };
+
+  // Boundary points in the order they are updated (by x plane, then by
+  // row), with the coefficients of their update equation
+  struct BoundaryUpdate {
+    Int index;
+    Int x;
+    Int y;
+    Int z;
+    double a;
+    double b;
+    double c;
+  };
+  std::vector<BoundaryUpdate> boundary_updates;
+  boundary_updates.reserve(geometry.num_boundary_points());
+  // For compact schemes, indices of the 26 neighbours of each boundary point
+  // (faces, edges and corners), with those outside of the domain replaced by
+  // their mirror image across the boundary
+  std::vector<Int> boundary_neighbours;
+  // Index in `boundary_updates` of the first point of each x plane
+  std::vector<Int> plane_offsets(size_x + 1, 0);
+  for (Int l = 0; l < size_x; ++l) {
+    plane_offsets[l] = (Int)boundary_updates.size();
+    for (Int m = 0; m < size_y; ++m) {
+      for (const FdtdGeometry::BoundaryPoint& point :
+           geometry.boundary_points(l, m)) {
+        double KK = (double)point.num_neighbours;
+        if (!compact) {
+          double beta = (6.0 - KK) / (2.0 * point.xi);
+          boundary_updates.push_back({grid_0.Index(l, m, point.z), l, m,
+                                      point.z, 1.0 / (1.0 + lmb * beta),
+                                      2.0 - KK * lmb_2, lmb * beta - 1.0});
+          continue;
+        }
+
+        // The ghost points beyond each boundary direction have a total
+        // weight of lmb^2 in the stencil, which gives a loss of lmb / xi per
+        // direction.
+        double loss = (6.0 - KK) * lmb / point.xi;
+        boundary_updates.push_back({grid_0.Index(l, m, point.z), l, m,
+                                    point.z, 1.0 / (1.0 + loss),
+                                    compact_coefficients.d4, loss - 1.0});
+
+        const Int position[3] = {l, m, point.z};
+        bool outside_plus[3];
+        bool outside_minus[3];
+        for (Int c = 0; c < 3; ++c) {
+          Int plus[3] = {l, m, point.z};
+          Int minus[3] = {l, m, point.z};
+          plus[c]++;
+          minus[c]--;
+          outside_plus[c] = !in_domain(plus[0], plus[1], plus[2]);
+          outside_minus[c] = !in_domain(minus[0], minus[1], minus[2]);
+        }
+        auto add_neighbour = [&](const Int* offset) {
+          Int neighbour[3];
+          for (Int c = 0; c < 3; ++c) {
+            Int mirrored = offset[c];
+            if (offset[c] == 1 && outside_plus[c]) {
+              mirrored = outside_minus[c] ? 0 : -1;
+            } else if (offset[c] == -1 && outside_minus[c]) {
+              mirrored = outside_plus[c] ? 0 : 1;
+            }
+            neighbour[c] = position[c] + mirrored;
+          }
+          // E.g. at concave corners there is no mirror image in the domain
+          if (!in_domain(neighbour[0], neighbour[1], neighbour[2])) {
+            std::copy(position, position + 3, neighbour);
+          }
+          boundary_neighbours.push_back(
+              grid_0.Index(neighbour[0], neighbour[1], neighbour[2]));
+        };
+        for (const auto& offset : kFaceOffsets) {
+          add_neighbour(offset);
+        }
+        for (const auto& offset : kEdgeOffsets) {
+          add_neighbour(offset);
+        }
+        for (const auto& offset : kCornerOffsets) {
+          add_neighbour(offset);
+        }
+      }
+    }
+  }
+  plane_offsets[size_x] = (Int)boundary_updates.size();
+
+  const Int stride_x = grid_0.stride_x();
+  const Int stride_y = grid_0.stride_y();
+  // Sources that are in the domain, with their signals
+  std::vector<Int> source_indices;
+  std::vector<std::span<const Sample> > signals;
+  std::vector<FdtdGridPoint> source_positions;
+  for (size_t k = 0; k < sources.size(); ++k) {
+    const FdtdGridPoint& source = sources[k];
+    if (source.x >= 0 && source.x < size_x && source.y >= 0 &&
+        source.y < size_y && source.z >= 0 && source.z < size_z &&
+        geometry.NumNeighbours(source.x, source.y, source.z) != 0) {
+      ASSERT((Int)source_signals[k].size() >= Nt - 1);
+      source_indices.push_back(grid_0.Index(source.x, source.y, source.z));
+      signals.push_back(source_signals[k]);
+      source_positions.push_back(source);
+    }
+  }
+
+  // Within a time step the stencils only reach the neighbouring points, so
+  // r steps after its first non-zero sample a source has only reached the
+  // points within distance r: in the Manhattan metric for the standard
+  // scheme, and in the Chebyshev metric for the compact ones, which also
+  // include edges and corners. Everywhere else the pressure is still exactly
+  // zero, so until the light cone fills the grid only the points inside it
+  // are updated.
+  struct ActiveSource {
+    FdtdGridPoint position;
+    Int first_time_step;
+  };
+  std::vector<ActiveSource> active_sources;
+  // Time step from which the light cone covers the whole grid
+  Int full_time_step = Nt + 1;
+  for (size_t k = 0; k < signals.size(); ++k) {
+    Int j = 0;
+    while (j < Nt - 1 && signals[k][j] == 0.0) {
+      j++;
+    }
+    if (j == Nt - 1) {
+      continue;
+    }
+    const FdtdGridPoint& position = source_positions[k];
+    const Int reach_x = std::max(position.x, size_x - 1 - position.x);
+    const Int reach_y = std::max(position.y, size_y - 1 - position.y);
+    const Int reach_z = std::max(position.z, size_z - 1 - position.z);
+    const Int reach = compact ? std::max({reach_x, reach_y, reach_z})
+                              : reach_x + reach_y + reach_z;
+    active_sources.push_back({position, j + 2});
+    full_time_step = std::min(full_time_step, j + 2 + reach);
+  }
+
+  // Time step being computed, and whether the light cone is still growing
+  Int time_step = 0;
+  bool track_light_cone = true;
+
+  // Range [z_begin, z_end) of row (l, m) inside the light cone
+  auto light_cone_row = [&](const Int l, const Int m, Int& z_begin,
+                            Int& z_end) {
+    z_begin = size_z;
+    z_end = 0;
+    for (const ActiveSource& source : active_sources) {
+      const Int radius = time_step - source.first_time_step;
+      const Int dx = std::abs(l - source.position.x);
+      const Int dy = std::abs(m - source.position.y);
+      Int reach = compact ? radius : radius - dx - dy;
+      if (compact && std::max(dx, dy) > radius) {
+        reach = -1;
+      }
+      if (reach >= 0) {
+        z_begin = std::min(z_begin, source.position.z - reach);
+        z_end = std::max(z_end, source.position.z + reach + 1);
+      }
+    }
+    z_begin = std::max(z_begin, (Int)0);
+    z_end = std::min(z_end, size_z);
+  };
+
+  // Range [x_begin, x_end) of x planes inside the light cone
+  auto light_cone_planes = [&](Int& x_begin, Int& x_end) {
+    x_begin = size_x;
+    x_end = 0;
+    for (const ActiveSource& source : active_sources) {
+      const Int radius = time_step - source.first_time_step;
+      if (radius >= 0) {
+        x_begin = std::min(x_begin, source.position.x - radius);
+        x_end = std::max(x_end, source.position.x + radius + 1);
+      }
+    }
+    x_begin = std::max(x_begin, (Int)0);
+    x_end = std::min(x_end, size_x);
+  };
+  std::vector<Int> microphone_indices;
+  for (const FdtdGridPoint& microphone : microphones) {
+    ASSERT(microphone.x >= 0 && microphone.x < size_x && microphone.y >= 0 &&
+           microphone.y < size_y && microphone.z >= 0 &&
+           microphone.z < size_z);
+    microphone_indices.push_back(
+        grid_0.Index(microphone.x, microphone.y, microphone.z));
+  }
+
+  // Pressure at time steps n - 2, n - 1 and n. The buffers are rotated at the
+  // end of each step instead of being copied.
+  Sample* p_0 = grid_0.data();
+  Sample* p_1 = grid_1.data();
+  Sample* p_2 = grid_2.data();
+
+  // Rows along y are processed in tiles, so that the three x planes of
+  // `p_1` read by the stencil for a tile stay in cache while sweeping along x.
+  const Int tile_y = std::max(
+      (Int)1, kTileBytes / (3 * stride_y * (Int)sizeof(Sample)));
+
+  // Updates the points with x in [x_begin, x_end). Slabs along x are
+  // independent within a time step, so they can be processed in parallel.
+  auto update_slab = [&](const Int x_begin, const Int x_end) {
+    for (Int m_begin = 0; m_begin < size_y; m_begin += tile_y) {
+      const Int m_end = std::min(m_begin + tile_y, size_y);
+      for (Int l = x_begin; l < x_end; l++) {
+        for (Int m = m_begin; m < m_end; m++) {
+          Int z_begin = 0;
+          Int z_end = size_z;
+          if (track_light_cone) {
+            light_cone_row(l, m, z_begin, z_end);
+          }
+          const Int row = grid_0.Index(l, m, 0);
+          for (const FdtdGeometry::AirRun& run : geometry.air_runs(l, m)) {
+            const Int begin = row + std::max(run.begin, z_begin);
+            const Int end = row + std::min(run.end, z_end);
+            if (compact) {
+              if (compact_coefficients.d3 != 0.0) {
+                UpdateCompactRun<true>(p_0, p_1, p_2, begin, end, stride_x,
+                                       stride_y, compact_coefficients);
+              } else {
+                UpdateCompactRun<false>(p_0, p_1, p_2, begin, end, stride_x,
+                                        stride_y, compact_coefficients);
+              }
+              continue;
+            }
+            for (Int i = begin; i < end; i++) {
+              p_2[i] = air_coefficient * p_1[i] +
+                       lmb_2 * (p_1[i + stride_x] + p_1[i - stride_x] +
+                                p_1[i + stride_y] + p_1[i - stride_y] +
+                                p_1[i + 1] + p_1[i - 1]) -
+                       p_0[i];
             }
           }
         }
       }
     }
 
+    // Boundary points outside of the light cone are skipped as well
+    auto outside_light_cone = [&](const BoundaryUpdate& point) {
+      if (!track_light_cone) {
+        return false;
+      }
+      Int z_begin;
+      Int z_end;
+      light_cone_row(point.x, point.y, z_begin, z_end);
+      return point.z < z_begin || point.z >= z_end;
+    };
+
+    if (compact) {
+      for (Int j = plane_offsets[x_begin]; j < plane_offsets[x_end]; ++j) {
+        const BoundaryUpdate& point = boundary_updates[j];
+        if (outside_light_cone(point)) {
+          continue;
+        }
+        const Int* neighbours = &boundary_neighbours[26 * j];
+        Sample faces = 0.0;
+        for (Int k = 0; k < 6; ++k) {
+          faces += p_1[neighbours[k]];
+        }
+        Sample edges = 0.0;
+        for (Int k = 6; k < 18; ++k) {
+          edges += p_1[neighbours[k]];
+        }
+        Sample corners = 0.0;
+        for (Int k = 18; k < 26; ++k) {
+          corners += p_1[neighbours[k]];
+        }
+        const Int i = point.index;
+        p_2[i] = point.a * (compact_coefficients.d1 * faces +
+                            compact_coefficients.d2 * edges +
+                            compact_coefficients.d3 * corners +
+                            point.b * p_1[i] + point.c * p_0[i]);
+      }
+      return;
+    }
+
+    for (Int j = plane_offsets[x_begin]; j < plane_offsets[x_end]; ++j) {
+      const BoundaryUpdate& point = boundary_updates[j];
+      if (outside_light_cone(point)) {
+        continue;
+      }
+      const Int i = point.index;
+      p_2[i] = point.a * (point.b * p_1[i] +
+                          lmb_2 * (p_1[i + stride_x] + p_1[i - stride_x] +
+                                   p_1[i + stride_y] + p_1[i - stride_y] +
+                                   p_1[i + 1] + p_1[i - 1]) +
+                          point.c * p_0[i]);
+    }
+  };
+
+  Int first_time_step = 2;
+  CheckpointHeader checkpoint_header;
+  // State copied for the thread writing checkpoints
+  std::vector<Sample> checkpoint_p_0;
+  std::vector<Sample> checkpoint_p_1;
+  std::vector<Signal> checkpoint_outputs;
+  std::future<void> checkpoint_writer;
+  if (!checkpoint.path.empty()) {
+    ASSERT(checkpoint.interval > 0);
+    std::memcpy(checkpoint_header.magic, kCheckpointMagic,
+                sizeof(kCheckpointMagic));
+    checkpoint_header.key =
+        CheckpointKey(geometry, Nt, source_indices, signals,
+                      microphone_indices, lmb, scheme);
+    checkpoint_header.next_time_step = 0;
+    checkpoint_header.num_time_steps = Nt;
+    checkpoint_header.num_microphones = microphones.size();
+    checkpoint_header.grid_size = grid_0.size();
+    checkpoint_header.sample_size = sizeof(Sample);
+    if (!ReadCheckpoint(checkpoint.path, checkpoint_header, p_0, p_1, p_out,
+                        first_time_step)) {
+      // Starts from scratch
+      std::fill(p_0, p_0 + grid_0.size(), 0.0);
+      std::fill(p_1, p_1 + grid_1.size(), 0.0);
+      p_out.assign(microphones.size(), sal::Signal(Nt, 0));
+    }
+  }
+
+  for (Int n = first_time_step; n <= Nt; n++) {
+    time_step = n;
+    track_light_cone = (n < full_time_step);
+    Int x_begin = 0;
+    Int x_end = size_x;
+    if (track_light_cone) {
+      light_cone_planes(x_begin, x_end);
+    }
+    if (thread_pool) {
+      thread_pool->ParallelFor(x_begin, x_end, update_slab);
+    } else if (x_end > x_begin) {
+      update_slab(x_begin, x_end);
+    }
+
+    for (size_t k = 0; k < source_indices.size(); ++k) {
+      p_2[source_indices[k]] += signals[k][n - 2];  // Soft source
+    }
+
+    Sample* p_temp = p_0;
     p_0 = p_1;
     p_1 = p_2;
+    p_2 = p_temp;
+
+    for (size_t k = 0; k < microphone_indices.size(); ++k) {
+      p_out[k][n - 1] = p_1[microphone_indices[k]];
+    }
+
+    const bool stop = checkpoint.stop && checkpoint.stop();
+    if (checkpoint.path.empty()) {
+      if (stop) {
+        return p_out;
+      }
+      continue;
+    }
+    const bool writer_busy =
+        checkpoint_writer.valid() &&
+        checkpoint_writer.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready;
+    if (stop || ((n - first_time_step + 1) % checkpoint.interval == 0 &&
+                 !writer_busy)) {
+      if (checkpoint_writer.valid()) {
+        checkpoint_writer.get();
+      }
+      checkpoint_header.next_time_step = n + 1;
+      checkpoint_p_0.assign(p_0, p_0 + grid_0.size());
+      checkpoint_p_1.assign(p_1, p_1 + grid_1.size());
+      checkpoint_outputs = p_out;
+      checkpoint_writer =
+          std::async(std::launch::async, [&checkpoint, checkpoint_header,
+                                          &checkpoint_p_0, &checkpoint_p_1,
+                                          &checkpoint_outputs]() {
+            WriteCheckpoint(checkpoint.path, checkpoint_header,
+                            checkpoint_p_0, checkpoint_p_1,
+                            checkpoint_outputs);
+          });
+    }
+    if (stop) {
+      checkpoint_writer.get();
+      return p_out;
+    }
+  }
 
-    p_out[n - 1] = p_1[pos_m_x - 1][pos_m_y - 1][pos_m_z - 1];
+  if (checkpoint_writer.valid()) {
+    checkpoint_writer.get();
+  }
+  if (!checkpoint.path.empty()) {
+    std::remove(checkpoint.path.c_str());
   }
 
   return p_out;
 }
 
+Length Fdtd::GridSpacing() const noexcept {
+  return SOUND_SPEED / (CourantNumber(scheme_) * sampling_frequency_);
+}
+
+FdtdGridPoint Fdtd::GridPoint(const Point& position) const noexcept {
+  const Length spacing = GridSpacing();
+  Point relative_position = position;
+  if (const MeshRoom* mesh_room = dynamic_cast<const MeshRoom*>(room_)) {
+    relative_position = dsp::Subtract(
+        position, FdtdGeometry::MeshOrigin(mesh_room->mesh(), spacing));
+  }
+  return {dsp::RoundToInt(relative_position.x() / spacing),
+          dsp::RoundToInt(relative_position.y() / spacing),
+          dsp::RoundToInt(relative_position.z() / spacing)};
+}
+
+FdtdGeometry Fdtd::RoomGeometry() const {
+  if (const MeshRoom* mesh_room = dynamic_cast<const MeshRoom*>(room_)) {
+    return FdtdGeometry::FromMesh(mesh_room->mesh(), GridSpacing(),
+                                  mesh_room->WallImpedances());
+  }
+  const FdtdGridPoint size = GridPoint(((CuboidRoom*)room_)->dimensions());
+  return FdtdGeometry::Cuboid(size.x, size.y, size.z, xi_);
+}
+
 void Fdtd::Run(const MonoBuffer& input_buffer, Buffer& output_buffer) {
   ASSERT(input_buffer.num_samples() == output_buffer.num_samples());
-  Triplet dimensions = ((CuboidRoom*)room_)->dimensions();
-
-  double curant_number = 1.0 / sqrt(3.0);
-
-  double spatial_frequency =
-      SOUND_SPEED / (curant_number * sampling_frequency_);
-
-  Int Nx = dsp::RoundToInt(dimensions.x() / spatial_frequency);
-  Int Ny = dsp::RoundToInt(dimensions.y() / spatial_frequency);
-  Int Nz = dsp::RoundToInt(dimensions.z() / spatial_frequency);
-
-  Int pos_s_x =
-      dsp::RoundToInt(source_->position().x() / spatial_frequency) + 1;
-  Int pos_s_y =
-      dsp::RoundToInt(source_->position().y() / spatial_frequency) + 1;
-  Int pos_s_z =
-      dsp::RoundToInt(source_->position().z() / spatial_frequency) + 1;
-
-  Int pos_m_x =
-      dsp::RoundToInt(microphone_->position().x() / spatial_frequency) + 1;
-  Int pos_m_y =
-      dsp::RoundToInt(microphone_->position().y() / spatial_frequency) + 1;
-  Int pos_m_z =
-      dsp::RoundToInt(microphone_->position().z() / spatial_frequency) + 1;
-
-  rir_ =
-      Fdtd::RunFdtd(Nx, Ny, Nz, input_buffer.num_samples(),
-                    CreateGeometry(Nx, Ny, Nz), xi_, input_buffer.GetReadView(),
-                    lmb_, pos_s_x, pos_s_y, pos_s_z, pos_m_x, pos_m_y, pos_m_z);
+  const FdtdGeometry geometry = RoomGeometry();
+  const FdtdGridPoint source = GridPoint(source_->position());
+  const FdtdGridPoint microphone = GridPoint(microphone_->position());
+
+  uint64_t cache_key = 0;
+  if (rir_cache_) {
+    RirCache::Key key("Fdtd");
+    if (dynamic_cast<const MeshRoom*>(room_)) {
+      AddGeometry(geometry, key);
+    } else {
+      key.Add(geometry.size_x()).Add(geometry.size_y()).Add(geometry.size_z());
+    }
+    key.Add(source.x).Add(source.y).Add(source.z);
+    key.Add(microphone.x).Add(microphone.y).Add(microphone.z);
+    key.Add(xi_).Add(lmb_).Add(input_buffer.GetReadView()).Add((Int)scheme_);
+    cache_key = key.value();
+    if (rir_cache_->Find(cache_key, rir_)) {
+      return;
+    }
+  }
+
+  FdtdCheckpointSettings checkpoint = checkpoint_;
+  checkpoint.stop = [this]() {
+    return (run_state_.load() & kStopRequested) != 0;
+  };
+  BeginRun();
+  rir_ = Fdtd::RunFdtd(geometry, input_buffer.num_samples(), {source},
+                       {input_buffer.GetReadView()}, {microphone}, lmb_,
+                       thread_pool_.get(), checkpoint, scheme_)[0];
+  if (EndRun()) {
+    return;
+  }
+
+  if (rir_cache_) {
+    rir_cache_->Insert(cache_key, rir_);
+  }
+}
+
+std::vector<sal::Signal> Fdtd::Run(
+    const std::vector<Point>& source_positions,
+    const std::vector<sal::Signal>& source_signals,
+    const std::vector<Point>& microphone_positions) {
+  ASSERT(source_positions.size() == source_signals.size());
+  Int num_samples = 0;
+  std::vector<FdtdGridPoint> sources;
+  std::vector<std::span<const Sample> > signals;
+  for (size_t k = 0; k < source_positions.size(); ++k) {
+    num_samples = std::max(num_samples, (Int)source_signals[k].size());
+    sources.push_back(GridPoint(source_positions[k]));
+  }
+  // Shorter signals are zero-padded
+  std::vector<sal::Signal> padded_signals(source_signals);
+  for (sal::Signal& signal : padded_signals) {
+    signal.resize(num_samples, 0.0);
+    signals.push_back(signal);
+  }
+  std::vector<FdtdGridPoint> microphones;
+  for (const Point& position : microphone_positions) {
+    microphones.push_back(GridPoint(position));
+  }
+  FdtdCheckpointSettings checkpoint = checkpoint_;
+  checkpoint.stop = [this]() {
+    return (run_state_.load() & kStopRequested) != 0;
+  };
+  BeginRun();
+  std::vector<sal::Signal> outputs =
+      Fdtd::RunFdtd(RoomGeometry(), num_samples, sources, signals, microphones,
+                    lmb_, thread_pool_.get(), checkpoint, scheme_);
+  EndRun();
+  return outputs;
 }
 
 std::vector<std::vector<std::vector<sal::Int> > > Fdtd::CreateGeometry(Int Nx,
@@ -6,8 +6,15 @@
  Authors: Enzo De Sena, enzodesena@gmail.com
  */
 #include "ism.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include "monomics.h"
 #include "randomop.h"
 #include "salconstants.h"
+#include "vectorop.h"
 
 using sal::dsp::Abs;
 using sal::dsp::IirFilter;
@@ -33,27 +40,225 @@ Ism::Ism(Room* const room, Source* const source, Microphone* const microphone,
       sampling_frequency_(sampling_frequency),
       random_distance_(0),
       peterson_window_(0.004),  // Standard value in Peterson's paper
-      modified_(true) {}
+      peterson_table_width_(0),
+      peterson_table_offset_(0),
+      peterson_table_window_(0.0),
+      peterson_table_sampling_frequency_(0.0),
+      modified_(true),
+      rir_cache_(nullptr),
+      cache_tolerance_(0.001),
+      mixing_time_(0.0),
+      energy_threshold_(0.0),
+      automatic_length_(false) {}
 
 void Ism::ProcessBlock(std::span<const Sample> input_data,
                        Buffer& output_buffer) {
+  // Only allocates when the block size grows
+  if (scratch_.size() < input_data.size()) {
+    scratch_.resize(input_data.size());
+  }
+  std::span<Sample> output(scratch_.data(), input_data.size());
+
+  if (async_convolver_) {
+    ASSERT(microphone_->IsOmni());
+    async_convolver_->ProcessBlock(input_data, output);
+    microphone_->AddPlaneWave(std::span<const Sample>(output),
+                              dsp::Point(0, 0, 0), output_buffer);
+    return;
+  }
+
   if (modified_) {
     Ism::CalculateRir();
+    if (microphone_->IsOmni()) {
+      convolver_.SetImpulseResponse(rir_);
+    } else {
+      bin_convolvers_.resize(bin_rirs_.size());
+      for (size_t i = 0; i < bin_rirs_.size(); ++i) {
+        bin_convolvers_[i].SetImpulseResponse(bin_rirs_[i]);
+      }
+    }
   }
 
-  // TODO: I still need to test the spatialised implementation
   if (microphone_->IsOmni()) {
-    dsp::FirFilter filter(rir_);
-    std::vector<Sample> temp(input_data.size());
-    filter.ProcessBlock(input_data, temp);
-    microphone_->AddPlaneWave(temp, dsp::Point(0, 0, 0), output_buffer);
-  } else {
-    ASSERT(false);
+    convolver_.ProcessBlock(input_data, output);
+    microphone_->AddPlaneWave(std::span<const Sample>(output),
+                              dsp::Point(0, 0, 0), output_buffer);
+    return;
+  }
+
+  // The microphone sees one plane wave per direction bin
+  const Point mic_position = microphone_->position();
+  for (size_t i = 0; i < bin_convolvers_.size(); ++i) {
+    bin_convolvers_[i].ProcessBlock(input_data, output);
+    const Point& direction =
+        (i < direction_bins_.size()) ? direction_bins_[i] : direct_direction_;
+    microphone_->AddPlaneWave(std::span<const Sample>(output),
+                              dsp::Sum(mic_position, direction), i,
+                              output_buffer);
   }
 }
 
+void Ism::SetDirectionBins(const std::vector<dsp::Point>& directions) {
+  ASSERT(directions.size() > 0);
+  direction_bins_.clear();
+  for (const Point& direction : directions) {
+    direction_bins_.push_back(dsp::Normalized(direction));
+  }
+  Update();
+}
+
+std::vector<Point> Ism::UniformDirections(const Int num_directions) {
+  ASSERT(num_directions > 0);
+  const Angle golden_angle = PI * (3.0 - sqrt(5.0));
+  std::vector<Point> directions;
+  directions.reserve(num_directions);
+  for (Int i = 0; i < num_directions; ++i) {
+    const Length z = 1.0 - 2.0 * ((Length)i + 0.5) / ((Length)num_directions);
+    const Length radius = sqrt(1.0 - z * z);
+    const Angle phi = golden_angle * ((Angle)i);
+    directions.push_back(Point(radius * cos(phi), radius * sin(phi), z));
+  }
+  return directions;
+}
+
+Int Ism::NearestDirectionBin(const Point& direction) const noexcept {
+  Int nearest = 0;
+  Sample max_projection = dsp::DotProduct(direction, direction_bins_[0]);
+  for (Int i = 1; i < (Int)direction_bins_.size(); ++i) {
+    const Sample projection = dsp::DotProduct(direction, direction_bins_[i]);
+    if (projection > max_projection) {
+      max_projection = projection;
+      nearest = i;
+    }
+  }
+  return nearest;
+}
+
+struct Ism::AsyncScene {
+  Point source_position;
+  Point microphone_position;
+  Triplet room_dimensions;
+  Int rir_length;
+  Length random_distance;
+  Time peterson_window;
+  Length cache_tolerance;
+  Time mixing_time;
+  Sample energy_threshold;
+  bool automatic_length;
+};
+
+struct Ism::AsyncState {
+  explicit AsyncState(const Ism& ism)
+      : room(*(const CuboidRoom*)ism.room_),
+        interpolation(ism.interpolation_),
+        sampling_frequency(ism.sampling_frequency_),
+        rir_cache(ism.rir_cache_),
+        band_frequencies(ism.band_frequencies_),
+        crossover_filters(ism.crossover_filters_),
+        back(0),
+        middle(1),
+        front(2),
+        last_rir(ism.rir_) {}
+
+  /** Computes the RIR of the latest scene, if it was not picked up yet, and
+   returns the latest RIR. Called by the worker thread. */
+  std::vector<Sample> CalculateRir();
+
+  /** Copy of the room (for its wall filters) and settings which are fixed
+   while in asynchronous mode */
+  CuboidRoom room;
+  IsmInterpolation interpolation;
+  Time sampling_frequency;
+  RirCache* rir_cache;
+  std::vector<Time> band_frequencies;
+  std::vector<std::vector<Sample>> crossover_filters;
+
+  /** Triple buffer of scenes: `Update()` writes into `scenes[back]` and then
+   exchanges it with `middle`, and the worker thread exchanges `front` with
+   `middle` when `middle` holds a scene it has not picked up. */
+  AsyncScene scenes[3];
+  Int back;
+  std::atomic<Int> middle;
+  Int front;
+  static const Int kNewScene = 4;
+
+  std::vector<Sample> last_rir;
+};
+
+std::vector<Sample> Ism::AsyncState::CalculateRir() {
+  if (middle.load(std::memory_order_acquire) & kNewScene) {
+    front = middle.exchange(front, std::memory_order_acq_rel) & ~kNewScene;
+    const AsyncScene& scene = scenes[front];
+    room.SetDimensions(scene.room_dimensions);
+    OmniSource source(scene.source_position);
+    OmniMic microphone(scene.microphone_position);
+    Ism ism(&room, &source, &microphone, interpolation, scene.rir_length,
+            sampling_frequency);
+    ism.random_distance_ = scene.random_distance;
+    ism.peterson_window_ = scene.peterson_window;
+    ism.rir_cache_ = rir_cache;
+    ism.cache_tolerance_ = scene.cache_tolerance;
+    ism.band_frequencies_ = band_frequencies;
+    ism.crossover_filters_ = crossover_filters;
+    ism.mixing_time_ = scene.mixing_time;
+    ism.energy_threshold_ = scene.energy_threshold;
+    ism.automatic_length_ = scene.automatic_length;
+    ism.CalculateRir();
+    last_rir = std::move(ism.rir_);
+  }
+  return last_rir;
+}
+
+Ism::~Ism() {
+  // Joins the worker thread before any member it may still be using (the
+  // generator only holds `async_state_`) is destroyed.
+  async_convolver_.reset();
+}
+
+void Ism::SetAsynchronous(const bool asynchronous,
+                          const Int crossfade_length) {
+  if (!asynchronous) {
+    async_convolver_.reset();
+    async_state_.reset();
+    modified_ = true;
+    return;
+  }
+
+  // The first RIR is calculated here, so that the convolver does not start
+  // from silence.
+  if (modified_) {
+    CalculateRir();
+  }
+  async_convolver_.reset();
+  async_state_ = std::make_shared<AsyncState>(*this);
+  // The generator runs on the worker thread, and only accesses the scenes
+  // handed over by `Update()`, so that this object can be modified (or
+  // destroyed) in the meantime.
+  std::shared_ptr<AsyncState> state = async_state_;
+  async_convolver_ = std::make_unique<AsyncRirConvolver>(
+      [state]() { return state->CalculateRir(); }, rir_, crossfade_length);
+}
+
 /** Calculates the Rir. This is called by Run() before filtering. */
 void Ism::CalculateRir() {
+  images_delay_.clear();
+  images_position_.clear();
+
+  if (automatic_length_) {
+    rir_length_ = AutomaticLength();
+  }
+
+  const bool cached = rir_cache_ && microphone_->IsOmni();
+  const uint64_t cache_key = cached ? CacheKey() : 0;
+  if (cached && rir_cache_->Find(cache_key, rir_)) {
+    modified_ = false;
+    return;
+  }
+
+  if (interpolation_ == peterson) {
+    UpdatePetersonTable();
+  }
+
   dsp::Matrix<Sample> beta(2, 3);
   std::vector<dsp::Filter> filters = room_->wall_filters();
   beta.SetElement(0, 0, CuboidRoom::GetFilterResponse(filters[0]));  // beta_{x1}
@@ -70,17 +275,76 @@ void Ism::CalculateRir() {
 
   rir_ = dsp::Zeros<sal::Sample>(rir_length_);
 
-  Time rir_time = ((Time)rir_length_) / ((Time)sampling_frequency_);
-  Int n1 = (Int)floor(rir_time / (((Length)room_x) * 2.0)) + 1;
-  Int n2 = (Int)floor(rir_time / (((Length)room_y) * 2.0)) + 1;
-  Int n3 = (Int)floor(rir_time / (((Length)room_z) * 2.0)) + 1;
+  const bool directional = !microphone_->IsOmni();
+  if (directional) {
+    if (direction_bins_.empty()) {
+      direction_bins_ = UniformDirections(kDefaultNumDirectionBins);
+    }
+    bin_rirs_.resize(direction_bins_.size() + 1);
+    for (std::vector<Sample>& bin_rir : bin_rirs_) {
+      bin_rir.assign(rir_length_, 0.0);
+    }
+  }
+
+  // In hybrid mode, images are only computed up to the mixing time
+  const Int mixing_sample =
+      (mixing_time_ > 0.0)
+          ? std::min(rir_length_,
+                     (Int)round(mixing_time_ * sampling_frequency_))
+          : rir_length_;
+  const bool hybrid = mixing_sample < rir_length_;
+  const Int window_start = mixing_sample / 2;
+
+  Time rir_time = ((Time)mixing_sample) / ((Time)sampling_frequency_);
+  Int n1 = (Int)floor(rir_time * SOUND_SPEED / (((Length)room_x) * 2.0)) + 1;
+  Int n2 = (Int)floor(rir_time * SOUND_SPEED / (((Length)room_y) * 2.0)) + 1;
+  Int n3 = (Int)floor(rir_time * SOUND_SPEED / (((Length)room_z) * 2.0)) + 1;
 
   Int max_num_images = 8 * (2 * n1 + 1) * (2 * n2 + 1) * (2 * n3 + 1);
 
+  // In multi-band mode, the reflection gains along each axis are tabulated
+  // for each band, number of reflections and parity.
+  const Int num_bands = band_frequencies_.size();
+  const bool multiband = num_bands > 0;
+  const Int x_stride = (2 * n1 + 1) * 2;
+  const Int y_stride = (2 * n2 + 1) * 2;
+  const Int z_stride = (2 * n3 + 1) * 2;
+  std::vector<Sample> x_gains;
+  std::vector<Sample> y_gains;
+  std::vector<Sample> z_gains;
+  if (multiband) {
+    auto axis_gains = [&](const Int n, const dsp::Filter& wall_1,
+                          const dsp::Filter& wall_2) {
+      std::vector<Sample> gains(num_bands * (2 * n + 1) * 2);
+      for (Int b = 0; b < num_bands; ++b) {
+        const Sample beta_1 = CuboidRoom::GetFilterResponse(
+            wall_1, band_frequencies_[b], sampling_frequency_);
+        const Sample beta_2 = CuboidRoom::GetFilterResponse(
+            wall_2, band_frequencies_[b], sampling_frequency_);
+        for (Int m = -n; m <= n; ++m) {
+          for (Int p = 0; p <= 1; ++p) {
+            gains[(b * (2 * n + 1) + m + n) * 2 + p] =
+                Pow(beta_1, Abs((Sample)m - p)) * Pow(beta_2, Abs((Sample)m));
+          }
+        }
+      }
+      return gains;
+    };
+    x_gains = axis_gains(n1, filters[0], filters[1]);
+    y_gains = axis_gains(n2, filters[2], filters[3]);
+    z_gains = axis_gains(n3, filters[4], filters[5]);
+
+    const Int num_outputs = directional ? bin_rirs_.size() + 1 : 1;
+    band_rirs_.resize(num_outputs * num_bands);
+    for (std::vector<Sample>& band_rir : band_rirs_) {
+      band_rir.assign(rir_length_, 0.0);
+    }
+  }
+
+  std::vector<Sample> window_energies(std::max(num_bands, (Int)1), 0.0);
+
   images_delay_.reserve(max_num_images);
   images_position_.reserve(max_num_images);
-  images_int_delay_filter_.reserve(max_num_images);
-  images_frac_delay_filter_.reserve(max_num_images);
 
   dsp::RandomGenerator randn_gen;
   std::vector<sal::Length> rand_delays;
@@ -94,111 +358,535 @@ void Ism::CalculateRir() {
                            -top_limit);
   }
 
-  for (Int mx = -n1; mx <= n1; ++mx) {
-    for (Int my = -n2; my <= n2; ++my) {
-      for (Int mz = -n3; mz <= n3; ++mz) {
+  // Adds the 8 images with the given lattice indices, and returns the sum of
+  // their squared amplitudes.
+  auto add_images = [&](const Int mx, const Int my, const Int mz) -> Sample {
+    Sample energy = 0.0;
+    for (Int px = 0; px <= 1; ++px) {
+      for (Int py = 0; py <= 1; ++py) {
+        for (Int pz = 0; pz <= 1; ++pz) {
+          Point image_position =
+              ((CuboidRoom*)room_)
+                  ->ImageSourcePosition(source_->position(), mx, my, mz, px,
+                                        py, pz);
+
+          Time delay =
+              dsp::Subtract(image_position, microphone_->position()).norm() /
+              SOUND_SPEED;
+
+          if (randomisation) {
+            delay += rand_delays.at(k++);
+          }
+
+          if (round(delay * sampling_frequency_) < 0 ||
+              round(delay * sampling_frequency_) >= mixing_sample) {
+            continue;
+          }
+
+          images_position_.push_back(image_position);
+          images_delay_.push_back(delay);
+
+          const bool direct_path = mx == 0 && my == 0 && mz == 0 && px == 0 &&
+                                   py == 0 && pz == 0;
+          const bool in_window =
+              hybrid && !direct_path &&
+              delay * sampling_frequency_ >= (Time)window_start;
+
+          Int bin = 0;
+          if (directional) {
+            const Point direction =
+                dsp::Subtract(image_position, microphone_->position());
+            bin = direct_path ? direction_bins_.size()
+                              : NearestDirectionBin(direction);
+            if (direct_path) {
+              direct_direction_ = dsp::Normalized(direction);
+            }
+          }
+
+          if (!multiband) {
+            Sample gid = Pow(beta.GetElement(0, 0), Abs((Sample)mx - px)) *
+                         Pow(beta.GetElement(1, 0), Abs((Sample)mx)) *
+                         Pow(beta.GetElement(0, 1), Abs((Sample)my - py)) *
+                         Pow(beta.GetElement(1, 1), Abs((Sample)my)) *
+                         Pow(beta.GetElement(0, 2), Abs((Sample)mz - pz)) *
+                         Pow(beta.GetElement(1, 2), Abs((Sample)mz));
+
+            Sample attenuation = gid / (delay * sampling_frequency_);
+
+            WriteSample(delay, attenuation, rir_);
+            if (directional) {
+              WriteSample(delay, attenuation, bin_rirs_[bin]);
+            }
+            if (in_window) {
+              window_energies[0] += attenuation * attenuation;
+            }
+            energy += attenuation * attenuation;
+            continue;
+          }
+
+          const Int x_index = ((mx + n1) * 2 + px);
+          const Int y_index = ((my + n2) * 2 + py);
+          const Int z_index = ((mz + n3) * 2 + pz);
+          for (Int b = 0; b < num_bands; ++b) {
+            Sample gid = x_gains[b * x_stride + x_index] *
+                         y_gains[b * y_stride + y_index] *
+                         z_gains[b * z_stride + z_index];
+            Sample attenuation = gid / (delay * sampling_frequency_);
+
+            WriteSample(delay, attenuation, band_rirs_[b]);
+            if (directional) {
+              WriteSample(delay, attenuation,
+                          band_rirs_[(bin + 1) * num_bands + b]);
+            }
+            if (in_window) {
+              window_energies[b] += attenuation * attenuation;
+            }
+            energy += attenuation * attenuation;
+          }
+        }
+      }
+    }
+    return energy;
+  };
+
+  if (energy_threshold_ >= 0.0) {
+    for (Int mx = -n1; mx <= n1; ++mx) {
+      for (Int my = -n2; my <= n2; ++my) {
+        for (Int mz = -n3; mz <= n3; ++mz) {
+          add_images(mx, my, mz);
+        }
+      }
+    }
+  } else {
+    // The lattice is expanded in shells of increasing Chebyshev norm
+    // max(|mx|, |my|, |mz|), until the energy added by a shell falls below
+    // the threshold relative to the energy accumulated so far.
+    const Sample relative_threshold = pow(10.0, energy_threshold_ / 10.0);
+    const Int num_shells = std::max(n1, std::max(n2, n3));
+    Sample total_energy = 0.0;
+    for (Int shell = 0; shell <= num_shells; ++shell) {
+      Sample shell_energy = 0.0;
+      for (Int mx = -std::min(shell, n1); mx <= std::min(shell, n1); ++mx) {
+        for (Int my = -std::min(shell, n2); my <= std::min(shell, n2); ++my) {
+          if (std::abs(mx) == shell || std::abs(my) == shell) {
+            for (Int mz = -std::min(shell, n3); mz <= std::min(shell, n3);
+                 ++mz) {
+              shell_energy += add_images(mx, my, mz);
+            }
+          } else if (shell <= n3) {
+            shell_energy += add_images(mx, my, -shell);
+            shell_energy += add_images(mx, my, shell);
+          }
+        }
+      }
+      total_energy += shell_energy;
+      if (shell > 0 && shell_energy <= relative_threshold * total_energy) {
+        break;
+      }
+    }
+  }
+
+  if (hybrid) {
+    AddLateReverberation(window_energies, mixing_sample, directional);
+  }
+
+  if (multiband) {
+    MergeBands(std::span(band_rirs_).subspan(0, num_bands), rir_);
+    for (size_t i = 0; directional && i < bin_rirs_.size(); ++i) {
+      MergeBands(std::span(band_rirs_).subspan((i + 1) * num_bands, num_bands),
+                 bin_rirs_[i]);
+    }
+  }
+
+  if (cached) {
+    rir_cache_->Insert(cache_key, rir_);
+  }
+  modified_ = false;
+}
+
+std::vector<Sample> Ism::CalculateRirs(
+    const std::vector<Point>& source_positions,
+    const std::vector<Point>& receiver_positions) {
+  if (interpolation_ == peterson) {
+    UpdatePetersonTable();
+  }
+
+  const Int num_sources = source_positions.size();
+  const Int num_receivers = receiver_positions.size();
+  std::vector<Sample> rirs(num_sources * num_receivers * rir_length_, 0.0);
+  if (num_receivers == 0) {
+    return rirs;
+  }
+
+  const CuboidRoom* room = (CuboidRoom*)room_;
+  const Triplet dimensions = room->dimensions();
+  const Length room_sizes[3] = {dimensions.x(), dimensions.y(),
+                                dimensions.z()};
+  const Length max_distance =
+      ((Time)rir_length_) / sampling_frequency_ * SOUND_SPEED;
+
+  // Reflection gains along each axis, indexed by (m + n) * 2 + p, computed
+  // once for all source-receiver pairs.
+  const std::vector<dsp::Filter>& filters = room_->wall_filters();
+  Int n[3];
+  std::vector<Sample> gains[3];
+  for (Int axis = 0; axis < 3; ++axis) {
+    n[axis] = (Int)floor(max_distance / (room_sizes[axis] * 2.0)) + 1;
+    const Sample beta_1 = CuboidRoom::GetFilterResponse(filters[2 * axis]);
+    const Sample beta_2 = CuboidRoom::GetFilterResponse(filters[2 * axis + 1]);
+    gains[axis].resize((2 * n[axis] + 1) * 2);
+    for (Int m = -n[axis]; m <= n[axis]; ++m) {
+      for (Int p = 0; p <= 1; ++p) {
+        gains[axis][(m + n[axis]) * 2 + p] =
+            Pow(beta_1, Abs((Sample)m - p)) * Pow(beta_2, Abs((Sample)m));
+      }
+    }
+  }
+
+  // Receivers in structure-of-arrays layout, and their bounding box
+  std::vector<Length> receivers_x(num_receivers);
+  std::vector<Length> receivers_y(num_receivers);
+  std::vector<Length> receivers_z(num_receivers);
+  for (Int r = 0; r < num_receivers; ++r) {
+    receivers_x[r] = receiver_positions[r].x();
+    receivers_y[r] = receiver_positions[r].y();
+    receivers_z[r] = receiver_positions[r].z();
+  }
+  const auto [min_x, max_x] =
+      std::minmax_element(receivers_x.begin(), receivers_x.end());
+  const auto [min_y, max_y] =
+      std::minmax_element(receivers_y.begin(), receivers_y.end());
+  const auto [min_z, max_z] =
+      std::minmax_element(receivers_z.begin(), receivers_z.end());
+  const Point box_min(*min_x, *min_y, *min_z);
+  const Point box_max(*max_x, *max_y, *max_z);
+
+  std::vector<Length> distances(num_receivers);
+  for (Int mx = -n[0]; mx <= n[0]; ++mx) {
+    for (Int my = -n[1]; my <= n[1]; ++my) {
+      for (Int mz = -n[2]; mz <= n[2]; ++mz) {
         for (Int px = 0; px <= 1; ++px) {
           for (Int py = 0; py <= 1; ++py) {
             for (Int pz = 0; pz <= 1; ++pz) {
-              Point image_position =
-                  ((CuboidRoom*)room_)
-                      ->ImageSourcePosition(source_->position(), mx, my, mz, px,
-                                            py, pz);
-
-              Time delay =
-                  dsp::Subtract(image_position, microphone_->position())
-                      .norm() /
-                  SOUND_SPEED;
-
-              if (randomisation) {
-                delay += rand_delays.at(k++);
+              const Sample gid = gains[0][(mx + n[0]) * 2 + px] *
+                                 gains[1][(my + n[1]) * 2 + py] *
+                                 gains[2][(mz + n[2]) * 2 + pz];
+              if (gid == 0.0) {
+                continue;
               }
 
-              if (round(delay * sampling_frequency_) < 0 ||
-                  round(delay * sampling_frequency_) >= rir_length_) {
-                continue;
+              for (Int s = 0; s < num_sources; ++s) {
+                const Point image_position = room->ImageSourcePosition(
+                    source_positions[s], mx, my, mz, px, py, pz);
+
+                // Skips images that are too far from all receivers
+                const Point box_distance(
+                    std::max(std::max(box_min.x() - image_position.x(),
+                                      image_position.x() - box_max.x()),
+                             0.0),
+                    std::max(std::max(box_min.y() - image_position.y(),
+                                      image_position.y() - box_max.y()),
+                             0.0),
+                    std::max(std::max(box_min.z() - image_position.z(),
+                                      image_position.z() - box_max.z()),
+                             0.0));
+                if (box_distance.norm() >= max_distance) {
+                  continue;
+                }
+
+                for (Int r = 0; r < num_receivers; ++r) {
+                  const Length dx = receivers_x[r] - image_position.x();
+                  const Length dy = receivers_y[r] - image_position.y();
+                  const Length dz = receivers_z[r] - image_position.z();
+                  distances[r] = sqrt(dx * dx + dy * dy + dz * dz);
+                }
+
+                for (Int r = 0; r < num_receivers; ++r) {
+                  const Time delay = distances[r] / SOUND_SPEED;
+                  if (round(delay * sampling_frequency_) >= rir_length_) {
+                    continue;
+                  }
+                  WriteSample(
+                      delay, gid / (delay * sampling_frequency_),
+                      std::span<Sample>(
+                          &rirs[(s * num_receivers + r) * rir_length_],
+                          rir_length_));
+                }
               }
+            }
+          }
+        }
+      }
+    }
+  }
+  return rirs;
+}
 
-              Sample gid = Pow(beta.GetElement(0, 0), Abs((Sample)mx - px)) *
-                           Pow(beta.GetElement(1, 0), Abs((Sample)mx)) *
-                           Pow(beta.GetElement(0, 1), Abs((Sample)my - py)) *
-                           Pow(beta.GetElement(1, 1), Abs((Sample)my)) *
-                           Pow(beta.GetElement(0, 2), Abs((Sample)mz - pz)) *
-                           Pow(beta.GetElement(1, 2), Abs((Sample)mz));
+void Ism::AddLateReverberation(std::span<const Sample> window_energies,
+                               const Int mixing_sample,
+                               const bool directional) {
+  const Int num_bands = band_frequencies_.size();
+  const bool multiband = num_bands > 0;
+  const Int window_start = mixing_sample / 2;
+  // The tail of directional microphones is split evenly across the
+  // direction bins (the last bin is reserved to the direct path).
+  const Int num_directions = directional ? direction_bins_.size() : 0;
+  CuboidRoom* room = (CuboidRoom*)room_;
+
+  for (size_t b = 0; b < window_energies.size(); ++b) {
+    const Time rt60 =
+        multiband ? room->SabineRt60(band_frequencies_[b], sampling_frequency_)
+                  : room->SabineRt60();
+    // Amplitude decay per sample, i.e. 60 dB over `rt60`
+    const Sample decay = 3.0 * log(10.0) / (rt60 * sampling_frequency_);
+
+    // Expected energy of the tail, extrapolated back over the window
+    Sample model_energy = 0.0;
+    for (Int n = window_start; n < mixing_sample; ++n) {
+      model_energy += exp(-2.0 * decay * (Sample)(n - mixing_sample));
+    }
+    const Sample gain = (model_energy > 0.0)
+                            ? sqrt(window_energies[b] / model_energy)
+                            : 0.0;
+
+    for (Int i = 0; i <= num_directions; ++i) {
+      // Output 0 is the omnidirectional RIR, the others the direction bins
+      std::vector<Sample>& rir =
+          multiband ? band_rirs_[i * num_bands + b]
+                    : ((i == 0) ? rir_ : bin_rirs_[i - 1]);
+      const Sample output_gain =
+          (i == 0) ? gain : gain / sqrt((Sample)num_directions);
+      dsp::RandomGenerator generator(
+          (unsigned int)(b * (num_directions + 1) + i + 1));
+      const std::vector<Sample> noise =
+          generator.Randn(rir_length_ - mixing_sample);
+      for (Int n = mixing_sample; n < rir_length_; ++n) {
+        rir[n] += output_gain * noise[n - mixing_sample] *
+                  exp(-decay * (Sample)(n - mixing_sample));
+      }
+    }
+  }
+}
+
+void Ism::MergeBands(std::span<const std::vector<Sample>> bands,
+                     std::vector<Sample>& rir) const {
+  ASSERT(bands.size() == crossover_filters_.size());
+  const Int delay = (crossover_filters_[0].size() - 1) / 2;
+  std::vector<Sample> input(rir_length_ + delay, 0.0);
+  std::vector<Sample> output(rir_length_ + delay);
+  rir.assign(rir_length_, 0.0);
+  for (size_t b = 0; b < bands.size(); ++b) {
+    std::copy(bands[b].begin(), bands[b].end(), input.begin());
+    dsp::PartitionedConvolver convolver(crossover_filters_[b]);
+    convolver.ProcessBlock(input, output);
+    for (Int n = 0; n < rir_length_; ++n) {
+      rir[n] += output[n + delay];
+    }
+  }
+}
+
+void Ism::SetFrequencyBands(const std::vector<Time>& centre_frequencies) {
+  band_frequencies_ = centre_frequencies;
+  crossover_filters_.clear();
+  if (centre_frequencies.size() == 1) {
+    crossover_filters_.push_back(std::vector<Sample>(1, 1.0));
+  } else if (centre_frequencies.size() > 1) {
+    std::vector<Time> crossover_frequencies;
+    for (size_t b = 1; b < centre_frequencies.size(); ++b) {
+      crossover_frequencies.push_back(
+          sqrt(centre_frequencies[b - 1] * centre_frequencies[b]));
+    }
+    // About four periods of the lowest crossover frequency
+    const Int length =
+        2 * (Int)ceil(2.0 * sampling_frequency_ / crossover_frequencies[0]) +
+        1;
+    crossover_filters_ = dsp::LinearPhaseCrossover(
+        crossover_frequencies, sampling_frequency_, length);
+  }
+  Update();
+}
 
-              Sample attenuation = gid / (delay * sampling_frequency_);
+void Ism::SetLateReverberation(const Time mixing_time) {
+  ASSERT(mixing_time >= 0.0);
+  mixing_time_ = mixing_time;
+  Update();
+}
 
-              images_position_.push_back(image_position);
-              images_delay_.push_back(delay);
+void Ism::SetEnergyThreshold(const Sample threshold_db,
+                             const bool automatic_length) {
+  ASSERT(threshold_db <= 0.0);
+  ASSERT(!automatic_length || threshold_db < 0.0);
+  energy_threshold_ = threshold_db;
+  automatic_length_ = automatic_length;
+  Update();
+}
 
-              WriteSample(delay, attenuation);
-            }
-          }
-        }
+Int Ism::AutomaticLength() const {
+  CuboidRoom* room = (CuboidRoom*)room_;
+  Time rt60 = 0.0;
+  if (band_frequencies_.empty()) {
+    rt60 = room->SabineRt60();
+  }
+  for (const Time frequency : band_frequencies_) {
+    rt60 = std::max(rt60, room->SabineRt60(frequency, sampling_frequency_));
+  }
+  if (!std::isfinite(rt60)) {
+    dsp::Logger::GetInstance().LogError(
+        "The reverberation time is not finite; keeping a RIR length of %lld "
+        "samples.",
+        rir_length_);
+    return rir_length_;
+  }
+  // The decay starts with the direct path
+  const Time direct_delay =
+      dsp::Distance(source_->position(), microphone_->position()) /
+      SOUND_SPEED;
+  const Time decay_time = rt60 * (-energy_threshold_) / 60.0;
+  return (Int)ceil((direct_delay + decay_time) * sampling_frequency_) + 1;
+}
+
+std::vector<Time> Ism::OctaveBands(const Time sampling_frequency) {
+  std::vector<Time> centre_frequencies;
+  for (Time frequency = 125.0; frequency * sqrt(2.0) < sampling_frequency / 2.0;
+       frequency *= 2.0) {
+    centre_frequencies.push_back(frequency);
+  }
+  return centre_frequencies;
+}
+
+uint64_t Ism::CacheKey() const {
+  RirCache::Key key("Ism");
+  key.Add(((CuboidRoom*)room_)->dimensions(), cache_tolerance_);
+  for (const dsp::Filter& filter : room_->wall_filters()) {
+    key.AddImpulseResponse(filter);
+  }
+  key.Add(source_->position(), cache_tolerance_)
+      .Add(microphone_->position(), cache_tolerance_)
+      .Add(sampling_frequency_)
+      .Add(rir_length_)
+      .Add((Int)interpolation_)
+      .Add(peterson_window_)
+      .Add(random_distance_)
+      .Add(band_frequencies_)
+      .Add(mixing_time_)
+      .Add(energy_threshold_);
+  return key.value();
+}
+
+void Ism::UpdatePetersonTable() {
+  if (!peterson_table_.empty() &&
+      dsp::IsEqual(peterson_table_window_, peterson_window_) &&
+      dsp::IsEqual(peterson_table_sampling_frequency_, sampling_frequency_)) {
+    return;
+  }
+  peterson_table_window_ = peterson_window_;
+  peterson_table_sampling_frequency_ = sampling_frequency_;
+
+  // Half window length in samples
+  const Time half_window = peterson_window_ * sampling_frequency_ / 2.0;
+  // The cutoff frequency is 90% of Nyquist frequency
+  const Time f_c = 0.9 / 2.0;  // Normalised by the sampling frequency
+
+  // Covers all the taps written by WriteSample (with a one-tap margin on
+  // either side for rounding errors)
+  peterson_table_offset_ = (Int)floor(-half_window);
+  peterson_table_width_ =
+      (Int)floor(half_window) + 2 - peterson_table_offset_ + 1;
+  peterson_table_.resize((kPetersonOversampling + 1) * peterson_table_width_);
+
+  for (Int row = 0; row <= kPetersonOversampling; ++row) {
+    const Time fraction = ((Time)row) / ((Time)kPetersonOversampling);
+    for (Int i = 0; i < peterson_table_width_; ++i) {
+      // Time distance from the image's delay, in samples
+      const Time t = ((Time)(peterson_table_offset_ + i)) - fraction;
+      Sample low_pass = 1.0 / 2.0 * (1.0 + cos(PI * t / half_window)) *
+                        sin(2.0 * PI * f_c * t) / (2.0 * PI * f_c * t);
+
+      // If low_pass is nan it means that t=0 and sinc(0)=1
+      if (isnan(low_pass)) {
+        low_pass = 1.0;
       }
+      peterson_table_[row * peterson_table_width_ + i] = low_pass;
     }
   }
 }
 
-void Ism::WriteSample(const sal::Time& delay, const sal::Sample& attenuation) {
+void Ism::WriteSample(const sal::Time& delay, const sal::Sample& attenuation,
+                      std::span<Sample> rir) {
   sal::Time delay_norm = delay * sampling_frequency_;
   Int id_round = dsp::RoundToInt(delay_norm);
-  Int rir_length = rir_.size();
+  Int rir_length = rir.size();
 
   switch (interpolation_) {
     case none: {
-      rir_.at(id_round) += attenuation;
-      images_int_delay_filter_.push_back(sal::DelayFilter(id_round, id_round));
-      images_frac_delay_filter_.push_back(
-          dsp::FirFilter::GainFilter(attenuation));
+      ASSERT(id_round >= 0 && id_round < rir_length);
+      rir[id_round] += attenuation;
       break;
     }
     case peterson: {
-      // The cutoff frequency is 90% of Nyquist frequency
-      sal::Time f_c = 0.9 * (sampling_frequency_ / 2.0);
-      sal::Time T_w = peterson_window_;
-
-      sal::Time tau = ((sal::Time)delay_norm) / sampling_frequency_;
-
-      std::vector<sal::Sample> filter_coefficients;
-      sal::Int integer_delay =
-          (Int)floor(sampling_frequency_ * (-T_w / 2.0 + tau));
-      for (Int n = integer_delay + 1;
-           n < floor(sampling_frequency_ * (T_w / 2.0 + tau)); ++n) {
-        if (n < 0 || n >= ((Int)rir_length)) {
-          continue;
-        }
-
-        sal::Time t = ((sal::Time)n) / sampling_frequency_ - tau;
-        sal::Sample low_pass = 1.0 / 2.0 * (1.0 + cos(2.0 * PI * t / T_w)) *
-                               sin(2.0 * PI * f_c * t) / (2.0 * PI * f_c * t);
-
-        // If low_pass is nan it means that t=0 and sinc(0)=1
-        if (isnan(low_pass)) {
-          low_pass = 1.0;
-        }
-
-        filter_coefficients.push_back(attenuation * low_pass);
-        rir_.at(n) += attenuation * low_pass;
+      const Time half_window = peterson_window_ * sampling_frequency_ / 2.0;
+      const Int begin = std::max((Int)floor(delay_norm - half_window) + 1,
+                                 (Int)0);
+      const Int end =
+          std::min((Int)floor(delay_norm + half_window), rir_length);
+      if (begin >= end) {
+        break;
       }
 
-      sal::Int nneg_integer_delay = (integer_delay < 0) ? 0 : integer_delay;
-      images_int_delay_filter_.push_back(
-          sal::DelayFilter(nneg_integer_delay, nneg_integer_delay));
-      images_frac_delay_filter_.push_back(dsp::FirFilter(filter_coefficients));
-
+      // The kernel is interpolated linearly between the two rows of the
+      // table closest to the fractional delay.
+      const Int integer_delay = (Int)floor(delay_norm);
+      const Time position =
+          (delay_norm - (Time)integer_delay) * kPetersonOversampling;
+      const Int row =
+          std::min((Int)floor(position), kPetersonOversampling - 1);
+      const Sample weight = position - (Time)row;
+
+      const Int column = begin - integer_delay - peterson_table_offset_;
+      const Int num_taps = end - begin;
+      ASSERT(column >= 0 && column + num_taps <= peterson_table_width_);
+      std::span<const Sample> lower_row(
+          &peterson_table_[row * peterson_table_width_ + column], num_taps);
+      std::span<const Sample> upper_row(
+          &peterson_table_[(row + 1) * peterson_table_width_ + column],
+          num_taps);
+      std::span<Sample> output = rir.subspan(begin, num_taps);
+      dsp::MultiplyAdd(lower_row, attenuation * (1.0 - weight), output,
+                       output);
+      dsp::MultiplyAdd(upper_row, attenuation * weight, output, output);
       break;
     }
   }
 }
 
 void Ism::Update() {
+  if (async_convolver_) {
+    // The scene is handed over as plain data, without locks or memory
+    // allocation, and replaces any scene that the worker thread has not
+    // picked up yet.
+    AsyncScene& scene = async_state_->scenes[async_state_->back];
+    scene.source_position = source_->position();
+    scene.microphone_position = microphone_->position();
+    scene.room_dimensions = ((CuboidRoom*)room_)->dimensions();
+    scene.rir_length = rir_length_;
+    scene.random_distance = random_distance_;
+    scene.peterson_window = peterson_window_;
+    scene.cache_tolerance = cache_tolerance_;
+    scene.mixing_time = mixing_time_;
+    scene.energy_threshold = energy_threshold_;
+    scene.automatic_length = automatic_length_;
+    async_state_->back =
+        async_state_->middle.exchange(
+            async_state_->back | AsyncState::kNewScene,
+            std::memory_order_acq_rel) &
+        ~AsyncState::kNewScene;
+    async_convolver_->RequestUpdate();
+    return;
+  }
   modified_ = true;
   rir_.clear();
   images_delay_.clear();
   images_position_.clear();
-  images_int_delay_filter_.clear();
-  images_frac_delay_filter_.clear();
 }
 
 }  // namespace sal
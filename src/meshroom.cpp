@@ -0,0 +1,543 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#include "meshroom.h"
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include "cuboidroom.h"
+
+namespace sal {
+
+using dsp::Point;
+
+namespace {
+
+/** Reflection coefficient of rigid walls, for which the impedance would be
+ infinite */
+constexpr Sample kMaxReflection = 1.0 - 1.0E-6;
+
+Int FindOrAddMaterial(const std::string& name,
+                      std::vector<std::string>& material_names) {
+  const auto it =
+      std::find(material_names.begin(), material_names.end(), name);
+  if (it != material_names.end()) {
+    return (Int)(it - material_names.begin());
+  }
+  material_names.push_back(name);
+  return (Int)material_names.size() - 1;
+}
+
+}  // namespace
+
+TriangleMesh::TriangleMesh(const std::vector<Point>& vertices,
+                           const std::vector<Triangle>& triangles,
+                           const std::vector<std::string>& material_names)
+    : vertices_(vertices),
+      triangles_(triangles),
+      material_names_(material_names) {
+  ASSERT(!vertices_.empty());
+  for (const Triangle& triangle : triangles_) {
+    for (const Int vertex : triangle.vertices) {
+      ASSERT(vertex >= 0 && vertex < (Int)vertices_.size());
+    }
+    ASSERT(triangle.material >= 0 && triangle.material < num_materials());
+  }
+  min_corner_ = vertices_[0];
+  max_corner_ = vertices_[0];
+  for (const Point& vertex : vertices_) {
+    min_corner_ = Point(std::min(min_corner_.x(), vertex.x()),
+                        std::min(min_corner_.y(), vertex.y()),
+                        std::min(min_corner_.z(), vertex.z()));
+    max_corner_ = Point(std::max(max_corner_.x(), vertex.x()),
+                        std::max(max_corner_.y(), vertex.y()),
+                        std::max(max_corner_.z(), vertex.z()));
+  }
+}
+
+bool TriangleMesh::LoadObj(const std::string& path, TriangleMesh& mesh) {
+  std::ifstream file(path);
+  if (!file.is_open() || !ReadObj(file, mesh)) {
+    dsp::Logger::GetInstance().LogError("Could not load OBJ mesh %s",
+                                        path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool TriangleMesh::LoadPly(const std::string& path, TriangleMesh& mesh) {
+  std::ifstream file(path);
+  if (!file.is_open() || !ReadPly(file, mesh)) {
+    dsp::Logger::GetInstance().LogError("Could not load PLY mesh %s",
+                                        path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool TriangleMesh::Load(const std::string& path, TriangleMesh& mesh) {
+  std::string extension = path.substr(path.find_last_of('.') + 1);
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](const unsigned char c) { return std::tolower(c); });
+  if (extension == "ply") {
+    return LoadPly(path, mesh);
+  }
+  return LoadObj(path, mesh);
+}
+
+bool TriangleMesh::ReadObj(std::istream& stream, TriangleMesh& mesh) {
+  std::vector<Point> vertices;
+  std::vector<Triangle> triangles;
+  std::vector<std::string> material_names;
+  Int material = -1;
+  std::string line;
+  while (std::getline(stream, line)) {
+    std::istringstream tokens(line);
+    std::string keyword;
+    if (!(tokens >> keyword)) {
+      continue;
+    }
+    if (keyword == "v") {
+      Length x;
+      Length y;
+      Length z;
+      if (!(tokens >> x >> y >> z)) {
+        return false;
+      }
+      vertices.push_back(Point(x, y, z));
+    } else if (keyword == "usemtl") {
+      std::string name;
+      tokens >> name;
+      material = FindOrAddMaterial(name, material_names);
+    } else if (keyword == "f") {
+      if (material < 0) {
+        material = FindOrAddMaterial("default", material_names);
+      }
+      // Vertices are written as v, v/vt, v//vn or v/vt/vn, and negative
+      // indices count back from the last vertex
+      std::vector<Int> polygon;
+      std::string vertex;
+      while (tokens >> vertex) {
+        char* end;
+        const Int index = std::strtoll(vertex.c_str(), &end, 10);
+        if (end == vertex.c_str() || index == 0) {
+          return false;
+        }
+        polygon.push_back((index > 0) ? index - 1
+                                      : (Int)vertices.size() + index);
+      }
+      if (polygon.size() < 3) {
+        return false;
+      }
+      for (size_t k = 1; k + 1 < polygon.size(); ++k) {
+        triangles.push_back({{polygon[0], polygon[k], polygon[k + 1]},
+                             material});
+      }
+    }
+  }
+
+  if (triangles.empty()) {
+    return false;
+  }
+  for (const Triangle& triangle : triangles) {
+    for (const Int vertex : triangle.vertices) {
+      if (vertex < 0 || vertex >= (Int)vertices.size()) {
+        return false;
+      }
+    }
+  }
+  mesh = TriangleMesh(vertices, triangles, material_names);
+  return true;
+}
+
+bool TriangleMesh::ReadPly(std::istream& stream, TriangleMesh& mesh) {
+  struct Element {
+    std::string name;
+    Int count;
+    /** Names of the properties, and whether each of them is a list */
+    std::vector<std::string> properties;
+    std::vector<bool> is_list;
+  };
+  std::vector<Element> elements;
+  std::string line;
+  if (!std::getline(stream, line) || line.rfind("ply", 0) != 0) {
+    return false;
+  }
+  while (std::getline(stream, line)) {
+    std::istringstream tokens(line);
+    std::string keyword;
+    if (!(tokens >> keyword)) {
+      continue;
+    }
+    if (keyword == "end_header") {
+      break;
+    } else if (keyword == "format") {
+      std::string format;
+      tokens >> format;
+      if (format != "ascii") {
+        return false;
+      }
+    } else if (keyword == "element") {
+      Element element;
+      if (!(tokens >> element.name >> element.count)) {
+        return false;
+      }
+      elements.push_back(element);
+    } else if (keyword == "property") {
+      if (elements.empty()) {
+        return false;
+      }
+      std::string type;
+      std::string name;
+      tokens >> type;
+      const bool is_list = (type == "list");
+      if (is_list) {
+        std::string count_type;
+        tokens >> count_type >> type;
+      }
+      tokens >> name;
+      elements.back().properties.push_back(name);
+      elements.back().is_list.push_back(is_list);
+    }
+  }
+
+  std::vector<Point> vertices;
+  std::vector<Triangle> triangles;
+  Int num_materials = 1;
+  for (const Element& element : elements) {
+    for (Int i = 0; i < element.count; ++i) {
+      if (!std::getline(stream, line)) {
+        return false;
+      }
+      std::istringstream tokens(line);
+      Length coordinates[3] = {0.0, 0.0, 0.0};
+      std::vector<Int> polygon;
+      Int material = 0;
+      for (size_t k = 0; k < element.properties.size(); ++k) {
+        const std::string& property = element.properties[k];
+        if (element.is_list[k]) {
+          Int length;
+          if (!(tokens >> length)) {
+            return false;
+          }
+          std::vector<Int> values(length);
+          for (Int& value : values) {
+            tokens >> value;
+          }
+          if (property == "vertex_indices" || property == "vertex_index") {
+            polygon = values;
+          }
+          continue;
+        }
+        double value;
+        if (!(tokens >> value)) {
+          return false;
+        }
+        if (property == "x" || property == "y" || property == "z") {
+          coordinates[property[0] - 'x'] = value;
+        } else if (property == "material") {
+          material = (Int)value;
+        }
+      }
+      if (!tokens) {
+        return false;
+      }
+      if (element.name == "vertex") {
+        vertices.push_back(Point(coordinates[0], coordinates[1],
+                                 coordinates[2]));
+      } else if (element.name == "face") {
+        if (polygon.size() < 3 || material < 0) {
+          return false;
+        }
+        num_materials = std::max(num_materials, material + 1);
+        for (size_t k = 1; k + 1 < polygon.size(); ++k) {
+          triangles.push_back({{polygon[0], polygon[k], polygon[k + 1]},
+                               material});
+        }
+      }
+    }
+  }
+
+  if (triangles.empty()) {
+    return false;
+  }
+  for (const Triangle& triangle : triangles) {
+    for (const Int vertex : triangle.vertices) {
+      if (vertex < 0 || vertex >= (Int)vertices.size()) {
+        return false;
+      }
+    }
+  }
+  std::vector<std::string> material_names;
+  for (Int k = 0; k < num_materials; ++k) {
+    material_names.push_back("material_" + std::to_string(k));
+  }
+  mesh = TriangleMesh(vertices, triangles, material_names);
+  return true;
+}
+
+TriangleMesh TriangleMesh::Cuboid(const Length x, const Length y,
+                                  const Length z) {
+  // Vertex 4 i + 2 j + k is at (i x, j y, k z)
+  std::vector<Point> vertices;
+  for (Int i = 0; i < 2; ++i) {
+    for (Int j = 0; j < 2; ++j) {
+      for (Int k = 0; k < 2; ++k) {
+        vertices.push_back(Point(i * x, j * y, k * z));
+      }
+    }
+  }
+  // Faces in the order of `CuboidWallId`, counter-clockwise from outside
+  const Int faces[6][4] = {{0, 1, 3, 2}, {4, 6, 7, 5}, {0, 4, 5, 1},
+                           {2, 3, 7, 6}, {0, 2, 6, 4}, {1, 5, 7, 3}};
+  std::vector<Triangle> triangles;
+  for (Int face = 0; face < 6; ++face) {
+    const Int* v = faces[face];
+    triangles.push_back({{v[0], v[1], v[2]}, face});
+    triangles.push_back({{v[0], v[2], v[3]}, face});
+  }
+  return TriangleMesh(vertices, triangles,
+                      {"x1", "x2", "y1", "y2", "z1", "z2"});
+}
+
+Point TriangleMesh::Normal(const Int triangle) const noexcept {
+  return dsp::Normalized(dsp::CrossProduct(
+      dsp::Subtract(Vertex(triangle, 1), Vertex(triangle, 0)),
+      dsp::Subtract(Vertex(triangle, 2), Vertex(triangle, 0))));
+}
+
+Length TriangleMesh::Area(const Int triangle) const noexcept {
+  return 0.5 * dsp::CrossProduct(
+                   dsp::Subtract(Vertex(triangle, 1), Vertex(triangle, 0)),
+                   dsp::Subtract(Vertex(triangle, 2), Vertex(triangle, 0)))
+                   .norm();
+}
+
+Length TriangleMesh::Volume() const noexcept {
+  Length volume = 0.0;
+  for (Int t = 0; t < num_triangles(); ++t) {
+    volume += dsp::DotProduct(
+        Vertex(t, 0), dsp::CrossProduct(Vertex(t, 1), Vertex(t, 2)));
+  }
+  return volume / 6.0;
+}
+
+bool TriangleMesh::LineCrossing(const Point& a, const Point& b,
+                                const Point& c, const Int axis,
+                                const Length u, const Length v,
+                                Length& w) noexcept {
+  const Int axis_u = (axis + 1) % 3;
+  const Int axis_v = (axis + 2) % 3;
+  const Length a_u = Coordinate(a, axis_u) - u;
+  const Length a_v = Coordinate(a, axis_v) - v;
+  const Length b_u = Coordinate(b, axis_u) - u;
+  const Length b_v = Coordinate(b, axis_v) - v;
+  const Length c_u = Coordinate(c, axis_u) - u;
+  const Length c_v = Coordinate(c, axis_v) - v;
+  // Twice the signed areas of the triangles formed by the line and each edge
+  const Length area_ab = a_u * b_v - a_v * b_u;
+  const Length area_bc = b_u * c_v - b_v * c_u;
+  const Length area_ca = c_u * a_v - c_v * a_u;
+  if (!((area_ab >= 0.0 && area_bc >= 0.0 && area_ca >= 0.0) ||
+        (area_ab <= 0.0 && area_bc <= 0.0 && area_ca <= 0.0))) {
+    return false;
+  }
+  const Length area = area_ab + area_bc + area_ca;
+  if (area == 0.0) {
+    // The triangle is parallel to the line
+    return false;
+  }
+  w = (area_bc * Coordinate(a, axis) + area_ca * Coordinate(b, axis) +
+       area_ab * Coordinate(c, axis)) /
+      area;
+  return true;
+}
+
+bool TriangleMesh::IsPointInside(const Point& point) const noexcept {
+  const Point shifted = dsp::Sum(point, InsideTestOffset(1.0));
+  Int num_crossings = 0;
+  for (Int t = 0; t < num_triangles(); ++t) {
+    Length z;
+    if (LineCrossing(Vertex(t, 0), Vertex(t, 1), Vertex(t, 2), 2,
+                     shifted.x(), shifted.y(), z) &&
+        z > shifted.z()) {
+      num_crossings++;
+    }
+  }
+  return num_crossings % 2 == 1;
+}
+
+Point TriangleMesh::ClosestPoint(const Int triangle,
+                                 const Point& point) const noexcept {
+  // C. Ericson, "Real-Time Collision Detection", Sec. 5.1.5
+  const Point& a = Vertex(triangle, 0);
+  const Point& b = Vertex(triangle, 1);
+  const Point& c = Vertex(triangle, 2);
+  const Point ab = dsp::Subtract(b, a);
+  const Point ac = dsp::Subtract(c, a);
+  const Point ap = dsp::Subtract(point, a);
+  const Length d1 = dsp::DotProduct(ab, ap);
+  const Length d2 = dsp::DotProduct(ac, ap);
+  if (d1 <= 0.0 && d2 <= 0.0) {
+    return a;
+  }
+  const Point bp = dsp::Subtract(point, b);
+  const Length d3 = dsp::DotProduct(ab, bp);
+  const Length d4 = dsp::DotProduct(ac, bp);
+  if (d3 >= 0.0 && d4 <= d3) {
+    return b;
+  }
+  const Length vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) {
+    return dsp::Sum(a, dsp::Multiply(ab, d1 / (d1 - d3)));
+  }
+  const Point cp = dsp::Subtract(point, c);
+  const Length d5 = dsp::DotProduct(ab, cp);
+  const Length d6 = dsp::DotProduct(ac, cp);
+  if (d6 >= 0.0 && d5 <= d6) {
+    return c;
+  }
+  const Length vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) {
+    return dsp::Sum(a, dsp::Multiply(ac, d2 / (d2 - d6)));
+  }
+  const Length va = d3 * d6 - d5 * d4;
+  if (va <= 0.0 && (d4 - d3) >= 0.0 && (d5 - d6) >= 0.0) {
+    return dsp::Sum(b, dsp::Multiply(dsp::Subtract(c, b),
+                                     (d4 - d3) / ((d4 - d3) + (d5 - d6))));
+  }
+  const Length denominator = 1.0 / (va + vb + vc);
+  return dsp::Sum(a, dsp::Sum(dsp::Multiply(ab, vb * denominator),
+                              dsp::Multiply(ac, vc * denominator)));
+}
+
+Length TriangleMesh::Distance(const Point& point,
+                              Int& triangle) const noexcept {
+  Length min_distance = std::numeric_limits<Length>::infinity();
+  triangle = 0;
+  for (Int t = 0; t < num_triangles(); ++t) {
+    const Length distance = dsp::Distance(point, ClosestPoint(t, point));
+    if (distance < min_distance) {
+      min_distance = distance;
+      triangle = t;
+    }
+  }
+  return min_distance;
+}
+
+MeshRoom::MeshRoom(const TriangleMesh& mesh,
+                   const std::vector<dsp::Filter>& wall_filters)
+    : Room(wall_filters),
+      mesh_(mesh),
+      orientation_((mesh.Volume() >= 0.0) ? 1.0 : -1.0) {
+  ASSERT((Int)wall_filters.size() == mesh_.num_materials());
+}
+
+MeshRoom::MeshRoom(const TriangleMesh& mesh, const dsp::Filter& wall_filter)
+    : MeshRoom(mesh,
+               std::vector<dsp::Filter>(mesh.num_materials(), wall_filter)) {}
+
+std::vector<Sample> MeshRoom::WallImpedances() const {
+  std::vector<Sample> impedances;
+  for (const dsp::Filter& filter : wall_filters_) {
+    const Sample reflection = std::min(
+        CuboidRoom::GetFilterResponse(filter, 0.0, 1.0), kMaxReflection);
+    impedances.push_back((1.0 + reflection) / (1.0 - reflection));
+  }
+  return impedances;
+}
+
+Point MeshRoom::InwardNormal(const Int triangle) const noexcept {
+  return dsp::Multiply(mesh_.Normal(triangle), -orientation_);
+}
+
+std::vector<Point> MeshRoom::CalculateBoundaryPoints(
+    const Point& source, const Point& destination) const noexcept {
+  std::vector<Point> boundary_points(num_boundary_points());
+  CalculateBoundaryPoints(source, destination, boundary_points);
+  return boundary_points;
+}
+
+void MeshRoom::CalculateBoundaryPoints(
+    const Point& source, const Point& destination,
+    std::span<Point> boundary_points) const noexcept {
+  ASSERT((Int)boundary_points.size() == num_boundary_points());
+  for (Int t = 0; t < mesh_.num_triangles(); ++t) {
+    const Point& vertex = mesh_.Vertex(t, 0);
+    const Point normal = mesh_.Normal(t);
+    // Intersection with the plane of the triangle of the line from the image
+    // of the source to the destination
+    const Length source_distance =
+        dsp::DotProduct(dsp::Subtract(source, vertex), normal);
+    const Length destination_distance =
+        dsp::DotProduct(dsp::Subtract(destination, vertex), normal);
+    const Point image =
+        dsp::Subtract(source, dsp::Multiply(normal, 2.0 * source_distance));
+    Point reflection;
+    if (source_distance + destination_distance == 0.0) {
+      reflection = dsp::Subtract(
+          destination, dsp::Multiply(normal, destination_distance));
+    } else {
+      reflection = dsp::Sum(
+          image, dsp::Multiply(dsp::Subtract(destination, image),
+                               source_distance / (source_distance +
+                                                  destination_distance)));
+    }
+    boundary_points[t] = mesh_.ClosestPoint(t, reflection);
+  }
+}
+
+std::vector<dsp::Filter> MeshRoom::GetBoundaryFilters(
+    const Point& source_point, const Point& mic_point) const noexcept {
+  std::vector<Int> wall_ids(num_boundary_points());
+  GetBoundaryWallIds(source_point, mic_point, wall_ids);
+  std::vector<dsp::Filter> filters;
+  filters.reserve(wall_ids.size());
+  for (const Int wall_id : wall_ids) {
+    filters.push_back(wall_filters_[wall_id]);
+  }
+  return filters;
+}
+
+void MeshRoom::GetBoundaryWallIds(const Point& /* source_point */,
+                                  const Point& /* mic_point */,
+                                  std::span<Int> wall_ids) const noexcept {
+  ASSERT((Int)wall_ids.size() == num_boundary_points());
+  for (Int t = 0; t < mesh_.num_triangles(); ++t) {
+    wall_ids[t] = mesh_.triangles()[t].material;
+  }
+}
+
+Length MeshRoom::max_distance() const noexcept {
+  return dsp::Distance(mesh_.min_corner(), mesh_.max_corner());
+}
+
+bool MeshRoom::IsPointInRoom(const Point& point,
+                             const Length wall_distance) const noexcept {
+  if (!mesh_.IsPointInside(point)) {
+    return false;
+  }
+  Int triangle;
+  return wall_distance <= 0.0 ||
+         mesh_.Distance(point, triangle) >= wall_distance;
+}
+
+std::string MeshRoom::ShapeDescription() const noexcept {
+  return "The room is a mesh of " + ToString(mesh_.num_triangles()) +
+         " triangles with " + ToString(mesh_.min_corner().x()) + "<x<" +
+         ToString(mesh_.max_corner().x()) + " " +
+         ToString(mesh_.min_corner().y()) + "<y<" +
+         ToString(mesh_.max_corner().y()) + " " +
+         ToString(mesh_.min_corner().z()) + "<z<" +
+         ToString(mesh_.max_corner().z()) + " [m].";
+}
+
+}  // namespace sal
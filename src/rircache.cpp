@@ -0,0 +1,251 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#include "rircache.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <atomic>
+
+#if _WIN32 || _WIN64
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace sal {
+
+namespace {
+
+/** Header of RIR files */
+struct FileHeader {
+  char magic[8];
+  uint64_t key;
+  uint64_t num_samples;
+  uint64_t sample_size;
+};
+
+const char kFileMagic[8] = {'S', 'A', 'L', 'R', 'I', 'R', '0', '1'};
+
+bool IsValidHeader(const FileHeader& header, const uint64_t key) {
+  return std::memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) == 0 &&
+         header.key == key && header.sample_size == sizeof(Sample);
+}
+
+}  // namespace
+
+RirCache::Key::Key(const std::string& tag) noexcept : value_(kOffsetBasis) {
+  AddBytes(tag.data(), tag.size());
+}
+
+RirCache::Key& RirCache::Key::Add(const Int value) noexcept {
+  AddBytes(&value, sizeof(value));
+  return *this;
+}
+
+RirCache::Key& RirCache::Key::Add(const Sample value,
+                                  const Sample tolerance) noexcept {
+  ASSERT(tolerance >= 0.0);
+  if (tolerance > 0.0) {
+    return Add((Int)std::llround(value / tolerance));
+  }
+  // Makes sure that 0.0 and -0.0 have the same key
+  const Sample exact_value = (value == 0.0) ? 0.0 : value;
+  AddBytes(&exact_value, sizeof(exact_value));
+  return *this;
+}
+
+RirCache::Key& RirCache::Key::Add(const dsp::Point& point,
+                                  const Sample tolerance) noexcept {
+  return Add(point.x(), tolerance)
+      .Add(point.y(), tolerance)
+      .Add(point.z(), tolerance);
+}
+
+RirCache::Key& RirCache::Key::Add(std::span<const Sample> values) noexcept {
+  Add((Int)values.size());
+  for (const Sample value : values) {
+    Add(value);
+  }
+  return *this;
+}
+
+RirCache::Key& RirCache::Key::AddImpulseResponse(const dsp::Filter& filter,
+                                                 const Int length) {
+  dsp::Filter filter_copy(filter);
+  filter_copy.ResetState();
+  Signal impulse(length, 0.0);
+  impulse[0] = 1.0;
+  Signal impulse_response(length);
+  filter_copy.ProcessBlock(impulse, impulse_response);
+  return Add(impulse_response);
+}
+
+void RirCache::Key::AddBytes(const void* data,
+                             const size_t num_bytes) noexcept {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < num_bytes; ++i) {
+    value_ ^= (uint64_t)bytes[i];
+    value_ *= kPrime;
+  }
+}
+
+RirCache::RirCache(const size_t capacity, const std::string& directory)
+    : capacity_(capacity), directory_(directory) {
+  ASSERT(capacity > 0);
+}
+
+bool RirCache::Find(const uint64_t key, Signal& rir) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iterator = index_.find(key);
+    if (iterator != index_.end()) {
+      entries_.splice(entries_.begin(), entries_, iterator->second);
+      rir = iterator->second->second;
+      return true;
+    }
+  }
+
+  // The file is read without holding the lock, so that other threads can
+  // access the memory tier in the meantime.
+  if (directory_.empty()) {
+    return false;
+  }
+  Signal file_rir;
+  if (!ReadFile(key, file_rir)) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    InsertInMemory(key, file_rir);
+  }
+  rir = std::move(file_rir);
+  return true;
+}
+
+void RirCache::Insert(const uint64_t key, const Signal& rir) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    InsertInMemory(key, rir);
+  }
+  // Concurrent writes of the same key go to different temporary files, and
+  // the last one renamed wins.
+  if (!directory_.empty()) {
+    WriteFile(key, rir);
+  }
+}
+
+void RirCache::InsertInMemory(const uint64_t key, const Signal& rir) {
+  auto iterator = index_.find(key);
+  if (iterator != index_.end()) {
+    iterator->second->second = rir;
+    entries_.splice(entries_.begin(), entries_, iterator->second);
+    return;
+  }
+
+  entries_.emplace_front(key, rir);
+  index_[key] = entries_.begin();
+  if (entries_.size() > capacity_) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+void RirCache::Clear() noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  index_.clear();
+}
+
+size_t RirCache::num_entries() const noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+std::string RirCache::TemporaryFilePath(const std::string& path) {
+  static std::atomic<uint64_t> counter(0);
+#if _WIN32 || _WIN64
+  const int process_id = _getpid();
+#else
+  const int process_id = getpid();
+#endif
+  std::stringstream temporary_path;
+  temporary_path << path << "." << process_id << "." << counter++ << ".tmp";
+  return temporary_path.str();
+}
+
+std::string RirCache::FilePath(const uint64_t key) const {
+  std::stringstream path;
+  path << directory_ << "/" << std::hex << key << ".rir";
+  return path.str();
+}
+
+bool RirCache::ReadFile(const uint64_t key, Signal& rir) const {
+  std::ifstream file(FilePath(key), std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  FileHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      !IsValidHeader(header, key)) {
+    return false;
+  }
+  // The size of the file is checked before allocating the RIR, so that a
+  // truncated or corrupted file is rejected.
+  const std::streamoff data_begin = file.tellg();
+  if (!file.seekg(0, std::ios::end)) {
+    return false;
+  }
+  const uint64_t data_size = (uint64_t)(file.tellg() - data_begin);
+  if (data_size % sizeof(Sample) != 0 ||
+      data_size / sizeof(Sample) != header.num_samples ||
+      !file.seekg(data_begin)) {
+    return false;
+  }
+  Signal file_rir(header.num_samples);
+  if (!file.read(reinterpret_cast<char*>(file_rir.data()),
+                 header.num_samples * sizeof(Sample))) {
+    return false;
+  }
+  rir = std::move(file_rir);
+  return true;
+}
+
+void RirCache::WriteFile(const uint64_t key, const Signal& rir) const {
+  // Written to a temporary file first, so that other processes never see a
+  // partially written RIR.
+  const std::string path = FilePath(key);
+  const std::string temporary_path = TemporaryFilePath(path);
+  std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    dsp::Logger::GetInstance().LogError("Could not write RIR cache file %s",
+                                        path.c_str());
+    return;
+  }
+
+  FileHeader header;
+  std::memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+  header.key = key;
+  header.num_samples = rir.size();
+  header.sample_size = sizeof(Sample);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(rir.data()),
+             rir.size() * sizeof(Sample));
+  file.close();
+  if (!file || std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    std::remove(temporary_path.c_str());
+    dsp::Logger::GetInstance().LogError("Could not write RIR cache file %s",
+                                        path.c_str());
+  }
+}
+
+}  // namespace sal
@@ -0,0 +1,223 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#include "sdn.h"
+
+#include <algorithm>
+
+#include "salconstants.h"
+
+using sal::dsp::Point;
+
+namespace sal {
+
+Sdn::Sdn(Room* const room, Source* const source, Microphone* const microphone,
+         const Time sampling_frequency)
+    : room_(room),
+      source_(source),
+      microphone_(microphone),
+      sampling_frequency_(sampling_frequency),
+      num_nodes_(room->num_boundary_points()),
+      node_positions_(num_nodes_),
+      wall_ids_(num_nodes_),
+      updated_wall_ids_(num_nodes_),
+      direct_line_(Distance(source->position(), microphone->position()),
+                   sampling_frequency, room->max_distance(),
+                   InterpolationType::kRounding, false, true,
+                   PropagationLine::kOneSampleDistance, 1),
+      incoming_(num_nodes_ - 1, 0.0),
+      outputs_(num_nodes_ + 1) {
+  ASSERT(num_nodes_ > 1);
+  room_->CalculateBoundaryPoints(source_->position(), microphone_->position(),
+                                 node_positions_);
+  room_->GetBoundaryWallIds(source_->position(), microphone_->position(),
+                            wall_ids_);
+
+  const Length max_distance = room_->max_distance();
+  const Int max_latency =
+      (Int)ceil(max_distance / SOUND_SPEED * sampling_frequency_);
+  source_lines_.reserve(num_nodes_);
+  microphone_lines_.reserve(num_nodes_);
+  for (Int k = 0; k < num_nodes_; ++k) {
+    source_lines_.push_back(PropagationLine(
+        Distance(source_->position(), node_positions_[k]), sampling_frequency,
+        max_distance, InterpolationType::kRounding, false, true,
+        PropagationLine::kOneSampleDistance, 1));
+    microphone_lines_.push_back(PropagationLine(
+        Distance(node_positions_[k], microphone_->position()),
+        sampling_frequency, max_distance, InterpolationType::kRounding, false,
+        true, PropagationLine::kOneSampleDistance, 1));
+    microphone_filters_.push_back(room_->wall_filters()[wall_ids_[k]]);
+  }
+
+  node_lines_.reserve(num_nodes_ * (num_nodes_ - 1));
+  node_filters_.reserve(num_nodes_ * (num_nodes_ - 1));
+  for (Int from = 0; from < num_nodes_; ++from) {
+    for (Int to = 0; to < num_nodes_; ++to) {
+      if (to == from) {
+        continue;
+      }
+      ASSERT(LineIndex(from, to) == (Int)node_lines_.size());
+      node_lines_.push_back(DelayFilter(1, max_latency));
+      node_filters_.push_back(room_->wall_filters()[wall_ids_[from]]);
+    }
+  }
+
+  SetLines(0.0);
+}
+
+void Sdn::Update(const Time ramp_time) {
+  room_->CalculateBoundaryPoints(source_->position(), microphone_->position(),
+                                 node_positions_);
+  // The wall of a node can change with the positions (e.g. for the
+  // second-order nodes of a cuboid room), in which case the filters of the
+  // waves leaving the node are replaced.
+  room_->GetBoundaryWallIds(source_->position(), microphone_->position(),
+                            updated_wall_ids_);
+  for (Int k = 0; k < num_nodes_; ++k) {
+    if (updated_wall_ids_[k] == wall_ids_[k]) {
+      continue;
+    }
+    wall_ids_[k] = updated_wall_ids_[k];
+    const dsp::Filter& wall_filter = room_->wall_filters()[wall_ids_[k]];
+    microphone_filters_[k] = wall_filter;
+    for (Int to = 0; to < num_nodes_; ++to) {
+      if (to != k) {
+        node_filters_[LineIndex(k, to)] = wall_filter;
+      }
+    }
+  }
+  SetLines(ramp_time);
+}
+
+void Sdn::SetLines(const Time ramp_time) {
+  const Point& source_position = source_->position();
+  const Point& microphone_position = microphone_->position();
+
+  direct_line_.SetDistance(Distance(source_position, microphone_position),
+                           ramp_time);
+
+  for (Int k = 0; k < num_nodes_; ++k) {
+    const Length source_distance = Distance(source_position, node_positions_[k]);
+    const Length microphone_distance =
+        Distance(node_positions_[k], microphone_position);
+
+    // The product of the two attenuations is the 1/r attenuation of the
+    // first-order reflection, so that these are rendered exactly.
+    source_lines_[k].SetDistance(source_distance, ramp_time);
+    microphone_lines_[k].SetDistance(microphone_distance, ramp_time);
+    microphone_lines_[k].SetAttenuation(
+        1.0 / (1.0 + microphone_distance / source_distance), ramp_time);
+  }
+
+  for (Int from = 0; from < num_nodes_; ++from) {
+    for (Int to = 0; to < num_nodes_; ++to) {
+      if (to == from) {
+        continue;
+      }
+      // At least one sample, so that a node never reads what another node
+      // wrote in the same sample.
+      const Time latency = Distance(node_positions_[from], node_positions_[to]) /
+                           SOUND_SPEED * sampling_frequency_;
+      node_lines_[LineIndex(from, to)].SetLatency(
+          std::max((Int)1, dsp::RoundToInt(latency)));
+    }
+  }
+}
+
+void Sdn::ProcessBlock(std::span<const Sample> input_data,
+                       Buffer& output_buffer) {
+  const size_t num_samples = input_data.size();
+  // Only allocates when the block size grows
+  for (std::vector<Sample>& output : outputs_) {
+    if (output.size() < num_samples) {
+      output.resize(num_samples);
+    }
+  }
+
+  // Diagonal and off-diagonal elements of the isotropic scattering matrix
+  // A = 2 / (K - 1) * 1 * 1^T - I, with K - 1 incoming waves per node.
+  const Sample scattering_gain = 2.0 / ((Sample)(num_nodes_ - 1));
+
+  for (size_t n = 0; n < num_samples; ++n) {
+    const Sample input_sample = input_data[n];
+    direct_line_.Write(input_sample);
+    outputs_[0][n] = direct_line_.Read();
+
+    for (Int k = 0; k < num_nodes_; ++k) {
+      source_lines_[k].Write(input_sample);
+      // Half of the source pressure is injected into each incoming wave
+      const Sample source_wave = 0.5 * source_lines_[k].Read();
+
+      Sample incoming_sum = 0.0;
+      Int i = 0;
+      for (Int from = 0; from < num_nodes_; ++from) {
+        if (from == k) {
+          continue;
+        }
+        incoming_[i] = node_lines_[LineIndex(from, k)].Read() + source_wave;
+        incoming_sum += incoming_[i];
+        ++i;
+      }
+
+      // Node pressure, towards the microphone
+      const Sample pressure = scattering_gain * incoming_sum;
+      Sample filtered;
+      microphone_filters_[k].ProcessBlock(std::span<const Sample>(&pressure, 1),
+                                          std::span<Sample>(&filtered, 1));
+      microphone_lines_[k].Write(filtered);
+      outputs_[k + 1][n] = microphone_lines_[k].Read();
+
+      // Scattered waves, towards the other nodes
+      i = 0;
+      for (Int to = 0; to < num_nodes_; ++to) {
+        if (to == k) {
+          continue;
+        }
+        const Sample outgoing = pressure - incoming_[i++];
+        const Int line = LineIndex(k, to);
+        node_filters_[line].ProcessBlock(std::span<const Sample>(&outgoing, 1),
+                                         std::span<Sample>(&filtered, 1));
+        node_lines_[line].Write(filtered);
+      }
+    }
+
+    direct_line_.Tick();
+    for (Int k = 0; k < num_nodes_; ++k) {
+      source_lines_[k].Tick();
+      microphone_lines_[k].Tick();
+    }
+    for (DelayFilter& node_line : node_lines_) {
+      node_line.Tick();
+    }
+  }
+
+  microphone_->AddPlaneWave(
+      std::span<const Sample>(outputs_[0].data(), num_samples),
+      source_->position(), 0, output_buffer);
+  for (Int k = 0; k < num_nodes_; ++k) {
+    microphone_->AddPlaneWave(
+        std::span<const Sample>(outputs_[k + 1].data(), num_samples),
+        node_positions_[k], k + 1, output_buffer);
+  }
+}
+
+void Sdn::ResetState() noexcept {
+  direct_line_.ResetState();
+  for (Int k = 0; k < num_nodes_; ++k) {
+    source_lines_[k].ResetState();
+    microphone_lines_[k].ResetState();
+    microphone_filters_[k].ResetState();
+  }
+  for (size_t i = 0; i < node_lines_.size(); ++i) {
+    node_lines_[i].ResetState();
+    node_filters_[i].ResetState();
+  }
+}
+
+}  // namespace sal
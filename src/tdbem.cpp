@@ -9,6 +9,9 @@
 #include "salconstants.h"
 #include "tdbem.h"
 
+#include <algorithm>
+#include <functional>
+
 namespace sal {
 
 using sal::dsp::Point;
@@ -22,118 +25,319 @@ using sal::Time;
 TdBem::TdBem(Room* const room, Source* const source,
              Microphone* const microphone, const Time sampling_frequency,
              const Length spatial_sampling_period,
-             const Sample specific_acoustic_impedance)
+             const Sample specific_acoustic_impedance,
+             const Sample far_field_ratio)
     : room_(room),
       source_(source),
       microphone_(microphone),
       sampling_frequency_(sampling_frequency),
       spatial_sampling_period_(spatial_sampling_period),
       specific_acoustic_impedance_(specific_acoustic_impedance),
+      far_field_ratio_(far_field_ratio),
       log_(false),
       source_delay_line_(sal::DelayFilter(
           (UInt)ceil(room->max_distance() * sampling_frequency),
           (UInt)ceil(room->max_distance() * sampling_frequency))) {
+  ASSERT(far_field_ratio >= 0.0 && far_field_ratio < 1.0);
   CalculatePoints();
 
   num_elements_ = points_.size();
 
-  std::vector<sal::Length> all_distances;
   // Precalculate distances
   distance_los_ = Distance(microphone_->position(), source_->position());
+  std::vector<sal::Length> distances_mic;
   for (Int i = 0; i < num_elements_; ++i) {
-    distances_source_.push_back(dsp::Distance(points_[i], source_->position()));
-    all_distances.push_back(distances_source_[i]);
-    distances_mic_.push_back(
-        dsp::Distance(points_[i], microphone_->position()));
-    all_distances.push_back(distances_mic_[i]);
-
-    // Precalculate distances between points
-    distances_.push_back(std::vector<sal::Length>(num_elements_, 0.0));
-    for (Int j = 0; j < num_elements_; ++j) {
-      if (i == j) {
-        continue;
-      }
-      Length distance = dsp::Distance(points_[i], points_[j]);
-      distances_[i][j] = distance;
-      all_distances.push_back(distance);
-    }
+    const Length distance_source =
+        dsp::Distance(points_[i], source_->position());
+    distances_mic.push_back(dsp::Distance(points_[i], microphone_->position()));
+    weights_source_.push_back(1.0 / distance_source);
+    delays_source_.push_back(distance_source * sampling_frequency / SOUND_SPEED);
   }
 
-  std::vector<sal::Sample> all_weights;
+  // The distance between two points of the room is at most its maximum
+  // distance, and each tap reads up to two samples after its integer delay
+  history_length_ =
+      (Int)(room->max_distance() * sampling_frequency / SOUND_SPEED) + 4;
+  if (far_field_ratio_ > 0.0) {
+    cluster_elements_.resize(num_elements_);
+    for (Int i = 0; i < num_elements_; ++i) {
+      cluster_elements_[i] = i;
+    }
+    BuildClusters(0, num_elements_);
+  }
+  histories_.assign(
+      (num_elements_ + 4 * (Int)clusters_.size()) * 2 * history_length_, 0.0);
+  write_position_ = 0;
+  num_processed_samples_ = 0;
 
+  auto add_element_tap = [&](const Int i, const Int j) {
+    const Length distance = dsp::Distance(points_[i], points_[j]);
+    sal::Sample dr_dn =
+        CalculateDrDn(points_[i], points_[j], normal_vectors_[j]);
+
+    Sample weight_current =
+        CalculateWeightCurrent(dr_dn, distance, SOUND_SPEED,
+                               sampling_frequency, areas_[j], impedances_[j]);
+    Sample weight_previous =
+        CalculateWeightPrevious(dr_dn, distance, SOUND_SPEED,
+                                sampling_frequency, areas_[j], impedances_[j]);
+
+    // The pressures of the current time step are not available yet, so
+    // that elements closer than one sample read the previous one
+    element_taps_.AddTap(
+        j, std::max(distance * sampling_frequency / SOUND_SPEED, 1.0),
+        weight_current / (2.0 * PI), weight_previous / (2.0 * PI),
+        history_length_);
+  };
+
+  std::vector<Int> pending_clusters;
   for (Int i = 0; i < num_elements_; ++i) {
-    weights_current_.push_back(std::vector<sal::Sample>(num_elements_, 0.0));
-    weights_previous_.push_back(std::vector<sal::Sample>(num_elements_, 0.0));
-    for (Int j = 0; j < num_elements_; ++j) {
-      if (i == j) {
-        continue;
+    if (clusters_.empty()) {
+      for (Int j = 0; j < num_elements_; ++j) {
+        if (i != j) {
+          add_element_tap(i, j);
+        }
+      }
+    } else {
+      pending_clusters.assign(1, 0);
+      while (!pending_clusters.empty()) {
+        const Cluster& cluster = clusters_[pending_clusters.back()];
+        const Int cluster_id = pending_clusters.back();
+        pending_clusters.pop_back();
+        const Length distance = dsp::Distance(points_[i], cluster.centre);
+        // Groups of up to four elements are cheaper to read directly
+        if (cluster.end - cluster.begin > 4 &&
+            cluster.radius < far_field_ratio_ * distance) {
+          AddClusterTaps(i, cluster_id);
+        } else if (cluster.children[0] < 0) {
+          for (Int k = cluster.begin; k < cluster.end; ++k) {
+            if (cluster_elements_[k] != i) {
+              add_element_tap(i, cluster_elements_[k]);
+            }
+          }
+        } else {
+          pending_clusters.push_back(cluster.children[1]);
+          pending_clusters.push_back(cluster.children[0]);
+        }
       }
-      sal::Sample dr_dn =
-          CalculateDrDn(points_[i], points_[j], normal_vectors_[j]);
-
-      Sample weight_current = CalculateWeightCurrent(
-          dr_dn, distances_[i][j], SOUND_SPEED, sampling_frequency,
-          spatial_sampling_period, specific_acoustic_impedance);
-      weights_current_[i][j] = weight_current;
-      all_weights.push_back(weight_current);
-
-      Sample weight_previous = CalculateWeightPrevious(
-          dr_dn, distances_[i][j], SOUND_SPEED, sampling_frequency,
-          spatial_sampling_period, specific_acoustic_impedance);
-      weights_previous_[i][j] = weight_previous;
-      all_weights.push_back(weight_previous);
     }
+    element_taps_.EndRow();
 
     sal::Sample dr_dn =
         CalculateDrDn(microphone_->position(), points_[i], normal_vectors_[i]);
-    weights_mic_current_.push_back(CalculateWeightCurrent(
-        dr_dn, distances_mic_[i], SOUND_SPEED, sampling_frequency,
-        spatial_sampling_period, specific_acoustic_impedance));
-    weights_mic_previous_.push_back(CalculateWeightPrevious(
-        dr_dn, distances_mic_[i], SOUND_SPEED, sampling_frequency,
-        spatial_sampling_period, specific_acoustic_impedance));
-
-    weights_source_.push_back(1.0 / distances_source_[i]);
+    mic_taps_.AddTap(
+        i, distances_mic[i] * sampling_frequency / SOUND_SPEED,
+        CalculateWeightCurrent(dr_dn, distances_mic[i], SOUND_SPEED,
+                               sampling_frequency, areas_[i], impedances_[i]) /
+            (4.0 * PI),
+        CalculateWeightPrevious(dr_dn, distances_mic[i], SOUND_SPEED,
+                                sampling_frequency, areas_[i],
+                                impedances_[i]) /
+            (4.0 * PI),
+        history_length_);
+    mic_taps_.EndRow();
   }
+}
 
-  // Initialise delay lines
-  for (Int i = 0; i < num_elements_; ++i) {
-    pressures_.push_back(sal::DelayFilter(
-        (UInt)ceil(room->max_distance() * sampling_frequency),
-        (UInt)ceil(room->max_distance() * sampling_frequency)));
+Int TdBem::BuildClusters(const Int begin, const Int end) {
+  const Int cluster_id = (Int)clusters_.size();
+  clusters_.push_back(Cluster());
+  Cluster cluster;
+  cluster.begin = begin;
+  cluster.end = end;
+  cluster.children[0] = -1;
+  cluster.children[1] = -1;
+
+  // Centre weighted by the areas of the elements
+  Point centre(0.0, 0.0, 0.0);
+  Length total_area = 0.0;
+  Point min_corner = points_[cluster_elements_[begin]];
+  Point max_corner = min_corner;
+  for (Int k = begin; k < end; ++k) {
+    const Int element = cluster_elements_[k];
+    centre = dsp::Sum(centre, dsp::Multiply(points_[element], areas_[element]));
+    total_area += areas_[element];
+    min_corner = Point(std::min(min_corner.x(), points_[element].x()),
+                       std::min(min_corner.y(), points_[element].y()),
+                       std::min(min_corner.z(), points_[element].z()));
+    max_corner = Point(std::max(max_corner.x(), points_[element].x()),
+                       std::max(max_corner.y(), points_[element].y()),
+                       std::max(max_corner.z(), points_[element].z()));
+  }
+  cluster.centre = dsp::Multiply(centre, 1.0 / total_area);
+  cluster.radius = 0.0;
+  for (Int k = begin; k < end; ++k) {
+    cluster.radius =
+        std::max(cluster.radius, dsp::Distance(points_[cluster_elements_[k]],
+                                               cluster.centre));
+  }
+
+  // Split at the median along the longest side of the bounding box
+  const Int max_cluster_size = 8;
+  if (end - begin > max_cluster_size) {
+    const Point size = dsp::Subtract(max_corner, min_corner);
+    const Int axis = (size.x() >= size.y() && size.x() >= size.z())
+                         ? 0
+                         : ((size.y() >= size.z()) ? 1 : 2);
+    const Int middle = (begin + end) / 2;
+    std::nth_element(
+        cluster_elements_.begin() + begin, cluster_elements_.begin() + middle,
+        cluster_elements_.begin() + end, [&](const Int a, const Int b) {
+          return TriangleMesh::Coordinate(points_[a], axis) <
+                 TriangleMesh::Coordinate(points_[b], axis);
+        });
+    cluster.children[0] = BuildClusters(begin, middle);
+    cluster.children[1] = BuildClusters(middle, end);
+  }
+  clusters_[cluster_id] = cluster;
+  return cluster_id;
+}
+
+void TdBem::AddClusterTaps(const Int element, const Int cluster_id) {
+  // With r the distance to the centre and u its direction, the sums over
+  // the elements j of the cluster of the weights are, to first order in the
+  // size of the cluster, (1 / r^2 + k) u.D + k M for the current sample and
+  // -k u.D + k M for the previous one, with k = fs / (c r), D = sum of
+  // A_j n_j p_j and M = sum of A_j / Z_j p_j.
+  const Cluster& cluster = clusters_[cluster_id];
+  const Point direction = dsp::Subtract(cluster.centre, points_[element]);
+  const Length distance = direction.norm();
+  const Sample k = sampling_frequency_ / (SOUND_SPEED * distance);
+  const Time delay =
+      std::max(distance * sampling_frequency_ / SOUND_SPEED, 1.0);
+  const Sample u[3] = {direction.x() / distance, direction.y() / distance,
+                       direction.z() / distance};
+  const Int first_row = num_elements_ + 4 * cluster_id;
+  for (Int axis = 0; axis < 3; ++axis) {
+    element_taps_.AddTap(first_row + axis, delay,
+                         u[axis] * (1.0 / pow(distance, 2.0) + k) / (2.0 * PI),
+                         -u[axis] * k / (2.0 * PI), history_length_);
+  }
+  element_taps_.AddTap(first_row + 3, delay, k / (2.0 * PI), k / (2.0 * PI),
+                       history_length_);
+}
+
+void TdBem::UpdateClusters() {
+  // Children are after their parents, so that they are updated first
+  for (Int c = (Int)clusters_.size() - 1; c >= 0; --c) {
+    const Cluster& cluster = clusters_[c];
+    Sample moments[4] = {0.0, 0.0, 0.0, 0.0};
+    if (cluster.children[0] < 0) {
+      for (Int k = cluster.begin; k < cluster.end; ++k) {
+        const Int element = cluster_elements_[k];
+        const Sample pressure = Pressure(element, 0) * areas_[element];
+        moments[0] += normal_vectors_[element].x() * pressure;
+        moments[1] += normal_vectors_[element].y() * pressure;
+        moments[2] += normal_vectors_[element].z() * pressure;
+        moments[3] += pressure / impedances_[element];
+      }
+    } else {
+      for (Int q = 0; q < 4; ++q) {
+        moments[q] = Pressure(num_elements_ + 4 * cluster.children[0] + q, 0) +
+                     Pressure(num_elements_ + 4 * cluster.children[1] + q, 0);
+      }
+    }
+    for (Int q = 0; q < 4; ++q) {
+      Sample* row_history =
+          histories_.data() +
+          (num_elements_ + 4 * c + q) * 2 * history_length_;
+      row_history[write_position_] = moments[q];
+      row_history[write_position_ + history_length_] = moments[q];
+    }
+  }
+}
+
+void TdBem::TapTable::AddTap(const Int element, const Time delay,
+                             const Sample weight_current,
+                             const Sample weight_previous,
+                             const Int history_length) {
+  ASSERT(!single_precision);
+  // Same linear interpolation as `DelayFilter::FractionalReadAt`, at
+  // `delay` for the current weight and at `delay + 1` for the previous one
+  const Int tap = (Int)delay;
+  const Sample fraction = delay - (Time)tap;
+  ASSERT(tap >= 0 && tap + 2 < history_length);
+  const Int offset = element * 2 * history_length + history_length - tap;
+  ASSERT(offset <= INT32_MAX);
+  offsets.push_back((std::int32_t)offset);
+  weights[0].push_back(weight_current * (1.0 - fraction));
+  weights[1].push_back(weight_current * fraction +
+                       weight_previous * (1.0 - fraction));
+  weights[2].push_back(weight_previous * fraction);
+}
+
+void TdBem::TapTable::UseSinglePrecision() {
+  if (single_precision) {
+    return;
+  }
+  for (Int q = 0; q < 3; ++q) {
+    single_precision_weights[q].assign(weights[q].begin(), weights[q].end());
+    weights[q] = std::vector<Sample>();
+  }
+  single_precision = true;
+}
+
+namespace {
+
+template <typename T>
+Sample AccumulateTaps(const std::int32_t* offsets, const T* weights_0,
+                      const T* weights_1, const T* weights_2, const Int begin,
+                      const Int end, const Sample* history) noexcept {
+  // Independent partial sums, so that the taps are gathered and
+  // accumulated in vector lanes
+  const Int num_lanes = 4;
+  Sample sums[num_lanes] = {0.0, 0.0, 0.0, 0.0};
+  Int k = begin;
+  for (; k + num_lanes <= end; k += num_lanes) {
+    for (Int lane = 0; lane < num_lanes; ++lane) {
+      const Sample* tap = history + offsets[k + lane];
+      sums[lane] += weights_0[k + lane] * tap[0] +
+                    weights_1[k + lane] * tap[-1] +
+                    weights_2[k + lane] * tap[-2];
+    }
+  }
+  for (; k < end; ++k) {
+    const Sample* tap = history + offsets[k];
+    sums[0] += weights_0[k] * tap[0] + weights_1[k] * tap[-1] +
+               weights_2[k] * tap[-2];
   }
+  return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
 
-  if (true) {
-    Length min_distance = dsp::Min(all_distances);
-    std::cout << "Spatial sampling period: " << spatial_sampling_period
-              << std::endl;
-    std::cout << "Minimum distance: " << min_distance << std::endl;
+}  // namespace
 
-    std::cout << "Minimum weight: " << dsp::Min(all_weights) << std::endl;
-    std::cout << "Maximum weight: " << dsp::Max(all_weights) << std::endl;
+Sample TdBem::TapTable::Accumulate(const Int row,
+                                   const Sample* history) const noexcept {
+  if (single_precision) {
+    return AccumulateTaps(offsets.data(), single_precision_weights[0].data(),
+                          single_precision_weights[1].data(),
+                          single_precision_weights[2].data(), row_begin[row],
+                          row_begin[row + 1], history);
   }
+  return AccumulateTaps(offsets.data(), weights[0].data(), weights[1].data(),
+                        weights[2].data(), row_begin[row], row_begin[row + 1],
+                        history);
 }
 
 Sample TdBem::CalculateWeightCurrent(Sample dr_dn, Length distance,
                                      Length sound_speed,
                                      Time sampling_frequency,
-                                     Length spatial_sampling_period,
+                                     Length element_area,
                                      Sample specific_acoustic_impedance) {
   return (dr_dn / pow(distance, 2.0) +
           dr_dn / (distance * sound_speed / sampling_frequency) +
           1.0 / (distance * sound_speed / sampling_frequency *
                  specific_acoustic_impedance)) *
-         pow(spatial_sampling_period, 2.0);
+         element_area;
 }
 
 Sample TdBem::CalculateWeightPrevious(Sample dr_dn, Length distance,
                                       Length sound_speed,
                                       Time sampling_frequency,
-                                      Length spatial_sampling_period,
+                                      Length element_area,
                                       Sample specific_acoustic_impedance) {
   return -(dr_dn - 1.0 / specific_acoustic_impedance) /
-         (distance * sound_speed / sampling_frequency) *
-         pow(spatial_sampling_period, 2.0);
+         (distance * sound_speed / sampling_frequency) * element_area;
 }
 
 Sample TdBem::CalculateDrDn(Point point_x, Point point_y, Point normal_y) {
@@ -142,7 +346,10 @@ Sample TdBem::CalculateDrDn(Point point_x, Point point_y, Point normal_y) {
 }
 
 void TdBem::CalculatePoints() {
-  // TODO: implement for other types of room
+  if (const MeshRoom* mesh_room = dynamic_cast<const MeshRoom*>(room_)) {
+    CalculateMeshPoints(*mesh_room);
+    return;
+  }
   ASSERT(dynamic_cast<CuboidRoom*>(room_) != 0);
   Triplet dimensions = ((CuboidRoom*)room_)->dimensions();
   Length room_x = dimensions.x();
@@ -195,82 +402,162 @@ void TdBem::CalculatePoints() {
       normal_vectors_.push_back(Point(-1.0, 0.0, 0.0));
     }
   }
+  areas_.assign(points_.size(), pow(spatial_sampling_period_, 2.0));
+  impedances_.assign(points_.size(), specific_acoustic_impedance_);
+}
+
+void TdBem::CalculateMeshPoints(const MeshRoom& room) {
+  const TriangleMesh& mesh = room.mesh();
+  const std::vector<Sample> impedances = room.WallImpedances();
+  for (Int t = 0; t < mesh.num_triangles(); ++t) {
+    const Point& a = mesh.Vertex(t, 0);
+    const Point ab = dsp::Subtract(mesh.Vertex(t, 1), a);
+    const Point ac = dsp::Subtract(mesh.Vertex(t, 2), a);
+    const Length max_side =
+        std::max({ab.norm(), ac.norm(),
+                  dsp::Distance(mesh.Vertex(t, 1), mesh.Vertex(t, 2))});
+    // The triangle is split into n^2 equal triangles, n - 1 of them
+    // upside-down in each row, with one element at the centroid of each
+    const Int n = std::max((Int)ceil(max_side / spatial_sampling_period_),
+                           (Int)1);
+    const Length area = mesh.Area(t) / (Length)(n * n);
+    const Point normal = room.InwardNormal(t);
+    const Sample impedance = impedances[mesh.triangles()[t].material];
+    auto add_element = [&](const Length u, const Length v) {
+      points_.push_back(dsp::Sum(
+          a, dsp::Sum(dsp::Multiply(ab, u / (Length)n),
+                      dsp::Multiply(ac, v / (Length)n))));
+      normal_vectors_.push_back(normal);
+      areas_.push_back(area);
+      impedances_.push_back(impedance);
+    };
+    for (Int i = 0; i < n; ++i) {
+      for (Int j = 0; i + j < n; ++j) {
+        add_element(i + 1.0 / 3.0, j + 1.0 / 3.0);
+        if (i + j + 1 < n) {
+          add_element(i + 2.0 / 3.0, j + 2.0 / 3.0);
+        }
+      }
+    }
+  }
 }
 
 void TdBem::Run(const MonoBuffer& input_buffer, Buffer& output_buffer) {
   ASSERT(input_buffer.num_samples() == output_buffer.num_samples());
-  MonoBuffer& mono_output_buffer = dynamic_cast<MonoBuffer&>(output_buffer);
-  dsp::Matrix<sal::Sample> boundary_pressure(0, 0);
-  if (log_) {
-    boundary_pressure =
-        dsp::Matrix<sal::Sample>(num_elements_, input_buffer.num_samples());
+  if (!log_) {
+    ProcessBlock(input_buffer.GetReadView(), output_buffer);
+    return;
   }
 
-  Int k = 0;
-  for (Int sample_id = 0; sample_id < input_buffer.num_samples(); ++sample_id) {
-    if (log_) {
-      std::cout << "Running TDBEM sample n. " << k << std::endl;
+  // One sample at a time, to save the pressures of the elements
+  const Int num_samples = input_buffer.num_samples();
+  dsp::Matrix<sal::Sample> boundary_pressure(num_elements_, num_samples);
+  std::vector<std::span<Sample> > sample_views(output_buffer.num_channels());
+  for (Int k = 0; k < num_samples; ++k) {
+    for (size_t channel = 0; channel < sample_views.size(); ++channel) {
+      sample_views[channel] = output_buffer.GetWriteView(channel).subspan(k, 1);
     }
-    source_delay_line_.Write(input_buffer.GetSample(sample_id));
-
+    Buffer sample_buffer(sample_views);
+    ProcessBlock(input_buffer.GetReadView().subspan(k, 1), sample_buffer);
     for (Int i = 0; i < num_elements_; ++i) {
-      sal::Sample pressure = 0.0;
-      // Line of sight to boundary point
-      pressure +=
-          source_delay_line_.FractionalReadAt(
-              distances_source_[i] * sampling_frequency_ / SOUND_SPEED) *
-          weights_source_[i];
+      boundary_pressure.SetElement(i, k, Pressure(i, 1));
+    }
+  }
+  boundary_pressure.Save(log_file_name_, 10);
+}
 
-      for (Int j = 0; j < num_elements_; ++j) {
-        if (i == j) {
-          continue;
-        }
-        Time delay = distances_[i][j] * sampling_frequency_ / SOUND_SPEED;
-        pressure +=
-            (pressures_[j].FractionalReadAt(delay) * weights_current_[i][j] +
-             pressures_[j].FractionalReadAt(delay + 1.0) *
-                 weights_previous_[i][j]) /
-            (2.0 * PI);
-      }
-      pressures_[i].Write(pressure);
+void TdBem::UpdateElements(const Int begin, const Int end) noexcept {
+  // The taps of the elements only read past samples, so that the elements
+  // are independent within a time step and the new pressures are written in
+  // place
+  const Sample* history = histories_.data() + write_position_;
+  for (Int i = begin; i < end; ++i) {
+    // Line of sight to boundary point
+    const sal::Sample pressure =
+        source_delay_line_.FractionalReadAt(delays_source_[i]) *
+            weights_source_[i] +
+        element_taps_.Accumulate(i, history);
+    Sample* element_history = histories_.data() + i * 2 * history_length_;
+    element_history[write_position_] = pressure;
+    element_history[write_position_ + history_length_] = pressure;
+  }
+}
 
-      if (log_) {
-        boundary_pressure.SetElement(i, k, pressure);
-      }
+void TdBem::ProcessBlock(std::span<const Sample> input_data,
+                         Buffer& output_buffer) {
+  const size_t num_samples = input_data.size();
+  ASSERT(output_buffer.num_samples() >= num_samples);
+  // Only allocates when the block size grows
+  outputs_.resize(num_elements_ + 1);
+  for (std::vector<Sample>& output : outputs_) {
+    if (output.size() < num_samples) {
+      output.resize(num_samples);
+    }
+  }
+
+  // Only captures `this`, so that it is stored without allocations
+  const std::function<void(Int, Int)> update_elements =
+      [this](const Int begin, const Int end) { UpdateElements(begin, end); };
+  const Time los_delay = distance_los_ * sampling_frequency_ / SOUND_SPEED;
+  for (size_t n = 0; n < num_samples; ++n) {
+    source_delay_line_.Write(input_data[n]);
+
+    if (thread_pool_) {
+      thread_pool_->ParallelFor(0, num_elements_, update_elements);
+    } else {
+      UpdateElements(0, num_elements_);
     }
+    UpdateClusters();
 
     // Extract pressure
+    const Sample* history = histories_.data() + write_position_;
     for (Int i = 0; i < num_elements_; ++i) {
-      Time delay = distances_mic_[i] * sampling_frequency_ / SOUND_SPEED;
-      Sample pressure =
-          (weights_mic_current_[i] * pressures_[i].FractionalReadAt(delay) +
-           weights_mic_previous_[i] *
-               pressures_[i].FractionalReadAt(delay + 1.0)) /
-          (4.0 * PI);
-
-      microphone_->AddPlaneWave(MonoBuffer::Unary(pressure), points_[i], i,
-                                mono_output_buffer);
+      outputs_[i][n] = mic_taps_.Accumulate(i, history);
     }
-
-    Time los_delay = distance_los_ * sampling_frequency_ / SOUND_SPEED;
-    microphone_->AddPlaneWave(
-        MonoBuffer::Unary(source_delay_line_.FractionalReadAt(los_delay) /
-                          (4.0 * PI * distance_los_)),
-        source_->position(), num_elements_, mono_output_buffer);
+    outputs_[num_elements_][n] =
+        source_delay_line_.FractionalReadAt(los_delay) /
+        (4.0 * PI * distance_los_);
 
     // Next time tick
     source_delay_line_.Tick();
-    for (Int i = 0; i < num_elements_; ++i) {
-      pressures_[i].Tick();
+    write_position_ = (write_position_ + 1) % history_length_;
+    num_processed_samples_++;
+    if (progress_callback_) {
+      progress_callback_(num_processed_samples_);
     }
-    k++;
   }
 
-  if (log_) {
-    boundary_pressure.Save(log_file_name_, 10);
+  for (Int i = 0; i < num_elements_; ++i) {
+    microphone_->AddPlaneWave(
+        std::span<const Sample>(outputs_[i].data(), num_samples), points_[i],
+        i, output_buffer);
+  }
+  microphone_->AddPlaneWave(
+      std::span<const Sample>(outputs_[num_elements_].data(), num_samples),
+      source_->position(), num_elements_, output_buffer);
+}
+
+void TdBem::ResetState() noexcept {
+  std::fill(histories_.begin(), histories_.end(), 0.0);
+  source_delay_line_.ResetState();
+  write_position_ = 0;
+  num_processed_samples_ = 0;
+}
+
+void TdBem::SetNumThreads(const Int num_threads) {
+  ASSERT(num_threads >= 0);
+  if (num_threads == 1) {
+    thread_pool_.reset();
+  } else {
+    thread_pool_ = std::make_unique<ThreadPool>(num_threads);
   }
 }
 
+void TdBem::UseSinglePrecisionWeights() {
+  element_taps_.UseSinglePrecision();
+  mic_taps_.UseSinglePrecision();
+}
+
 void TdBem::WriteOutPoints(const std::string file_name) {
   dsp::Matrix<sal::Length> output(num_elements_, 6);
   for (Int i = 0; i < num_elements_; ++i) {
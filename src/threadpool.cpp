@@ -0,0 +1,116 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#include "threadpool.h"
+
+#include <algorithm>
+
+namespace sal {
+
+ThreadPool::ThreadPool(const Int num_threads)
+    : task_(nullptr),
+      begin_(0),
+      end_(0),
+      generation_(0),
+      num_pending_(0),
+      stop_(false) {
+  ASSERT(num_threads >= 0);
+  Int total_threads = num_threads;
+  if (total_threads == 0) {
+    total_threads = std::max((Int)std::thread::hardware_concurrency(), (Int)1);
+  }
+  workers_.reserve(total_threads - 1);
+  for (Int thread_id = 1; thread_id < total_threads; ++thread_id) {
+    workers_.push_back(std::thread(&ThreadPool::Run, this, thread_id));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  start_condition_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::GetRange(const Int thread_id, Int& range_begin,
+                          Int& range_end) const noexcept {
+  const Int length = end_ - begin_;
+  const Int total_threads = num_threads();
+  range_begin = begin_ + length * thread_id / total_threads;
+  range_end = begin_ + length * (thread_id + 1) / total_threads;
+}
+
+void ThreadPool::ParallelFor(const Int begin, const Int end,
+                             const std::function<void(Int, Int)>& task) {
+  if (end <= begin) {
+    return;
+  }
+  if (workers_.empty()) {
+    task(begin, end);
+    return;
+  }
+
+  std::lock_guard<std::mutex> call_lock(call_mutex_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = &task;
+    begin_ = begin;
+    end_ = end;
+    num_pending_ = (Int)workers_.size();
+    ++generation_;
+  }
+  start_condition_.notify_all();
+
+  Int range_begin;
+  Int range_end;
+  GetRange(0, range_begin, range_end);
+  if (range_end > range_begin) {
+    task(range_begin, range_end);
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_condition_.wait(lock, [this] { return num_pending_ == 0; });
+  task_ = nullptr;
+}
+
+void ThreadPool::Run(const Int thread_id) {
+  Int last_generation = 0;
+  while (true) {
+    Int range_begin;
+    Int range_end;
+    const std::function<void(Int, Int)>* task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_condition_.wait(lock, [this, last_generation] {
+        return stop_ || generation_ != last_generation;
+      });
+      if (stop_) {
+        return;
+      }
+      last_generation = generation_;
+      task = task_;
+      GetRange(thread_id, range_begin, range_end);
+    }
+
+    if (range_end > range_begin) {
+      (*task)(range_begin, range_end);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --num_pending_;
+    }
+    done_condition_.notify_one();
+  }
+}
+
+}  // namespace sal
@@ -12,9 +12,11 @@
 #include <vector>
 
 #include "ambisonics.h"
+#include "asyncrirconvolver.h"
 #include "audiobuffer.h"
 #include "cuboidroom.h"
 #include "delayfilter.h"
+#include "fdn.h"
 #include "fdtd.h"
 #include "firfilter.h"
 #include "freefieldsimulation.h"
@@ -23,17 +25,22 @@
 #include "ism.h"
 #include "kemarmic.h"
 #include "matrixop.h"
+#include "meshroom.h"
 #include "microphone.h"
 #include "microphonearray.h"
 #include "monomics.h"
+#include "partitionedconvolver.h"
 #include "propagationline.h"
 #include "randomop.h"
+#include "rircache.h"
+#include "sdn.h"
 #include "riranalysis.h"
 #include "sofamic.h"
 #include "shsource.h"
 #include "sphericalheadmic.h"
 #include "statisticsop.h"
 #include "tdbem.h"
+#include "threadpool.h"
 #include "transformop.h"
 #include "vectorop.h"
 #include "wavhandler.h"
@@ -41,6 +48,7 @@
 int main(int argc, char* const argv[]) {
 #ifndef NDEBUG
   sal::dsp::FirFilter::Test();
+  sal::dsp::PartitionedConvolver::Test();
   sal::dsp::Quaternion::Test();
   sal::dsp::ElementaryOpTest();
   sal::dsp::BasicOpTest();
@@ -73,8 +81,16 @@ int main(int argc, char* const argv[]) {
   sal::PropagationLine::Test();
   sal::FreeFieldSim::Test();
   sal::CuboidRoom::Test();
+  sal::TriangleMesh::Test();
+  sal::MeshRoom::Test();
   sal::Ism::Test();
+  sal::AsyncRirConvolver::Test();
+  sal::RirCache::Test();
+  sal::Sdn::Test();
+  sal::Fdn::Test();
+  sal::ThreadPool::Test();
   sal::Fdtd::Test();
+  sal::TdBem::Test();
   sal::RirAnalysis::Test();
   sal::TripletHandler::Test();
 
@@ -0,0 +1,85 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#include <chrono>
+#include <thread>
+
+#include "asyncrirconvolver.h"
+#include "comparisonop.h"
+
+using sal::dsp::IsEqual;
+
+namespace sal {
+
+bool AsyncRirConvolver::Test() {
+  // Instantaneous swap
+  Signal new_rir = {0.0, 0.5, 0.0, -0.25};
+  AsyncRirConvolver convolver([&]() { return new_rir; },
+                              Signal({1.0, 0.0, 0.0, 0.0}), 0);
+  ASSERT(!convolver.IsUpdating());
+
+  Signal impulse = {1.0, 0.0, 0.0, 0.0};
+  Signal zeros = {0.0, 0.0, 0.0, 0.0};
+  Signal output(4);
+  convolver.ProcessBlock(impulse, output);
+  ASSERT(IsEqual(output, Signal({1.0, 0.0, 0.0, 0.0})));
+
+  convolver.RequestUpdate();
+  ASSERT(convolver.IsUpdating());
+  while (convolver.IsUpdating()) {
+    // The old RIR keeps being used while the new one is being computed
+    convolver.ProcessBlock(zeros, output);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  convolver.ResetState();
+  convolver.ProcessBlock(impulse, output);
+  ASSERT(IsEqual(output, new_rir));
+
+  // Crossfaded swap, detected from the output: the old RIR is used until
+  // the first sample of the crossfade.
+  AsyncRirConvolver convolver_b([]() { return Signal(1, 0.0); },
+                                Signal(1, 1.0), 3);
+  Signal one(1, 1.0);
+  Signal sample(1);
+  convolver_b.RequestUpdate();
+  do {
+    convolver_b.ProcessBlock(one, sample);
+    if (IsEqual(sample[0], 1.0)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  } while (IsEqual(sample[0], 1.0));
+  ASSERT(!convolver_b.IsUpdating());
+  ASSERT(IsEqual(sample[0], 0.75));
+  convolver_b.ProcessBlock(one, sample);
+  ASSERT(IsEqual(sample[0], 0.5));
+  convolver_b.ProcessBlock(one, sample);
+  ASSERT(IsEqual(sample[0], 0.25));
+  convolver_b.ProcessBlock(one, sample);
+  ASSERT(IsEqual(sample[0], 0.0));
+
+  // RIR longer than the initial one
+  Signal long_rir(1000, 0.0);
+  long_rir[999] = 1.0;
+  AsyncRirConvolver convolver_c([&]() { return long_rir; }, Signal(1, 1.0),
+                                0);
+  convolver_c.RequestUpdate();
+  Signal long_output(long_rir.size());
+  Signal long_zeros(long_rir.size(), 0.0);
+  while (convolver_c.IsUpdating()) {
+    convolver_c.ProcessBlock(long_zeros, long_output);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  Signal long_impulse(long_rir.size(), 0.0);
+  long_impulse[0] = 1.0;
+  convolver_c.ProcessBlock(long_impulse, long_output);
+  ASSERT(IsEqual(long_output, long_rir));
+
+  return true;
+}
+
+}  // namespace sal
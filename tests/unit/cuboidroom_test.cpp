@@ -7,6 +7,7 @@
  */
 
 #include "cuboidroom.h"
+#include "firfilter.h"
 
 namespace sal {
 
@@ -121,6 +122,86 @@ bool CuboidRoom::Test() {
                  room_x * room_y * (alpha_z1 + alpha_z2));
 
   ASSERT(dsp::IsEqual(room_sabine_2.SabineRt60(), rt60_2));
+  ASSERT(dsp::IsEqual(room_sabine_2.SabineRt60(1000.0, 44100.0), rt60_2));
+
+  // Frequency-dependent walls: at DC, the averaging filters below have the
+  // same gain as `GainFilter(0.8)`.
+  CuboidRoom room_sabine_3(room_x, room_y, room_z, GainFilter(0.8));
+  CuboidRoom room_sabine_4(room_x, room_y, room_z,
+                           dsp::FirFilter(std::vector<Sample>({0.4, 0.4})));
+  ASSERT(dsp::IsEqual(room_sabine_4.SabineRt60(0.0, 44100.0),
+                      room_sabine_3.SabineRt60()));
+  ASSERT(room_sabine_4.SabineRt60(10000.0, 44100.0) <
+         room_sabine_3.SabineRt60());
+
+  ASSERT(dsp::IsEqual(room_sabine_2.MixingTime(),
+                      0.001 * sqrt(room_x * room_y * room_z)));
+
+  // Non-allocating and batched boundary queries
+  CuboidRoom room_shifted(Triplet(2.0, 3.0, 4.0), Triplet(1.0, 1.0, 1.0),
+                          GainFilter(0.5));
+  std::vector<Point> pair_sources = {Point(1.5, 2.0, 2.0),
+                                     Point(2.2, 3.5, 4.1)};
+  std::vector<Point> pair_mics = {Point(2.5, 3.0, 4.0), Point(1.3, 1.2, 1.9)};
+  const Int num_points = room_shifted.num_boundary_points();
+  std::vector<Point> batch_points(2 * num_points);
+  room_shifted.CalculateBoundaryPoints(pair_sources, pair_mics, batch_points);
+  std::vector<Point> boundary_points(num_points);
+  std::vector<Int> wall_ids(num_points);
+  for (Int i = 0; i < 2; ++i) {
+    std::vector<Point> expected_points =
+        room_shifted.CalculateBoundaryPoints(pair_sources[i], pair_mics[i]);
+    ASSERT((Int)expected_points.size() == num_points);
+    room_shifted.CalculateBoundaryPoints(pair_sources[i], pair_mics[i],
+                                         boundary_points);
+    for (Int j = 0; j < num_points; ++j) {
+      ASSERT(IsEqual(boundary_points[j], expected_points[j]));
+      ASSERT(IsEqual(batch_points[i * num_points + j], expected_points[j]));
+    }
+    ASSERT(IsEqual(boundary_points[kX1].x(), 1.0));
+    ASSERT(IsEqual(boundary_points[kZ2].z(), 5.0));
+
+    room_shifted.GetBoundaryWallIds(pair_sources[i], pair_mics[i], wall_ids);
+    std::vector<dsp::Filter> boundary_filters =
+        room_shifted.GetBoundaryFilters(pair_sources[i], pair_mics[i]);
+    ASSERT((Int)boundary_filters.size() == num_points);
+    for (Int j = 0; j < num_points; ++j) {
+      ASSERT(wall_ids[j] == j);
+    }
+  }
+
+  // Second-order nodes: the path of the fourth one (via the x_1 and y_1
+  // walls) reaches the microphone from the x_1 wall, at (0, 2, 2), when the
+  // microphone is closer to x_1 than the source, and from the y_1 wall, at
+  // (2, 0, 2), when the positions are swapped.
+  CuboidRoom room_second(4.0, 4.0, 4.0, GainFilter(0.5));
+  room_second.boundary_set_type_ = kFirstAndSecondOrder;
+  ASSERT(room_second.num_boundary_points() == 10);
+  const Point source_second(3.0, 1.0, 2.0);
+  const Point mic_second(1.0, 3.0, 2.0);
+  std::vector<Int> wall_ids_second(10);
+  room_second.GetBoundaryWallIds(source_second, mic_second, wall_ids_second);
+  ASSERT(wall_ids_second[9] == kX1);
+  ASSERT(IsEqual(
+      room_second.CalculateBoundaryPoints(source_second, mic_second)[9],
+      Point(0.0, 2.0, 2.0)));
+  room_second.GetBoundaryWallIds(mic_second, source_second, wall_ids_second);
+  ASSERT(wall_ids_second[9] == kY1);
+  ASSERT(IsEqual(
+      room_second.CalculateBoundaryPoints(mic_second, source_second)[9],
+      Point(2.0, 0.0, 2.0)));
+
+  // Testing frequency responses of wall filters
+  ASSERT(dsp::IsEqual(
+      CuboidRoom::GetFilterResponse(GainFilter(0.6), 1000.0, 44100.0), 0.6));
+  dsp::FirFilter averaging_filter(std::vector<Sample>({0.5, 0.5}));
+  ASSERT(dsp::IsEqual(
+      CuboidRoom::GetFilterResponse(averaging_filter, 0.0, 44100.0), 1.0));
+  ASSERT(dsp::IsEqual(
+      CuboidRoom::GetFilterResponse(averaging_filter, 11025.0, 44100.0),
+      sqrt(2.0) / 2.0));
+  ASSERT(dsp::IsEqual(
+      CuboidRoom::GetFilterResponse(averaging_filter, 22050.0, 44100.0), 0.0));
 
   return true;
 }
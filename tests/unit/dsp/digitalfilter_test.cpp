@@ -529,6 +529,23 @@ bool FirFilter::Test() {
   ASSERT(IsEqual(filter_y.ProcessSample(-2.5), -1.5));
   ASSERT(IsEqual(filter_y.ProcessSample(-2.5), -2.5));
 
+  // Linear-phase crossover: the bands add up to a delay
+  std::vector<std::vector<Real>> crossover =
+      LinearPhaseCrossover({500.0, 2000.0}, 16000.0, 101);
+  ASSERT(crossover.size() == 3);
+  std::vector<Real> crossover_sum = Zeros<Real>(101);
+  for (const std::vector<Real>& band : crossover) {
+    ASSERT(band.size() == 101);
+    crossover_sum = Add(crossover_sum, band);
+  }
+  std::vector<Real> crossover_delay = Zeros<Real>(101);
+  crossover_delay[50] = 1.0;
+  ASSERT(IsEqual(crossover_sum, crossover_delay));
+  // The lowest band passes DC, the others do not
+  ASSERT(IsEqual(Sum(crossover[0]), 1.0));
+  ASSERT(IsEqual(Sum(crossover[1]), 0.0));
+  ASSERT(IsEqual(Sum(crossover[2]), 0.0));
+
   return true;
 }
 
@@ -0,0 +1,128 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2012-24, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "comparisonop.h"
+#include "dsptypes.h"
+#include "partitionedconvolver.h"
+#include "randomop.h"
+#include "vectorop.h"
+
+namespace sal {
+
+namespace dsp {
+
+bool PartitionedConvolver::Test() {
+  const Real precision = 1.0E-10;
+  RandomGenerator random_generator(1);
+
+  // Single partition is equivalent to time-domain convolution
+  PartitionedConvolver convolver_a(std::vector<Real>({0.5, -1.0, 0.25}), 4);
+  ASSERT(IsEqual(convolver_a.ProcessSample(1.0), 0.5));
+  ASSERT(IsEqual(convolver_a.ProcessSample(2.0), 0.0));
+  ASSERT(IsEqual(convolver_a.ProcessSample(0.0), -1.75));
+  ASSERT(IsEqual(convolver_a.ProcessSample(0.0), 0.5));
+  ASSERT(IsEqual(convolver_a.ProcessSample(0.0), 0.0));
+
+  // Long impulse response, streamed in blocks of varying length
+  std::vector<Real> impulse_response = random_generator.Randn(1000);
+  std::vector<Real> input = random_generator.Randn(3000);
+  std::vector<Real> cmp = Conv(input, impulse_response);
+  cmp.resize(input.size());
+
+  PartitionedConvolver convolver_b(impulse_response, 64);
+  std::vector<Real> output(input.size());
+  const std::vector<size_t> block_sizes = {1, 7, 64, 130, 3, 200, 512};
+  size_t start = 0;
+  for (size_t i = 0; start < input.size(); ++i) {
+    const size_t length =
+        std::min(block_sizes[i % block_sizes.size()], input.size() - start);
+    convolver_b.ProcessBlock(
+        std::span<const Real>(input).subspan(start, length),
+        std::span<Real>(output).subspan(start, length));
+    start += length;
+  }
+  ASSERT(IsEqual(output, cmp, precision));
+
+  // Resetting clears the input history
+  convolver_b.ResetState();
+  convolver_b.ProcessBlock(input, output);
+  ASSERT(IsEqual(output, cmp, precision));
+
+  // Instantaneous update in the middle of a partition
+  std::vector<Real> impulse_response_b = random_generator.Randn(700);
+  std::vector<Real> cmp_b = Conv(input, impulse_response_b);
+  convolver_b.ResetState();
+  convolver_b.ProcessBlock(std::span<const Real>(input).subspan(0, 1000),
+                           std::span<Real>(output).subspan(0, 1000));
+  convolver_b.SetImpulseResponse(impulse_response_b);
+  convolver_b.ProcessBlock(std::span<const Real>(input).subspan(1000),
+                           std::span<Real>(output).subspan(1000));
+  for (size_t i = 1000; i < input.size(); ++i) {
+    ASSERT(IsEqual(output[i], cmp_b[i], precision));
+  }
+
+  // Update to a longer impulse response in the middle of a stream: the delay
+  // line grows and keeps its input, so the tail of the input preceding the
+  // update (within the previous delay line) continues with the new response.
+  std::vector<Real> input_short = input;
+  std::fill(input_short.begin(), input_short.begin() + 900, 0.0);
+  std::vector<Real> cmp_long = Conv(input_short, impulse_response);
+  PartitionedConvolver convolver_e(random_generator.Randn(300), 64);
+  convolver_e.ProcessBlock(std::span<const Real>(input_short).subspan(0, 1000),
+                           std::span<Real>(output).subspan(0, 1000));
+  convolver_e.SetImpulseResponse(impulse_response);
+  convolver_e.ProcessBlock(std::span<const Real>(input_short).subspan(1000),
+                           std::span<Real>(output).subspan(1000));
+  for (size_t i = 1000; i < input.size(); ++i) {
+    ASSERT(IsEqual(output[i], cmp_long[i], precision));
+  }
+
+  // Same, with the longer delay line allocated with the partitions, which
+  // then hold the previous delay line
+  PartitionedConvolver convolver_f(random_generator.Randn(300), 64);
+  Partitions partitions_long(impulse_response, 64);
+  partitions_long.AllocateDelayLine();
+  convolver_f.ProcessBlock(std::span<const Real>(input_short).subspan(0, 1000),
+                           std::span<Real>(output).subspan(0, 1000));
+  convolver_f.SwapImpulseResponse(partitions_long);
+  ASSERT(partitions_long.num_partitions() == 5);
+  ASSERT(partitions_long.delay_line_.size() == 4 * 2 * 64);
+  ASSERT(convolver_f.current_.delay_line_.empty());
+  convolver_f.ProcessBlock(std::span<const Real>(input_short).subspan(1000),
+                           std::span<Real>(output).subspan(1000));
+  for (size_t i = 1000; i < input.size(); ++i) {
+    ASSERT(IsEqual(output[i], cmp_long[i], precision));
+  }
+
+  // Crossfaded update
+  PartitionedConvolver convolver_c(std::vector<Real>(1, 1.0), 8);
+  convolver_c.ProcessSample(1.0);
+  convolver_c.SetImpulseResponse(std::vector<Real>(1, 0.0), 3);
+  ASSERT(IsEqual(convolver_c.ProcessSample(1.0), 0.75));
+  ASSERT(IsEqual(convolver_c.ProcessSample(1.0), 0.5));
+  ASSERT(IsEqual(convolver_c.ProcessSample(1.0), 0.25));
+  ASSERT(IsEqual(convolver_c.ProcessSample(1.0), 0.0));
+  ASSERT(IsEqual(convolver_c.ProcessSample(1.0), 0.0));
+
+  // Partitions computed in advance
+  Partitions partitions(impulse_response, 64);
+  PartitionedConvolver convolver_d(std::vector<Real>(1, 0.0), 64);
+  convolver_d.SwapImpulseResponse(partitions);
+  ASSERT(partitions.num_partitions() == 1);
+  convolver_d.ProcessBlock(input, output);
+  ASSERT(IsEqual(output, cmp, precision));
+
+  return true;
+}
+
+}  // namespace dsp
+
+}  // namespace sal
@@ -0,0 +1,118 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#include <numeric>
+
+#include "cuboidroom.h"
+#include "fdn.h"
+#include "firfilter.h"
+#include "riranalysis.h"
+
+using sal::dsp::IsEqual;
+
+namespace sal {
+
+bool Fdn::Test() {
+  // Co-prime delays
+  const std::vector<Int> delays = CoprimeDelays(8, 400, 1200);
+  ASSERT(delays.size() == 8);
+  ASSERT(delays[0] == 400);
+  for (size_t i = 0; i < delays.size(); ++i) {
+    ASSERT(delays[i] >= 400 && delays[i] < 1300);
+    for (size_t j = 0; j < i; ++j) {
+      ASSERT(delays[j] < delays[i]);
+      ASSERT(std::gcd(delays[i], delays[j]) == 1);
+    }
+  }
+
+  // The reverberation time of the impulse response is the target one, with
+  // both feedback matrices
+  const Time sampling_frequency = 16000;
+  const Time rt60 = 0.6;
+  const Int num_samples = (Int)(1.5 * rt60 * sampling_frequency);
+  std::vector<Sample> impulse(num_samples, 0.0);
+  impulse[0] = 1.0;
+  for (const FdnMatrixType matrix_type :
+       {kHadamardMatrix, kHouseholderMatrix}) {
+    Fdn fdn(delays, sampling_frequency, matrix_type);
+    ASSERT(fdn.num_lines() == 8);
+    fdn.SetReverberationTime(rt60);
+    std::vector<Sample> output(num_samples);
+    fdn.ProcessBlock(impulse, output);
+    for (Int n = 0; n < delays[0]; ++n) {
+      ASSERT(IsEqual(output[n], 0.0));
+    }
+    ASSERT(std::abs(RirAnalysis::Rt60(output, sampling_frequency) - rt60) <
+           0.1 * rt60);
+
+    // Sample by sample processing gives the same result
+    fdn.ResetState();
+    std::vector<Sample> output_sample(num_samples);
+    for (Int n = 0; n < num_samples; ++n) {
+      output_sample[n] = fdn.ProcessSample(impulse[n]);
+    }
+    ASSERT(IsEqual(output, output_sample));
+
+    // And so does processing in blocks of arbitrary length
+    fdn.ResetState();
+    std::vector<Sample> output_blocks(num_samples);
+    const Int block_length = 1000;
+    for (Int n = 0; n < num_samples; n += block_length) {
+      const Int length = std::min(block_length, num_samples - n);
+      fdn.ProcessBlock(std::span<const Sample>(&impulse[n], length),
+                       std::span<Sample>(&output_blocks[n], length));
+    }
+    ASSERT(IsEqual(output, output_blocks));
+  }
+
+  // Lossless without absorption
+  Fdn fdn_lossless(delays, sampling_frequency, kHouseholderMatrix);
+  std::vector<Sample> output_lossless(num_samples);
+  fdn_lossless.ProcessBlock(impulse, output_lossless);
+  Sample energy_early = 0.0;
+  Sample energy_late = 0.0;
+  for (Int n = 0; n < 4000; ++n) {
+    energy_early += pow(output_lossless[n + 1000], 2.0);
+    energy_late += pow(output_lossless[num_samples - 4000 + n], 2.0);
+  }
+  ASSERT(energy_late > 0.5 * energy_early);
+
+  // Frequency-dependent reverberation time, from the Sabine formula in
+  // each octave band of a room with walls that absorb more at high
+  // frequencies
+  CuboidRoom room(6.0, 5.0, 3.0,
+                  dsp::FirFilter(std::vector<Sample>({0.45, 0.45})));
+  const std::vector<Time> centre_frequencies = {250.0, 500.0, 1000.0, 2000.0,
+                                                4000.0};
+  std::vector<Time> rt60s;
+  for (const Time f : centre_frequencies) {
+    rt60s.push_back(room.SabineRt60(f, sampling_frequency));
+  }
+  ASSERT(rt60s.front() > 2.0 * rt60s.back());
+  Fdn fdn_bands(delays, sampling_frequency);
+  fdn_bands.SetReverberationTime(centre_frequencies, rt60s);
+  std::vector<Sample> output_bands(num_samples);
+  fdn_bands.ProcessBlock(impulse, output_bands);
+  // The late response is dominated by low frequencies: its first difference
+  // (a high-pass) has relatively less energy than in the early response
+  auto highpass_ratio = [&](const Int start, const Int length) {
+    Sample energy = 0.0;
+    Sample energy_difference = 0.0;
+    for (Int n = start; n < start + length; ++n) {
+      energy += pow(output_bands[n], 2.0);
+      energy_difference += pow(output_bands[n] - output_bands[n - 1], 2.0);
+    }
+    return energy_difference / energy;
+  };
+  ASSERT(highpass_ratio(num_samples / 2, 2000) <
+         0.5 * highpass_ratio(delays.back(), 2000));
+
+  return true;
+}
+
+}  // namespace sal
@@ -6,7 +6,19 @@
  Authors: Enzo De Sena, enzodesena@gmail.com
  */
 
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+
 #include "fdtd.h"
+#include "monomics.h"
+#include "pointwiseop.h"
+#include "randomop.h"
+#include "source.h"
+
+using sal::dsp::Point;
 
 namespace sal {
 
@@ -48,6 +60,396 @@ bool Fdtd::Test() {
 
   ASSERT(dsp::IsEqual(rir_cmp, p_out, 0.001));
 
+  // Grid layout: rows are aligned and padded, the halo is included
+  FdtdGrid grid(3, 4, 5);
+  ASSERT(reinterpret_cast<uintptr_t>(grid.data()) % FdtdGrid::kAlignment == 0);
+  ASSERT(grid.stride_y() * sizeof(Sample) % FdtdGrid::kAlignment == 0);
+  ASSERT(grid.stride_y() >= 5);
+  ASSERT(grid.stride_x() == 4 * grid.stride_y());
+  ASSERT(grid.Index(2, 3, 4) == 2 * grid.stride_x() + 3 * grid.stride_y() + 4);
+  ASSERT(grid.size() == 3 * grid.stride_x());
+  ASSERT(grid.at(2, 3, 4) == 0.0);
+
+  // A non-cubic room gives the same response as the one with the x and z axes
+  // swapped (with swapped source and microphone coordinates)
+  const unsigned int Nt_room = 60;
+  MonoBuffer impulse(Nt_room);
+  impulse.SetSample(0, 1.0);
+  std::vector<sal::Sample> p_xyz =
+      Fdtd::RunFdtd(7, 5, 3, Nt_room, Fdtd::CreateGeometry(7, 5, 3), 10,
+                    impulse.GetReadView(), 1.0 / sqrt(3.0), 3, 4, 2,  // source
+                    7, 3, 3);  // microphone
+  std::vector<sal::Sample> p_zyx =
+      Fdtd::RunFdtd(3, 5, 7, Nt_room, Fdtd::CreateGeometry(3, 5, 7), 10,
+                    impulse.GetReadView(), 1.0 / sqrt(3.0), 2, 4, 3,  // source
+                    3, 3, 7);  // microphone
+  ASSERT(!dsp::IsEqual(p_xyz, std::vector<Sample>(Nt_room, 0.0)));
+  ASSERT(dsp::IsEqual(p_xyz, p_zyx));
+
+  // Compact geometry: the cuboid is the same as the one from the full map
+  // of K, with one run of air points per row inside the room
+  const std::vector<std::vector<std::vector<Int> > > geometry_map =
+      Fdtd::CreateGeometry(7, 5, 3);
+  const FdtdGeometry cuboid = FdtdGeometry::Cuboid(7, 5, 3, 10);
+  ASSERT(cuboid.size_x() == 9 && cuboid.size_y() == 7 && cuboid.size_z() == 5);
+  for (Int x = 0; x < 9; ++x) {
+    for (Int y = 0; y < 7; ++y) {
+      for (Int z = 0; z < 5; ++z) {
+        ASSERT(cuboid.NumNeighbours(x, y, z) == geometry_map[x][y][z]);
+      }
+    }
+  }
+  ASSERT(cuboid.num_boundary_points() == 7 * 5 * 3 - 5 * 3 * 1);
+  ASSERT(cuboid.air_runs(3, 3).size() == 1);
+  ASSERT(cuboid.air_runs(3, 3)[0].begin == 2);
+  ASSERT(cuboid.air_runs(3, 3)[0].end == 3);
+  ASSERT(cuboid.air_runs(1, 3).empty());
+  ASSERT(cuboid.boundary_points(3, 3).size() == 2);
+  ASSERT(Fdtd::RunFdtd(cuboid, Nt_room, impulse.GetReadView(),
+                       1.0 / sqrt(3.0), 2, 3, 1, 6, 2, 2) == p_xyz);
+
+  // Rows are split in several runs around boundary points
+  FdtdGeometry geometry(3, 3, 8);
+  const std::vector<Int> row = {0, 5, 6, 6, 4, 6, 5, 0};
+  geometry.SetRow(1, 1, row, std::vector<Sample>(8, 10.0));
+  ASSERT(geometry.air_runs(1, 1).size() == 2);
+  ASSERT(geometry.air_runs(1, 1)[0].begin == 2);
+  ASSERT(geometry.air_runs(1, 1)[0].end == 4);
+  ASSERT(geometry.air_runs(1, 1)[1].begin == 5);
+  ASSERT(geometry.air_runs(1, 1)[1].end == 6);
+  ASSERT(geometry.num_boundary_points() == 3);
+  for (Int z = 0; z < 8; ++z) {
+    ASSERT(geometry.NumNeighbours(1, 1, z) == row[z]);
+  }
+  ASSERT(geometry.NumNeighbours(0, 1, 3) == 0);
+
+  // Several microphones in one run give the same outputs as one run per
+  // microphone
+  const std::vector<FdtdGridPoint> microphones = {
+      {6, 2, 2}, {2, 5, 3}, {7, 3, 1}};
+  const std::vector<Signal> p_microphones =
+      Fdtd::RunFdtd(cuboid, Nt_room, {{2, 3, 1}}, {impulse.GetReadView()},
+                    microphones, 1.0 / sqrt(3.0));
+  ASSERT(p_microphones.size() == 3);
+  ASSERT(p_microphones[0] == p_xyz);
+  for (size_t k = 0; k < microphones.size(); ++k) {
+    ASSERT(p_microphones[k] ==
+           Fdtd::RunFdtd(cuboid, Nt_room, impulse.GetReadView(),
+                         1.0 / sqrt(3.0), 2, 3, 1, microphones[k].x,
+                         microphones[k].y, microphones[k].z));
+  }
+
+  // Several sources are superposed
+  Signal noise = dsp::RandomGenerator(1).Randn(Nt_room);
+  const Signal p_noise =
+      Fdtd::RunFdtd(cuboid, Nt_room, noise, 1.0 / sqrt(3.0), 5, 4, 3, 6, 2, 2);
+  const std::vector<Signal> p_sources = Fdtd::RunFdtd(
+      cuboid, Nt_room, {{2, 3, 1}, {5, 4, 3}, {0, 3, 1}},
+      {impulse.GetReadView(), noise, noise}, {{6, 2, 2}}, 1.0 / sqrt(3.0));
+  ASSERT(dsp::IsEqual(p_sources[0], dsp::Add(p_xyz, p_noise)));
+
+  // Room-level interface
+  CuboidRoom room(1.0, 1.2, 0.8, dsp::GainFilter(0.9));
+  OmniSource omni_source(Point(0.3, 0.4, 0.3));
+  OmniMic omni_mic(Point(0.7, 0.5, 0.4));
+  const Time sampling_frequency = 2000;
+  Fdtd fdtd(&room, &omni_source, &omni_mic, sampling_frequency, 10,
+            1.0 / sqrt(3.0));
+  MonoBuffer room_impulse(100);
+  room_impulse.SetSample(0, 1.0);
+  MonoBuffer room_output(100);
+  fdtd.Run(room_impulse, room_output);
+  Signal impulse_signal(100, 0.0);
+  impulse_signal[0] = 1.0;
+  const std::vector<Signal> rirs =
+      fdtd.Run({omni_source.position()}, {impulse_signal},
+               {Point(0.2, 0.9, 0.5), omni_mic.position()});
+  ASSERT(rirs.size() == 2);
+  ASSERT(rirs[0].size() == 100);
+  ASSERT(rirs[1] == fdtd.rir());
+  ASSERT(!dsp::IsEqual(rirs[1], Signal(100, 0.0)));
+
+  // A `Stop()` received between runs does not stop the next one, whose
+  // result is complete and is added to the cache.
+  RirCache fdtd_cache;
+  fdtd.SetRirCache(&fdtd_cache);
+  fdtd.Stop();
+  fdtd.Run(room_impulse, room_output);
+  ASSERT(fdtd.rir() == rirs[1]);
+  ASSERT(fdtd_cache.num_entries() == 1);
+  fdtd.Stop();
+  ASSERT(fdtd.Run({omni_source.position()}, {impulse_signal},
+                  {Point(0.2, 0.9, 0.5), omni_mic.position()}) == rirs);
+  fdtd.SetRirCache(nullptr);
+
+  // A `Stop()` received from another thread while the simulation is running
+  // stops it: the last samples are not computed and the RIR is not cached.
+  Fdtd fdtd_long(&room, &omni_source, &omni_mic, 20000, 10, 1.0 / sqrt(3.0));
+  RirCache long_cache;
+  fdtd_long.SetRirCache(&long_cache);
+  MonoBuffer long_impulse(20000);
+  long_impulse.SetSample(0, 1.0);
+  MonoBuffer long_output(20000);
+  std::atomic<bool> long_done(false);
+  std::thread long_thread([&]() {
+    fdtd_long.Run(long_impulse, long_output);
+    long_done.store(true);
+  });
+  while (!long_done.load()) {
+    fdtd_long.Stop();
+    std::this_thread::yield();
+  }
+  long_thread.join();
+  ASSERT(fdtd_long.rir().size() == 20000);
+  ASSERT(fdtd_long.rir().back() == 0.0);
+  ASSERT(long_cache.num_entries() == 0);
+
+  // Checkpoints: the simulation is stopped at every time step for the first
+  // steps and resumed from the checkpoint, which gives the same result as an
+  // uninterrupted simulation. The checkpoint is removed at the end.
+  const std::string checkpoint_path =
+      (std::filesystem::temp_directory_path() / "sal_fdtd_checkpoint.bin")
+          .string();
+  std::remove(checkpoint_path.c_str());
+  std::atomic<bool> stop(true);
+  FdtdCheckpointSettings checkpoint;
+  checkpoint.path = checkpoint_path;
+  checkpoint.interval = 7;
+  checkpoint.stop = [&stop]() { return stop.load(); };
+  for (Int n = 2; n < 12; ++n) {
+    const std::vector<Signal> p_stopped =
+        Fdtd::RunFdtd(cuboid, Nt_room, {{2, 3, 1}}, {impulse.GetReadView()},
+                      microphones, 1.0 / sqrt(3.0), nullptr, checkpoint);
+    ASSERT(std::filesystem::exists(checkpoint_path));
+    for (size_t k = 0; k < microphones.size(); ++k) {
+      for (Int i = 0; i < Nt_room; ++i) {
+        ASSERT(p_stopped[k][i] == ((i < n) ? p_microphones[k][i] : 0.0));
+      }
+    }
+  }
+  stop = false;
+  ASSERT(Fdtd::RunFdtd(cuboid, Nt_room, {{2, 3, 1}}, {impulse.GetReadView()},
+                       microphones, 1.0 / sqrt(3.0), nullptr,
+                       checkpoint) == p_microphones);
+  ASSERT(!std::filesystem::exists(checkpoint_path));
+
+  // Checkpoints of a different simulation are ignored
+  stop = true;
+  Fdtd::RunFdtd(cuboid, Nt_room, {{2, 3, 1}}, {noise}, microphones,
+                1.0 / sqrt(3.0), nullptr, checkpoint);
+  ASSERT(std::filesystem::exists(checkpoint_path));
+  stop = false;
+  ASSERT(Fdtd::RunFdtd(cuboid, Nt_room, {{2, 3, 1}}, {impulse.GetReadView()},
+                       microphones, 1.0 / sqrt(3.0), nullptr,
+                       checkpoint) == p_microphones);
+  ASSERT(!std::filesystem::exists(checkpoint_path));
+
+  // Compact schemes: a smooth pulse arrives at r / lambda time steps both
+  // along the axes and along the diagonals (i.e. dispersion is low), and
+  // schemes with a larger Courant number travel further per time step
+  const Int Nt_pulse = 50;
+  Signal pulse(Nt_pulse, 0.0);
+  for (Int n = 0; n < Nt_pulse; ++n) {
+    pulse[n] = exp(-pow((Sample)n - 15.0, 2.0) / (2.0 * 9.0));
+  }
+  const FdtdGeometry free_field = FdtdGeometry::Cuboid(41, 41, 41, 1000.0);
+  for (const FdtdScheme scheme :
+       {kStandardRectilinear, kInterpolatedIsotropic, kInterpolatedWideband}) {
+    const Sample courant_number = Fdtd::CourantNumber(scheme);
+    const std::vector<FdtdGridPoint> receivers = {{21 + 8, 21, 21},
+                                                  {21 + 5, 21 + 5, 21 + 5}};
+    const std::vector<Signal> p_pulse =
+        Fdtd::RunFdtd(free_field, Nt_pulse, {{21, 21, 21}}, {pulse},
+                      receivers, courant_number, nullptr,
+                      FdtdCheckpointSettings(), scheme);
+    const Sample distances[2] = {8.0, 5.0 * sqrt(3.0)};
+    for (Int k = 0; k < 2; ++k) {
+      const Int peak = (Int)(std::max_element(p_pulse[k].begin(),
+                                              p_pulse[k].end()) -
+                             p_pulse[k].begin());
+      ASSERT(std::abs((Sample)peak - (16.0 + distances[k] / courant_number)) <=
+             1.5);
+    }
+  }
+  Sample a;
+  Sample b;
+  Fdtd::SchemeParameters(kStandardRectilinear, a, b);
+  ASSERT(a == 0.0 && b == 0.0);
+  Fdtd::SchemeParameters(kInterpolatedWideband, a, b);
+  ASSERT(dsp::IsEqual(a, 0.25) && dsp::IsEqual(b, 1.0 / 16.0));
+
+  // Compact schemes are stable in a room with rigid walls, and decay in a
+  // room with absorbing walls. The input is a band-limited pulse with zero
+  // mean: white noise would excite the modes at the Nyquist frequency, which
+  // are marginally stable at the largest Courant number, and a non-zero
+  // mean makes the pressure drift in a closed rigid room.
+  for (const FdtdScheme scheme :
+       {kInterpolatedIsotropic, kInterpolatedWideband}) {
+    const Int Nt_long = 3000;
+    Signal input_long(Nt_long, 0.0);
+    for (Int n = 0; n < 60; ++n) {
+      input_long[n] = (15.0 - n) * exp(-pow(n - 15.0, 2.0) / (2.0 * 9.0));
+    }
+    const Signal p_rigid = Fdtd::RunFdtd(
+        FdtdGeometry::Cuboid(9, 7, 6, 1.0E6), Nt_long, {{3, 3, 3}},
+        {input_long}, {{7, 5, 2}}, Fdtd::CourantNumber(scheme), nullptr,
+        FdtdCheckpointSettings(), scheme)[0];
+    const Signal p_absorbing = Fdtd::RunFdtd(
+        FdtdGeometry::Cuboid(9, 7, 6, 2.0), Nt_long, {{3, 3, 3}},
+        {input_long}, {{7, 5, 2}}, Fdtd::CourantNumber(scheme), nullptr,
+        FdtdCheckpointSettings(), scheme)[0];
+    Sample energy_early = 0.0;
+    Sample energy_rigid = 0.0;
+    Sample energy_absorbing = 0.0;
+    for (Int n = 0; n < 500; ++n) {
+      energy_early += pow(p_rigid[n], 2.0);
+      energy_rigid += pow(p_rigid[Nt_long - 500 + n], 2.0);
+      energy_absorbing += pow(p_absorbing[Nt_long - 500 + n], 2.0);
+    }
+    ASSERT(energy_rigid > 0.1 * energy_early);
+    ASSERT(energy_rigid < 10.0 * energy_early);
+    ASSERT(energy_absorbing < 1.0E-6 * energy_early);
+  }
+
+  // Multithreaded simulations give exactly the same result, also when the
+  // grid is split in several tiles along y
+  ThreadPool thread_pool(3);
+  ASSERT(Fdtd::RunFdtd(7, 5, 3, Nt_room, Fdtd::CreateGeometry(7, 5, 3), 10,
+                       impulse.GetReadView(), 1.0 / sqrt(3.0), 3, 4, 2, 7, 3,
+                       3, &thread_pool) == p_xyz);
+  const std::vector<std::vector<std::vector<Int> > > geometry_long =
+      Fdtd::CreateGeometry(8, 60, 200);
+  std::vector<sal::Sample> p_serial =
+      Fdtd::RunFdtd(8, 60, 200, Nt_room, geometry_long, 10,
+                    impulse.GetReadView(), 1.0 / sqrt(3.0), 4, 5, 6, 5, 10,
+                    12);
+  ASSERT(!dsp::IsEqual(p_serial, std::vector<Sample>(Nt_room, 0.0)));
+  ASSERT(Fdtd::RunFdtd(8, 60, 200, Nt_room, geometry_long, 10,
+                       impulse.GetReadView(), 1.0 / sqrt(3.0), 4, 5, 6, 5, 10,
+                       12, &thread_pool) == p_serial);
+  const FdtdGeometry geometry_compact = FdtdGeometry::Cuboid(8, 60, 40, 5.0);
+  const std::vector<Signal> p_compact = Fdtd::RunFdtd(
+      geometry_compact, Nt_room, {{4, 5, 6}}, {impulse.GetReadView()},
+      {{5, 10, 12}, {1, 1, 1}}, 1.0, nullptr, FdtdCheckpointSettings(),
+      kInterpolatedWideband);
+  ASSERT(Fdtd::RunFdtd(geometry_compact, Nt_room, {{4, 5, 6}},
+                       {impulse.GetReadView()}, {{5, 10, 12}, {1, 1, 1}}, 1.0,
+                       &thread_pool, FdtdCheckpointSettings(),
+                       kInterpolatedWideband) == p_compact);
+
+  // Only the light cone of the sources is updated. Adding two sources that
+  // cancel out exactly in the opposite corner makes the light cone cover
+  // the grid much earlier, and gives exactly the same result.
+  const FdtdGeometry geometry_cone = FdtdGeometry::Cuboid(30, 20, 25, 5.0);
+  const Int Nt_cone = 60;
+  Signal delayed(Nt_cone, 0.0);
+  delayed[10] = 1.0;
+  delayed[12] = -0.5;
+  Signal cancelling(Nt_cone, 0.0);
+  cancelling[0] = 1.0;
+  Signal cancelled(Nt_cone, 0.0);
+  cancelled[0] = -1.0;
+  const std::vector<FdtdGridPoint> receivers_cone = {
+      {5, 6, 7}, {20, 4, 5}, {0, 0, 0}, {29, 19, 24}, {15, 10, 0}};
+  for (const FdtdScheme scheme :
+       {kStandardRectilinear, kInterpolatedIsotropic, kInterpolatedWideband}) {
+    const std::vector<Signal> p_cone = Fdtd::RunFdtd(
+        geometry_cone, Nt_cone, {{3, 4, 5}}, {delayed}, receivers_cone,
+        Fdtd::CourantNumber(scheme), &thread_pool, FdtdCheckpointSettings(),
+        scheme);
+    ASSERT(!dsp::IsEqual(p_cone[1], Signal(Nt_cone, 0.0)));
+    ASSERT(Fdtd::RunFdtd(geometry_cone, Nt_cone,
+                         {{3, 4, 5}, {28, 18, 23}, {28, 18, 23}},
+                         {delayed, cancelling, cancelled}, receivers_cone,
+                         Fdtd::CourantNumber(scheme), nullptr,
+                         FdtdCheckpointSettings(), scheme) == p_cone);
+  }
+
+  // Voxelized meshes: the mesh of a cuboid gives the same geometry as the
+  // cuboid, with the xi of each boundary point from the material of its wall
+  const Length spacing = 0.25;
+  const TriangleMesh cuboid_mesh =
+      TriangleMesh::Cuboid(7.0 * spacing, 5.0 * spacing, 3.0 * spacing);
+  ASSERT(dsp::IsEqual(FdtdGeometry::MeshOrigin(cuboid_mesh, spacing),
+                      Point(-spacing, -spacing, -spacing)));
+  const std::vector<Sample> wall_xis = {1.0, 2.0, 3.0, 4.0, 5.0, 6.0};
+  const FdtdGeometry voxelized =
+      FdtdGeometry::FromMesh(cuboid_mesh, spacing, wall_xis);
+  ASSERT(voxelized.size_x() == 9 && voxelized.size_y() == 7 &&
+         voxelized.size_z() == 5);
+  for (Int x = 0; x < 9; ++x) {
+    for (Int y = 0; y < 7; ++y) {
+      for (Int z = 0; z < 5; ++z) {
+        ASSERT(voxelized.NumNeighbours(x, y, z) == cuboid.NumNeighbours(x, y, z));
+      }
+    }
+  }
+  auto boundary_xi = [&voxelized](const Int x, const Int y, const Int z) {
+    for (const FdtdGeometry::BoundaryPoint& point :
+         voxelized.boundary_points(x, y)) {
+      if (point.z == z) {
+        return point.xi;
+      }
+    }
+    return 0.0;
+  };
+  ASSERT(boundary_xi(1, 3, 2) == 1.0);
+  ASSERT(boundary_xi(7, 3, 2) == 2.0);
+  ASSERT(boundary_xi(4, 1, 2) == 3.0);
+  ASSERT(boundary_xi(4, 5, 2) == 4.0);
+  ASSERT(boundary_xi(4, 3, 1) == 5.0);
+  ASSERT(boundary_xi(4, 3, 3) == 6.0);
+
+  // The points inside a tetrahedron are those inside the mesh
+  const TriangleMesh tetrahedron(
+      {Point(0, 0, 0), Point(2, 0, 0), Point(0, 2, 0), Point(0, 0, 2)},
+      {{{0, 2, 1}, 0}, {{0, 1, 3}, 0}, {{0, 3, 2}, 0}, {{1, 2, 3}, 0}},
+      {"default"});
+  const FdtdGeometry voxelized_tetrahedron =
+      FdtdGeometry::FromMesh(tetrahedron, 0.1, std::vector<Sample>(1, 5.0));
+  const Point tetrahedron_origin = FdtdGeometry::MeshOrigin(tetrahedron, 0.1);
+  Int num_points = 0;
+  for (Int x = 0; x < voxelized_tetrahedron.size_x(); ++x) {
+    for (Int y = 0; y < voxelized_tetrahedron.size_y(); ++y) {
+      for (Int z = 0; z < voxelized_tetrahedron.size_z(); ++z) {
+        const bool inside = voxelized_tetrahedron.NumNeighbours(x, y, z) > 0;
+        const Point position =
+            dsp::Sum(tetrahedron_origin, Point(0.1 * x, 0.1 * y, 0.1 * z));
+        ASSERT(inside == tetrahedron.IsPointInside(position));
+        num_points += inside;
+      }
+    }
+  }
+  // The points with non-negative coordinates x + y + z < 20, i.e. those on
+  // the slanted face are moved out by the offset of the inside test
+  ASSERT(num_points == 20 * 21 * 22 / 6);
+
+  // A room from the mesh of a cuboid has the same response as the cuboid
+  const Time mesh_sampling_frequency = 2000;
+  const Length mesh_spacing =
+      SOUND_SPEED / (mesh_sampling_frequency / sqrt(3.0));
+  MeshRoom mesh_room(TriangleMesh::Cuboid(4.0 * mesh_spacing,
+                                          5.0 * mesh_spacing,
+                                          3.0 * mesh_spacing),
+                     dsp::GainFilter(0.9));
+  Fdtd fdtd_mesh(&mesh_room, &omni_source, &omni_mic, mesh_sampling_frequency,
+                 10, 1.0 / sqrt(3.0));
+  fdtd_mesh.Run(room_impulse, room_output);
+  const FdtdGridPoint mesh_source = {
+      dsp::RoundToInt(0.3 / mesh_spacing) + 1,
+      dsp::RoundToInt(0.4 / mesh_spacing) + 1,
+      dsp::RoundToInt(0.3 / mesh_spacing) + 1};
+  const FdtdGridPoint mesh_mic = {dsp::RoundToInt(0.7 / mesh_spacing) + 1,
+                                  dsp::RoundToInt(0.5 / mesh_spacing) + 1,
+                                  dsp::RoundToInt(0.4 / mesh_spacing) + 1};
+  ASSERT(fdtd_mesh.rir() ==
+         Fdtd::RunFdtd(FdtdGeometry::Cuboid(4, 5, 3,
+                                            mesh_room.WallImpedances()[0]),
+                       100, room_impulse.GetReadView(), 1.0 / sqrt(3.0),
+                       mesh_source.x, mesh_source.y, mesh_source.z,
+                       mesh_mic.x, mesh_mic.y, mesh_mic.z));
+  ASSERT(!dsp::IsEqual(fdtd_mesh.rir(), Signal(100, 0.0)));
+
   return true;
 }
 
@@ -6,12 +6,17 @@
  Authors: Enzo De Sena, enzodesena@gmail.com
  */
 
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
 #include "ism.h"
 #include "microphone.h"
 #include "monomics.h"
 #include "salconstants.h"
 #include "source.h"
 
+using sal::dsp::FirFilter;
 using sal::dsp::GainFilter;
 using sal::dsp::IirFilter;
 using sal::dsp::IsEqual;
@@ -23,6 +28,7 @@ using sal::OmniMic;
 using sal::Sample;
 using sal::Source;
 using sal::Time;
+using sal::TrigMic;
 
 namespace sal {
 
@@ -158,13 +164,318 @@ bool Ism::Test() {
 
   ASSERT(dsp::IsEqual(cmpa, test_rir.GetReadView()));
 
-  // Testing peterson
-  // TODO: complete this test.
-  //  Ism ism_b(&room_absorption, &source, &mic, peterson, 10,
-  //  sampling_frequency); mic.Reset(); source.stream()->Reset();
-  //  std::vector<sal::Sample> signal = {0.3, -0.5, 1.0, 0.0, 0.0, 0.0, 0.0,
-  //  0.0, 0.0, 0.0}; source.stream()->Push(signal); ism_b.Run();
-  //  dsp::Print(mic.stream()->PullAll());
+  // Streaming: the tail of the RIR carries over across blocks
+  OmniMic mic_stream(mic.position());
+  Ism ism_stream(&room_absorption, &source, &mic_stream, none, 9,
+                 sampling_frequency);
+  std::vector<Sample> streamed_rir;
+  for (Int i = 0; i < 3; ++i) {
+    MonoBuffer block_input(3);
+    MonoBuffer block_output(3);
+    if (i == 0) {
+      block_input.SetSample(0, 1.0);
+    }
+    ism_stream.ProcessBlock(block_input.GetReadView(), block_output);
+    for (Int j = 0; j < 3; ++j) {
+      streamed_rir.push_back(block_output.GetSample(j));
+    }
+  }
+  ASSERT(dsp::IsEqual(cmpa, streamed_rir));
+
+  // Cached RIRs: a second instance with the same scene, up to the tolerance,
+  // finds the RIR in the cache.
+  RirCache cache;
+  OmniMic mic_cached(mic.position());
+  Ism ism_cached(&room_absorption, &source, &mic_cached, none, 9,
+                 sampling_frequency);
+  ism_cached.SetRirCache(&cache);
+  test_rir.Reset();
+  ism_cached.ProcessBlock(impulse.GetReadView(), test_rir);
+  ASSERT(cache.num_entries() == 1);
+  ASSERT(ism_cached.images_delay().size() > 0);
+
+  OmniMic mic_cached_b(dsp::Sum(mic.position(), Point(0.0001, 0.0, 0.0)));
+  Ism ism_cached_b(&room_absorption, &source, &mic_cached_b, none, 9,
+                   sampling_frequency);
+  ism_cached_b.SetRirCache(&cache, 0.001);
+  test_rir.Reset();
+  ism_cached_b.ProcessBlock(impulse.GetReadView(), test_rir);
+  ASSERT(cache.num_entries() == 1);
+  ASSERT(ism_cached_b.images_delay().size() == 0);
+  ASSERT(dsp::IsEqual(cmpa, test_rir.GetReadView()));
+
+  // Directional microphone with a constant directivity: binning the images
+  // by direction does not change the result.
+  TrigMic mic_constant(std::vector<Sample>(1, 1.0), mic.position(),
+                       dsp::Quaternion::Identity());
+  Ism ism_constant(&room_absorption, &source, &mic_constant, none, 9,
+                   sampling_frequency);
+  test_rir.Reset();
+  ism_constant.ProcessBlock(impulse.GetReadView(), test_rir);
+  ASSERT(dsp::IsEqual(cmpa, test_rir.GetReadView()));
+
+  // Figure-of-eight microphone: the direct path gets its exact direction
+  // (60 degrees from the axis of the microphone).
+  CuboidRoom room_anechoic_dir(100.0, 100.0, 100.0, GainFilter(0.0));
+  TrigMic mic_eight(std::vector<Sample>({0.0, 1.0}), Point(50.0, 50.0, 50.0),
+                    dsp::Quaternion::Identity());
+  Length distance = 10.0 * SOUND_SPEED / sampling_frequency;
+  OmniSource source_eight(Point(50.0 + distance * cos(PI / 3.0),
+                                50.0 + distance * sin(PI / 3.0), 50.0));
+  Ism ism_eight(&room_anechoic_dir, &source_eight, &mic_eight, none, 20,
+                sampling_frequency);
+  ism_eight.SetDirectionBins(Ism::UniformDirections(8));
+  MonoBuffer impulse_eight(20);
+  impulse_eight.SetSample(0, 1.0);
+  MonoBuffer output_eight(20);
+  ism_eight.ProcessBlock(impulse_eight.GetReadView(), output_eight);
+  std::vector<Sample> cmp_eight = dsp::Zeros<Sample>(20);
+  cmp_eight[10] = 1.0 / 10.0 * cos(PI / 3.0);
+  ASSERT(dsp::IsEqual(cmp_eight, output_eight.GetReadView()));
+
+  // Asynchronous mode
+  OmniMic mic_async(mic.position());
+  Ism ism_async(&room_absorption, &source, &mic_async, none, 9,
+                sampling_frequency);
+  ism_async.SetAsynchronous(true, 0);
+  test_rir.Reset();
+  ism_async.ProcessBlock(impulse.GetReadView(), test_rir);
+  ASSERT(dsp::IsEqual(cmpa, test_rir.GetReadView()));
+
+  // After an update the previous RIR is used until the new one is ready.
+  ism_async.Update();
+  MonoBuffer silence(impulse.num_samples());
+  while (ism_async.IsUpdating()) {
+    test_rir.Reset();
+    ism_async.ProcessBlock(silence.GetReadView(), test_rir);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ism_async.SetAsynchronous(false);
+  test_rir.Reset();
+  ism_async.ProcessBlock(impulse.GetReadView(), test_rir);
+  ASSERT(dsp::IsEqual(cmpa, test_rir.GetReadView()));
+
+  // An asynchronous update after moving the source gives the same RIR as a
+  // synchronous ISM of the new scene.
+  const Point moved_position(3.0 * SOUND_SPEED / sampling_frequency,
+                             2.0 * SOUND_SPEED / sampling_frequency,
+                             500.0 * SOUND_SPEED / sampling_frequency);
+  OmniSource source_reference(moved_position);
+  OmniMic mic_reference(mic.position());
+  Ism ism_reference(&room_absorption, &source_reference, &mic_reference, none,
+                    9, sampling_frequency);
+  MonoBuffer moved_rir(impulse.num_samples());
+  ism_reference.ProcessBlock(impulse.GetReadView(), moved_rir);
+  OmniSource source_async(source.position());
+  OmniMic mic_moved(mic.position());
+  Ism ism_moved(&room_absorption, &source_async, &mic_moved, none, 9,
+                sampling_frequency);
+  ism_moved.SetAsynchronous(true, 0);
+  source_async.SetPosition(moved_position);
+  ism_moved.Update();
+  while (ism_moved.IsUpdating()) {
+    test_rir.Reset();
+    ism_moved.ProcessBlock(silence.GetReadView(), test_rir);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  test_rir.Reset();
+  ism_moved.ProcessBlock(impulse.GetReadView(), test_rir);
+  ASSERT(dsp::IsEqual(moved_rir.GetReadView(), test_rir.GetReadView()));
+  ASSERT(!dsp::IsEqual(cmpa, test_rir.GetReadView()));
+
+  // The scene can be modified, and the ISM destroyed, while an update is in
+  // progress, since the update is computed on a copy of the scene.
+  {
+    OmniSource source_moving(source.position());
+    OmniMic mic_destroyed(mic.position());
+    Ism ism_destroyed(&room_absorption, &source_moving, &mic_destroyed,
+                      peterson, 1000, sampling_frequency);
+    ism_destroyed.SetAsynchronous(true, 0);
+    ism_destroyed.Update();
+    source_moving.SetPosition(dsp::Sum(
+        mic.position(), Point(0.0, SOUND_SPEED / sampling_frequency, 0.0)));
+    ism_destroyed.Update();
+    ASSERT(ism_destroyed.IsUpdating());
+  }
+
+  // Multi-band synthesis with frequency-independent walls: the crossover
+  // bands sum to the broadband RIR.
+  ASSERT(Ism::OctaveBands(sampling_frequency).size() == 7);
+  ASSERT(dsp::IsEqual(Ism::OctaveBands(sampling_frequency).back(), 8000.0));
+  OmniMic mic_bands(mic.position());
+  Ism ism_bands(&room_absorption, &source, &mic_bands, none, 9,
+                sampling_frequency);
+  ism_bands.SetFrequencyBands(Ism::OctaveBands(sampling_frequency));
+  test_rir.Reset();
+  ism_bands.ProcessBlock(impulse.GetReadView(), test_rir);
+  ASSERT(dsp::IsEqual(cmpa, test_rir.GetReadView(), 1.0E-9));
+
+  // Single band at the Nyquist frequency: walls with an averaging filter
+  // remove all reflections.
+  CuboidRoom room_lowpass(5.0 * SOUND_SPEED / sampling_frequency,
+                          5.0 * SOUND_SPEED / sampling_frequency,
+                          1000.0 * SOUND_SPEED / sampling_frequency,
+                          FirFilter(std::vector<Sample>({0.5, 0.5})));
+  OmniMic mic_lowpass(mic.position());
+  Ism ism_lowpass(&room_lowpass, &source, &mic_lowpass, none, 9,
+                  sampling_frequency);
+  ism_lowpass.SetFrequencyBands(std::vector<Time>(1, sampling_frequency / 2.0));
+  test_rir.Reset();
+  ism_lowpass.ProcessBlock(impulse.GetReadView(), test_rir);
+  std::vector<Sample> cmp_lowpass = dsp::Zeros<Sample>(9);
+  cmp_lowpass[2] = 1.0 / 2.0;
+  ASSERT(dsp::IsEqual(cmp_lowpass, test_rir.GetReadView(), 1.0E-9));
+
+  // Hybrid synthesis: the images up to the mixing time are unchanged, and
+  // the statistical tail continues with the energy of the images in the
+  // window before the mixing time (rigid walls, so that there is no decay).
+  Time sampling_frequency_hybrid = 8000.0;
+  CuboidRoom room_rigid(5.0, 4.0, 3.0, GainFilter(1.0));
+  OmniMic mic_hybrid(Point(1.2, 1.5, 1.1));
+  OmniSource source_hybrid(Point(3.7, 2.4, 1.8));
+  Int rir_length_hybrid = 2400;
+  Int mixing_sample = 400;
+  Ism ism_full(&room_rigid, &source_hybrid, &mic_hybrid, none,
+               rir_length_hybrid, sampling_frequency_hybrid);
+  Ism ism_hybrid(&room_rigid, &source_hybrid, &mic_hybrid, none,
+                 rir_length_hybrid, sampling_frequency_hybrid);
+  ism_hybrid.SetLateReverberation(mixing_sample / sampling_frequency_hybrid);
+  MonoBuffer output_hybrid(1);
+  ism_full.ProcessBlock(MonoBuffer(1).GetReadView(), output_hybrid);
+  ism_hybrid.ProcessBlock(MonoBuffer(1).GetReadView(), output_hybrid);
+  std::vector<Sample> rir_full = ism_full.rir();
+  std::vector<Sample> rir_hybrid = ism_hybrid.rir();
+  ASSERT(ism_hybrid.images_delay().size() < ism_full.images_delay().size());
+  ASSERT(dsp::IsEqual(
+      std::span<const Sample>(rir_full).subspan(0, mixing_sample),
+      std::span<const Sample>(rir_hybrid).subspan(0, mixing_sample)));
+
+  std::vector<Time> delays_hybrid = ism_hybrid.images_delay();
+  Time direct_delay =
+      *std::min_element(delays_hybrid.begin(), delays_hybrid.end());
+  Sample window_energy = 0.0;
+  for (Time delay : delays_hybrid) {
+    Time delay_norm = delay * sampling_frequency_hybrid;
+    if (delay > direct_delay && delay_norm >= mixing_sample / 2) {
+      window_energy += 1.0 / (delay_norm * delay_norm);
+    }
+  }
+  Sample tail_energy = 0.0;
+  for (Int n = mixing_sample; n < rir_length_hybrid; ++n) {
+    tail_energy += rir_hybrid[n] * rir_hybrid[n];
+  }
+  Sample expected_energy = window_energy / (mixing_sample / 2) *
+                           (rir_length_hybrid - mixing_sample);
+  ASSERT(tail_energy > 0.8 * expected_energy &&
+         tail_energy < 1.25 * expected_energy);
+
+  // With absorbing walls the tail decays following Sabine's formula
+  CuboidRoom room_absorbing(5.0, 4.0, 3.0, GainFilter(0.9));
+  Ism ism_decay(&room_absorbing, &source_hybrid, &mic_hybrid, none,
+                rir_length_hybrid, sampling_frequency_hybrid);
+  ism_decay.SetLateReverberation(mixing_sample / sampling_frequency_hybrid);
+  ism_decay.ProcessBlock(MonoBuffer(1).GetReadView(), output_hybrid);
+  std::vector<Sample> rir_decay = ism_decay.rir();
+  Sample energy_early = 0.0;
+  Sample energy_late = 0.0;
+  for (Int n = mixing_sample; n < mixing_sample + 1000; ++n) {
+    energy_early += rir_decay[n] * rir_decay[n];
+    energy_late += rir_decay[n + 1000] * rir_decay[n + 1000];
+  }
+  // 60 dB of decay in one RT60
+  Sample expected_ratio = pow(10.0, 6.0 * 1000.0 / sampling_frequency_hybrid /
+                                        room_absorbing.SabineRt60());
+  ASSERT(energy_early / energy_late > 0.5 * expected_ratio &&
+         energy_early / energy_late < 2.0 * expected_ratio);
+
+  // Energy-based pruning: the images that are dropped are below the
+  // threshold.
+  CuboidRoom room_pruning(5.0, 4.0, 3.0, GainFilter(0.5));
+  Ism ism_unpruned(&room_pruning, &source_hybrid, &mic_hybrid, none,
+                   rir_length_hybrid, sampling_frequency_hybrid);
+  Ism ism_pruned(&room_pruning, &source_hybrid, &mic_hybrid, none,
+                 rir_length_hybrid, sampling_frequency_hybrid);
+  ism_pruned.SetEnergyThreshold(-60.0);
+  ism_unpruned.ProcessBlock(MonoBuffer(1).GetReadView(), output_hybrid);
+  ism_pruned.ProcessBlock(MonoBuffer(1).GetReadView(), output_hybrid);
+  ASSERT(ism_pruned.images_delay().size() <
+         ism_unpruned.images_delay().size() / 2);
+  std::vector<Sample> rir_unpruned = ism_unpruned.rir();
+  std::vector<Sample> rir_pruned = ism_pruned.rir();
+  Sample energy_unpruned = 0.0;
+  Sample energy_error = 0.0;
+  for (Int n = 0; n < rir_length_hybrid; ++n) {
+    energy_unpruned += rir_unpruned[n] * rir_unpruned[n];
+    energy_error += pow(rir_unpruned[n] - rir_pruned[n], 2.0);
+  }
+  ASSERT(energy_error < 1.0E-5 * energy_unpruned);
+
+  // Automatic length: the direct path plus the time for a 60 dB decay
+  ism_pruned.SetEnergyThreshold(-60.0, true);
+  ism_pruned.ProcessBlock(MonoBuffer(1).GetReadView(), output_hybrid);
+  Time direct_time =
+      dsp::Distance(source_hybrid.position(), mic_hybrid.position()) /
+      SOUND_SPEED;
+  Int automatic_length =
+      (Int)ceil((direct_time + room_pruning.SabineRt60()) *
+                sampling_frequency_hybrid) +
+      1;
+  ASSERT(ism_pruned.rir_length() == automatic_length);
+  ASSERT((Int)ism_pruned.rir().size() == automatic_length);
+
+  // Many sources and receivers at once: same as one Ism per pair
+  std::vector<Point> source_positions = {Point(3.7, 2.4, 1.8),
+                                         Point(0.5, 3.1, 2.2)};
+  std::vector<Point> receiver_positions = {
+      Point(1.2, 1.5, 1.1), Point(4.1, 0.7, 0.3), Point(2.5, 2.0, 1.5)};
+  Int rir_length_pairs = 800;
+  for (IsmInterpolation interpolation : {none, peterson}) {
+    Ism ism_pairs(&room_pruning, &source_hybrid, &mic_hybrid, interpolation,
+                  rir_length_pairs, sampling_frequency_hybrid);
+    std::vector<Sample> rirs =
+        ism_pairs.CalculateRirs(source_positions, receiver_positions);
+    ASSERT((Int)rirs.size() == 2 * 3 * rir_length_pairs);
+    for (Int s = 0; s < 2; ++s) {
+      for (Int r = 0; r < 3; ++r) {
+        OmniSource source_pair(source_positions[s]);
+        OmniMic mic_pair(receiver_positions[r]);
+        Ism ism_pair(&room_pruning, &source_pair, &mic_pair, interpolation,
+                     rir_length_pairs, sampling_frequency_hybrid);
+        ism_pair.ProcessBlock(MonoBuffer(1).GetReadView(), output_hybrid);
+        ASSERT(dsp::IsEqual(
+            std::span<const Sample>(ism_pair.rir()),
+            std::span<const Sample>(rirs).subspan(
+                (s * 3 + r) * rir_length_pairs, rir_length_pairs)));
+      }
+    }
+  }
+
+  // Testing peterson: only the direct path, against the windowed sinc
+  // evaluated directly.
+  CuboidRoom room_anechoic(5.0, 6.0, 7.0, GainFilter(0.0));
+  OmniMic mic_peterson(Point(1.0, 1.0, 1.0));
+  OmniSource source_peterson(Point(1.0, 1.0 + 100.37 * SOUND_SPEED /
+                                                 sampling_frequency,
+                                   1.0));
+  Int rir_length_peterson = 300;
+  Ism ism_peterson(&room_anechoic, &source_peterson, &mic_peterson, peterson,
+                   rir_length_peterson, sampling_frequency);
+  MonoBuffer output_peterson(1);
+  ism_peterson.ProcessBlock(MonoBuffer(1).GetReadView(), output_peterson);
+
+  Time delay_norm = 100.37;
+  Sample attenuation = 1.0 / delay_norm;
+  Time half_window = 0.004 * sampling_frequency / 2.0;
+  Time f_c = 0.9 * (sampling_frequency / 2.0);
+  std::vector<Sample> cmp_peterson = dsp::Zeros<Sample>(rir_length_peterson);
+  for (Int n = (Int)floor(delay_norm - half_window) + 1;
+       n < floor(delay_norm + half_window); ++n) {
+    Time t = ((Time)n - delay_norm) / sampling_frequency;
+    cmp_peterson[n] = attenuation * 0.5 *
+                      (1.0 + cos(2.0 * PI * t / 0.004)) *
+                      sin(2.0 * PI * f_c * t) / (2.0 * PI * f_c * t);
+  }
+  ASSERT(dsp::IsEqual(cmp_peterson, ism_peterson.rir(), 1.0E-6));
 
   return true;
 }
@@ -0,0 +1,186 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+#include "cuboidroom.h"
+#include "meshroom.h"
+#include "monomics.h"
+#include "source.h"
+#include "tdbem.h"
+
+using sal::dsp::IsEqual;
+using sal::dsp::Point;
+
+namespace sal {
+
+bool TriangleMesh::Test() {
+  // Cuboid: outward normals, volume and inside test
+  const TriangleMesh cuboid = TriangleMesh::Cuboid(2.0, 3.0, 4.0);
+  ASSERT(cuboid.num_triangles() == 12);
+  ASSERT(cuboid.num_materials() == 6);
+  ASSERT(IsEqual(cuboid.Volume(), 24.0));
+  ASSERT(IsEqual(cuboid.Normal(0), Point(-1.0, 0.0, 0.0)));
+  ASSERT(IsEqual(cuboid.Normal(2 * kZ2), Point(0.0, 0.0, 1.0)));
+  ASSERT(IsEqual(cuboid.Area(0) + cuboid.Area(1), 12.0));
+  ASSERT(IsEqual(cuboid.max_corner(), Point(2.0, 3.0, 4.0)));
+  ASSERT(cuboid.IsPointInside(Point(1.0, 1.5, 2.0)));
+  // Also on the diagonals of the faces
+  ASSERT(cuboid.IsPointInside(Point(1.0, 1.5, 0.5)));
+  ASSERT(cuboid.IsPointInside(Point(0.5, 0.75, 1.0)));
+  ASSERT(!cuboid.IsPointInside(Point(1.0, 1.5, 4.5)));
+  ASSERT(!cuboid.IsPointInside(Point(-0.5, 1.5, 2.0)));
+  Int triangle;
+  ASSERT(IsEqual(cuboid.Distance(Point(1.0, 1.5, 3.5), triangle), 0.5));
+  ASSERT(cuboid.triangles()[triangle].material == kZ2);
+  ASSERT(IsEqual(cuboid.Distance(Point(3.0, 4.0, 2.0), triangle), sqrt(2.0)));
+
+  Length position;
+  ASSERT(LineCrossing(Point(0, 0, 1), Point(1, 0, 1), Point(0, 1, 3), 2, 0.25,
+                      0.5, position));
+  ASSERT(IsEqual(position, 2.0));
+  ASSERT(!LineCrossing(Point(0, 0, 1), Point(1, 0, 1), Point(0, 1, 3), 2, 0.75,
+                       0.5, position));
+
+  // OBJ file with quads, a comment, texture and normal indices, and two
+  // materials
+  const std::filesystem::path directory =
+      std::filesystem::temp_directory_path();
+  const std::string obj_path = (directory / "sal_mesh_test.obj").string();
+  {
+    std::ofstream file(obj_path);
+    file << "# Unit cube\n"
+         << "v 0 0 0\nv 0 0 1\nv 0 1 0\nv 0 1 1\n"
+         << "v 1 0 0\nv 1 0 1\nv 1 1 0\nv 1 1 1\n"
+         << "vn 0 0 1\n"
+         << "f 1/1/1 2/1/1 4/1/1 3/1/1\n"
+         << "usemtl concrete\n"
+         << "f 5//1 7//1 8//1 6//1\nf 1 5 6 2\nf 3 4 8 7\n"
+         << "usemtl carpet\n"
+         << "f -8 -6 -2 -4\n"
+         << "usemtl concrete\n"
+         << "f 2 6 8 4\n";
+  }
+  TriangleMesh obj;
+  ASSERT(TriangleMesh::Load(obj_path, obj));
+  std::remove(obj_path.c_str());
+  ASSERT(obj.num_triangles() == 12);
+  ASSERT(obj.vertices().size() == 8);
+  ASSERT(obj.material_names() ==
+         std::vector<std::string>({"default", "concrete", "carpet"}));
+  ASSERT(obj.triangles()[0].material == 0);
+  ASSERT(obj.triangles()[2].material == 1);
+  ASSERT(obj.triangles()[8].material == 2);
+  const std::array<Int, 3> vertices = {0, 2, 6};
+  ASSERT(obj.triangles()[8].vertices == vertices);
+  ASSERT(IsEqual(obj.Volume(), 1.0));
+
+  // ASCII PLY file with extra properties and a material per face
+  const std::string ply_path = (directory / "sal_mesh_test.ply").string();
+  {
+    std::ofstream file(ply_path);
+    file << "ply\nformat ascii 1.0\ncomment tetrahedron\n"
+         << "element vertex 4\nproperty float x\nproperty float y\n"
+         << "property float z\nproperty uchar red\n"
+         << "element face 4\nproperty list uchar int vertex_indices\n"
+         << "property int material\nend_header\n"
+         << "0 0 0 255\n1 0 0 255\n0 1 0 255\n0 0 1 255\n"
+         << "3 0 2 1 0\n3 0 1 3 1\n3 0 3 2 1\n3 1 2 3 2\n";
+  }
+  TriangleMesh ply;
+  ASSERT(TriangleMesh::Load(ply_path, ply));
+  std::remove(ply_path.c_str());
+  ASSERT(ply.num_triangles() == 4);
+  ASSERT(ply.num_materials() == 3);
+  ASSERT(ply.triangles()[3].material == 2);
+  ASSERT(IsEqual(ply.Volume(), 1.0 / 6.0));
+  ASSERT(ply.IsPointInside(Point(0.1, 0.2, 0.3)));
+  ASSERT(!ply.IsPointInside(Point(0.4, 0.4, 0.4)));
+
+  // Files that cannot be loaded leave the mesh unchanged
+  ASSERT(!TriangleMesh::Load((directory / "sal_missing.obj").string(), ply));
+  ASSERT(ply.num_triangles() == 4);
+
+  return true;
+}
+
+bool MeshRoom::Test() {
+  // A room from the mesh of a cuboid has the same first-order reflection
+  // points (each on one of the two triangles of its wall) as the cuboid room
+  const Length x = 4.0;
+  const Length y = 3.0;
+  const Length z = 2.5;
+  CuboidRoom cuboid_room(x, y, z, dsp::GainFilter(0.8));
+  MeshRoom mesh_room(TriangleMesh::Cuboid(x, y, z), dsp::GainFilter(0.8));
+  ASSERT(mesh_room.num_faces() == 6);
+  ASSERT(mesh_room.num_boundary_points() == 12);
+  ASSERT(IsEqual(mesh_room.max_distance(), cuboid_room.max_distance()));
+  const Point source(1.0, 2.0, 1.5);
+  const Point mic(3.0, 0.5, 1.0);
+  const std::vector<Point> cuboid_points =
+      cuboid_room.CalculateBoundaryPoints(source, mic);
+  const std::vector<Point> mesh_points =
+      mesh_room.CalculateBoundaryPoints(source, mic);
+  std::vector<Int> wall_ids(12);
+  mesh_room.GetBoundaryWallIds(source, mic, wall_ids);
+  for (Int wall = 0; wall < 6; ++wall) {
+    ASSERT(wall_ids[2 * wall] == wall && wall_ids[2 * wall + 1] == wall);
+    ASSERT(IsEqual(mesh_points[2 * wall], cuboid_points[wall]) ||
+           IsEqual(mesh_points[2 * wall + 1], cuboid_points[wall]));
+  }
+  ASSERT(mesh_room.GetBoundaryFilters(source, mic).size() == 12);
+  ASSERT(mesh_room.IsPointInRoom(source));
+  ASSERT(mesh_room.IsPointInRoom(source, 0.9));
+  ASSERT(!mesh_room.IsPointInRoom(source, 1.1));
+  ASSERT(!mesh_room.IsPointInRoom(Point(5.0, 1.0, 1.0)));
+
+  // Normals point into the room, also when the mesh is oriented inwards
+  ASSERT(IsEqual(mesh_room.InwardNormal(0), Point(1.0, 0.0, 0.0)));
+  std::vector<TriangleMesh::Triangle> flipped =
+      mesh_room.mesh().triangles();
+  for (TriangleMesh::Triangle& triangle : flipped) {
+    std::swap(triangle.vertices[1], triangle.vertices[2]);
+  }
+  MeshRoom flipped_room(
+      TriangleMesh(mesh_room.mesh().vertices(), flipped,
+                   mesh_room.mesh().material_names()),
+      dsp::GainFilter(0.8));
+  ASSERT(IsEqual(flipped_room.InwardNormal(0), Point(1.0, 0.0, 0.0)));
+
+  // Impedances of the walls
+  mesh_room.SetWallFilter(kZ1, dsp::GainFilter(0.5));
+  mesh_room.SetWallFilter(kZ2, dsp::GainFilter(1.0));
+  const std::vector<Sample> impedances = mesh_room.WallImpedances();
+  ASSERT(IsEqual(impedances[kX1], 9.0));
+  ASSERT(IsEqual(impedances[kZ1], 3.0));
+  ASSERT(impedances[kZ2] > 1.0E5);
+
+  // TdBem runs on the elements of the triangles of the mesh
+  MeshRoom small_room(TriangleMesh::Cuboid(1.0, 1.2, 0.8),
+                      dsp::GainFilter(0.9));
+  OmniSource omni_source(Point(0.3, 0.4, 0.3));
+  OmniMic omni_mic(Point(0.7, 0.5, 0.4));
+  TdBem tdbem(&small_room, &omni_source, &omni_mic, 4000, 0.25, 1.0);
+  const Int num_samples = 20;
+  MonoBuffer input(num_samples);
+  input.SetSample(0, 1.0);
+  MonoBuffer output(num_samples);
+  tdbem.Run(input, output);
+  Sample energy = 0.0;
+  for (Int n = 0; n < num_samples; ++n) {
+    ASSERT(std::isfinite(output.GetSample(n)));
+    energy += pow(output.GetSample(n), 2.0);
+  }
+  ASSERT(energy > 0.0);
+
+  return true;
+}
+
+}  // namespace sal
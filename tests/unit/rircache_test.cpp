@@ -0,0 +1,97 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#include <filesystem>
+#include <fstream>
+
+#include "comparisonop.h"
+#include "iirfilter.h"
+#include "rircache.h"
+
+using sal::dsp::IsEqual;
+using sal::dsp::Point;
+
+namespace sal {
+
+bool RirCache::Test() {
+  // Keys
+  ASSERT(Key("Ism").value() != Key("Fdtd").value());
+  ASSERT(Key().Add(Point(1.0, 2.0, 3.0), 0.01).value() ==
+         Key().Add(Point(1.001, 1.999, 3.002), 0.01).value());
+  ASSERT(Key().Add(Point(1.0, 2.0, 3.0), 0.01).value() !=
+         Key().Add(Point(1.0, 2.0, 3.02), 0.01).value());
+  ASSERT(Key().Add(0.0).value() == Key().Add(-0.0).value());
+  ASSERT(Key().Add((Int)1).Add((Int)2).value() !=
+         Key().Add((Int)2).Add((Int)1).value());
+  ASSERT(Key().AddImpulseResponse(dsp::GainFilter(0.5)).value() ==
+         Key().AddImpulseResponse(dsp::IirFilter(dsp::GainFilter(0.5))).value());
+  ASSERT(Key().AddImpulseResponse(dsp::GainFilter(0.5)).value() !=
+         Key().AddImpulseResponse(dsp::GainFilter(0.6)).value());
+
+  // Memory tier with least-recently-used eviction
+  const Signal rir_a = {1.0, 0.5};
+  const Signal rir_b = {0.0, 0.25, 0.125};
+  const Signal rir_c = {-1.0};
+  RirCache cache(2);
+  Signal rir;
+  ASSERT(!cache.Find(1, rir));
+  cache.Insert(1, rir_a);
+  cache.Insert(2, rir_b);
+  ASSERT(cache.Find(1, rir) && IsEqual(rir, rir_a));
+  cache.Insert(3, rir_c);  // Evicts 2, which is now the least recently used
+  ASSERT(cache.num_entries() == 2);
+  ASSERT(!cache.Find(2, rir));
+  ASSERT(cache.Find(1, rir) && IsEqual(rir, rir_a));
+  ASSERT(cache.Find(3, rir) && IsEqual(rir, rir_c));
+  cache.Clear();
+  ASSERT(cache.num_entries() == 0);
+  ASSERT(!cache.Find(1, rir));
+
+  // Disk tier, shared between caches
+  const std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "sal_rircache_test";
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory);
+  {
+    RirCache cache_a(1, directory.string());
+    cache_a.Insert(10, rir_a);
+    cache_a.Insert(11, rir_b);
+    ASSERT(cache_a.num_entries() == 1);
+    // Evicted from memory, read back from disk
+    ASSERT(cache_a.Find(10, rir) && IsEqual(rir, rir_a));
+  }
+  RirCache cache_b(4, directory.string());
+  ASSERT(cache_b.Find(11, rir) && IsEqual(rir, rir_b));
+  ASSERT(cache_b.Find(10, rir) && IsEqual(rir, rir_a));
+  ASSERT(!cache_b.Find(12, rir));
+  // Files whose size does not match their header are rejected: one is
+  // truncated, and the other claims more samples than the file contains.
+  const std::string path_b = cache_b.FilePath(11);
+  std::filesystem::resize_file(
+      path_b, std::filesystem::file_size(path_b) - sizeof(Sample));
+  {
+    std::fstream file(cache_b.FilePath(10),
+                      std::ios::binary | std::ios::in | std::ios::out);
+    const uint64_t num_samples = 1ULL << 60;
+    file.seekp(16);  // After the magic number and the key
+    file.write(reinterpret_cast<const char*>(&num_samples),
+               sizeof(num_samples));
+  }
+  RirCache cache_c(4, directory.string());
+  ASSERT(!cache_c.Find(11, rir) && IsEqual(rir, rir_a));
+  ASSERT(!cache_c.Find(10, rir) && IsEqual(rir, rir_a));
+  // Only the RIR files are left, the temporary files having been renamed
+  for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+    ASSERT(entry.path().extension() == ".rir");
+  }
+  std::filesystem::remove_all(directory);
+
+  return true;
+}
+
+}  // namespace sal
@@ -0,0 +1,173 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#include <cmath>
+
+#include "cuboidroom.h"
+#include "monomics.h"
+#include "salconstants.h"
+#include "sdn.h"
+#include "source.h"
+
+using sal::dsp::GainFilter;
+using sal::dsp::IsEqual;
+using sal::dsp::Point;
+
+namespace sal {
+
+namespace {
+
+/** Cuboid room with nodes also at the second-order reflection points
+ between the x and y walls */
+class SecondOrderCuboidRoom : public CuboidRoom {
+ public:
+  SecondOrderCuboidRoom(const Length x, const Length y, const Length z,
+                        const std::vector<dsp::Filter>& filter_prototypes)
+      : CuboidRoom(x, y, z, filter_prototypes) {
+    boundary_set_type_ = kFirstAndSecondOrder;
+  }
+};
+
+}  // namespace
+
+bool Sdn::Test() {
+  // Geometry in units of samples, chosen so that the direct path and all
+  // first-order reflections have integer delays: direct path of 30 samples,
+  // floor reflection of 40 samples (5 + 35), ceiling and side walls of 50
+  // samples (40 + 10 and 25 + 25). Higher-order paths arrive after 55
+  // samples.
+  const Time sampling_frequency = 44100;
+  const Length unit = SOUND_SPEED / sampling_frequency;
+  const Sample beta = 0.7;
+  CuboidRoom room(40.0 * unit, 40.0 * unit, 45.0 * unit, GainFilter(beta));
+  OmniSource source(Point(20.0 * unit, 20.0 * unit, 5.0 * unit));
+  OmniMic mic(Point(20.0 * unit, 20.0 * unit, 35.0 * unit));
+
+  Sdn sdn(&room, &source, &mic, sampling_frequency);
+  ASSERT(sdn.num_nodes() == 6);
+
+  const Int num_samples = 55;
+  MonoBuffer impulse(num_samples);
+  impulse.SetSample(0, 1.0);
+  MonoBuffer output(num_samples);
+  sdn.ProcessBlock(impulse.GetReadView(), output);
+
+  // First-order amplitudes are the same as in the image method
+  std::vector<Sample> cmp = dsp::Zeros<Sample>(num_samples);
+  cmp[30] = 1.0 / 30.0;
+  cmp[40] = beta / 40.0;
+  cmp[50] = 5.0 * beta / 50.0;
+  ASSERT(IsEqual(cmp, output.GetReadView()));
+
+  // Processing in smaller blocks gives the same result
+  sdn.ResetState();
+  std::vector<Sample> streamed;
+  for (Int i = 0; i < num_samples / 5; ++i) {
+    MonoBuffer block_input(5);
+    MonoBuffer block_output(5);
+    if (i == 0) {
+      block_input.SetSample(0, 1.0);
+    }
+    sdn.ProcessBlock(block_input.GetReadView(), block_output);
+    for (Int j = 0; j < 5; ++j) {
+      streamed.push_back(block_output.GetSample(j));
+    }
+  }
+  ASSERT(IsEqual(cmp, streamed));
+
+  // The network is lossless with rigid walls and decays with absorbing walls
+  CuboidRoom room_rigid(40.0 * unit, 40.0 * unit, 45.0 * unit,
+                        GainFilter(1.0));
+  Sdn sdn_rigid(&room_rigid, &source, &mic, sampling_frequency);
+  Sdn sdn_absorbing(&room, &source, &mic, sampling_frequency);
+  const Int num_samples_long = 20000;
+  MonoBuffer impulse_long(num_samples_long);
+  impulse_long.SetSample(0, 1.0);
+  MonoBuffer output_rigid(num_samples_long);
+  MonoBuffer output_absorbing(num_samples_long);
+  sdn_rigid.ProcessBlock(impulse_long.GetReadView(), output_rigid);
+  sdn_absorbing.ProcessBlock(impulse_long.GetReadView(), output_absorbing);
+  Sample energy_rigid = 0.0;
+  Sample energy_absorbing = 0.0;
+  for (Int n = num_samples_long - 1000; n < num_samples_long; ++n) {
+    energy_rigid += pow(output_rigid.GetSample(n), 2.0);
+    energy_absorbing += pow(output_absorbing.GetSample(n), 2.0);
+  }
+  ASSERT(energy_rigid > 0.0);
+  ASSERT(energy_absorbing < 1.0E-6 * energy_rigid);
+
+  // Moving source: the direct path follows the new position
+  source.SetPosition(Point(20.0 * unit, 20.0 * unit, 15.0 * unit));
+  sdn.Update();
+  sdn.ResetState();
+  MonoBuffer output_moved(num_samples);
+  sdn.ProcessBlock(impulse.GetReadView(), output_moved);
+  ASSERT(IsEqual(output_moved.GetSample(20), 1.0 / 20.0));
+  for (Int n = 0; n < 20; ++n) {
+    ASSERT(IsEqual(output_moved.GetSample(n), 0.0));
+  }
+
+  // Source moving while the network is running, with nodes at the
+  // second-order reflection points, whose walls change with the position of
+  // the source. Once the lines have reached their new lengths, the network
+  // gives the same response as one built for the final position.
+  std::vector<dsp::Filter> wall_filters;
+  for (Int i = 0; i < 6; ++i) {
+    wall_filters.push_back(GainFilter(0.5 + 0.05 * (Sample)i));
+  }
+  SecondOrderCuboidRoom room_second(40.0 * unit, 40.0 * unit, 45.0 * unit,
+                                    wall_filters);
+  const Point start_position(5.0 * unit, 20.0 * unit, 5.0 * unit);
+  const Point end_position(20.0 * unit, 5.0 * unit, 5.0 * unit);
+  OmniSource source_moving(start_position);
+  Sdn sdn_moving(&room_second, &source_moving, &mic, sampling_frequency);
+  ASSERT(sdn_moving.num_nodes() == 10);
+  std::vector<Int> start_wall_ids(10);
+  std::vector<Int> end_wall_ids(10);
+  room_second.GetBoundaryWallIds(start_position, mic.position(),
+                                 start_wall_ids);
+  room_second.GetBoundaryWallIds(end_position, mic.position(), end_wall_ids);
+  ASSERT(start_wall_ids != end_wall_ids);
+
+  const Int num_blocks = 40;
+  for (Int i = 0; i < num_blocks; ++i) {
+    MonoBuffer block_input(5);
+    MonoBuffer block_output(5);
+    if (i == 0) {
+      block_input.SetSample(0, 1.0);
+    }
+    sdn_moving.ProcessBlock(block_input.GetReadView(), block_output);
+    for (Int j = 0; j < 5; ++j) {
+      ASSERT(std::isfinite(block_output.GetSample(j)));
+      ASSERT(std::abs(block_output.GetSample(j)) < 1.0);
+    }
+    if (i < num_blocks / 2) {
+      const Sample fraction = ((Sample)(i + 1)) / ((Sample)(num_blocks / 2));
+      source_moving.SetPosition(dsp::Sum(
+          dsp::Multiply(start_position, 1.0 - fraction),
+          dsp::Multiply(end_position, fraction)));
+      sdn_moving.Update(5.0 / sampling_frequency);
+    }
+  }
+
+  OmniSource source_end(end_position);
+  Sdn sdn_end(&room_second, &source_end, &mic, sampling_frequency);
+  sdn_moving.ResetState();
+  const Int num_samples_end = 500;
+  MonoBuffer impulse_end(num_samples_end);
+  impulse_end.SetSample(0, 1.0);
+  MonoBuffer output_moving(num_samples_end);
+  MonoBuffer output_end(num_samples_end);
+  sdn_moving.ProcessBlock(impulse_end.GetReadView(), output_moving);
+  sdn_end.ProcessBlock(impulse_end.GetReadView(), output_end);
+  ASSERT(IsEqual(output_moving.GetReadView(), output_end.GetReadView()));
+
+  return true;
+}
+
+}  // namespace sal
@@ -7,6 +7,7 @@
  */
 
 #include "monomics.h"
+#include "randomop.h"
 #include "tdbem.h"
 
 namespace sal {
@@ -21,6 +22,165 @@ using sal::Sample;
 using sal::Source;
 using sal::Time;
 
+bool TdBem::Test() {
+  CuboidRoom room(1.0, 1.2, 0.8, dsp::GainFilter(0.9));
+  OmniSource source(Point(0.3, 0.4, 0.3));
+  OmniMic mic(Point(0.7, 0.5, 0.4));
+  const Time sampling_frequency = 4000;
+  TdBem tdbem(&room, &source, &mic, sampling_frequency, 0.25, 5.0);
+  const Int num_samples = 15;
+  ASSERT(tdbem.history_length_ > num_samples);
+  Signal noise = dsp::RandomGenerator(3).Randn(num_samples);
+  MonoBuffer input(noise);
+  MonoBuffer output(num_samples);
+  tdbem.Run(input, output);
+
+  // The pressures on the boundary are the same as from the direct evaluation
+  // of all the pairs of elements with delay lines
+  const Int num_elements = tdbem.num_elements_;
+  const Int max_latency = 100;
+  DelayFilter source_line(max_latency, max_latency);
+  std::vector<DelayFilter> pressures(num_elements,
+                                     DelayFilter(max_latency, max_latency));
+  std::vector<Signal> expected(num_elements, Signal(num_samples, 0.0));
+  for (Int n = 0; n < num_samples; ++n) {
+    source_line.Write(input.GetSample(n));
+    for (Int i = 0; i < num_elements; ++i) {
+      const Point& point = tdbem.points_[i];
+      const Length distance_source = dsp::Distance(point, source.position());
+      Sample pressure =
+          source_line.FractionalReadAt(distance_source * sampling_frequency /
+                                       SOUND_SPEED) /
+          distance_source;
+      for (Int j = 0; j < num_elements; ++j) {
+        if (i == j) {
+          continue;
+        }
+        const Length distance = dsp::Distance(point, tdbem.points_[j]);
+        const Sample dr_dn = CalculateDrDn(point, tdbem.points_[j],
+                                           tdbem.normal_vectors_[j]);
+        const Time delay = distance * sampling_frequency / SOUND_SPEED;
+        pressure += (pressures[j].FractionalReadAt(delay) *
+                         CalculateWeightCurrent(dr_dn, distance, SOUND_SPEED,
+                                                sampling_frequency, 0.0625,
+                                                5.0) +
+                     pressures[j].FractionalReadAt(delay + 1.0) *
+                         CalculateWeightPrevious(dr_dn, distance, SOUND_SPEED,
+                                                 sampling_frequency, 0.0625,
+                                                 5.0)) /
+                    (2.0 * PI);
+      }
+      pressures[i].Write(pressure);
+      expected[i][n] = pressure;
+    }
+    source_line.Tick();
+    for (Int i = 0; i < num_elements; ++i) {
+      pressures[i].Tick();
+    }
+  }
+  for (Int i = 0; i < num_elements; ++i) {
+    for (Int n = 0; n < num_samples; ++n) {
+      ASSERT(dsp::IsEqual(tdbem.Pressure(i, num_samples - n), expected[i][n],
+                          1.0E-10));
+    }
+  }
+  ASSERT(!dsp::IsEqual(expected[0], Signal(num_samples, 0.0)));
+
+  // Splitting the elements among threads gives the same pressures
+  TdBem threaded_tdbem(&room, &source, &mic, sampling_frequency, 0.25, 5.0);
+  threaded_tdbem.SetNumThreads(3);
+  MonoBuffer threaded_output(num_samples);
+  threaded_tdbem.Run(input, threaded_output);
+  ASSERT(threaded_tdbem.histories_ == tdbem.histories_);
+
+  // The direct path arrives after about 4.95 samples, before the paths
+  // through the boundary
+  for (Int n = 0; n < 4; ++n) {
+    ASSERT(output.GetSample(n) == 0.0);
+  }
+  ASSERT(output.GetSample(4) != 0.0);
+
+  // Processing in blocks of any size gives the same output, and reports the
+  // progress after each sample
+  TdBem block_tdbem(&room, &source, &mic, sampling_frequency, 0.25, 5.0);
+  Int num_callbacks = 0;
+  Int last_progress = 0;
+  block_tdbem.SetProgressCallback([&](const Int num_processed_samples) {
+    num_callbacks++;
+    last_progress = num_processed_samples;
+  });
+  MonoBuffer block_output(num_samples);
+  const Int block_sizes[3] = {1, 4, 10};
+  Int block_begin = 0;
+  for (const Int block_size : block_sizes) {
+    MonoBuffer block(block_output.GetWriteView().subspan(block_begin,
+                                                         block_size));
+    block_tdbem.ProcessBlock(input.GetReadView().subspan(block_begin,
+                                                         block_size),
+                             block);
+    block_begin += block_size;
+  }
+  ASSERT(block_begin == num_samples);
+  ASSERT(num_callbacks == num_samples && last_progress == num_samples);
+  ASSERT(dsp::IsEqual(block_output.GetReadView(), output.GetReadView()));
+
+  // After a reset, the same input gives the same output again
+  block_tdbem.ResetState();
+  MonoBuffer reset_output(num_samples);
+  block_tdbem.Run(input, reset_output);
+  ASSERT(last_progress == num_samples);
+  ASSERT(dsp::IsEqual(reset_output.GetReadView(), output.GetReadView()));
+
+  // Weights in single precision give nearly the same pressures
+  TdBem single_tdbem(&room, &source, &mic, sampling_frequency, 0.25, 5.0);
+  single_tdbem.UseSinglePrecisionWeights();
+  ASSERT(single_tdbem.element_taps_.weights[0].empty());
+  ASSERT(single_tdbem.element_taps_.single_precision_weights[0].size() ==
+         tdbem.element_taps_.weights[0].size());
+  MonoBuffer single_output(num_samples);
+  single_tdbem.Run(input, single_output);
+  for (Int i = 0; i < num_elements; ++i) {
+    for (Int n = 0; n < num_samples; ++n) {
+      ASSERT(dsp::IsEqual(single_tdbem.Pressure(i, num_samples - n),
+                          expected[i][n], 1.0E-5));
+    }
+  }
+
+  // Far-field aggregation is close to the evaluation of all pairs for an
+  // input with little energy at high frequencies, with fewer taps
+  const Int num_far_samples = 20;
+  const Int pulse_length = 12;
+  MonoBuffer pulse(num_far_samples);
+  for (Int n = 0; n < pulse_length; ++n) {
+    pulse.SetSample(n, 0.5 - 0.5 * cos(2.0 * PI * n / pulse_length));
+  }
+  MonoBuffer far_output(num_far_samples);
+  TdBem exact_tdbem(&room, &source, &mic, sampling_frequency, 0.1, 5.0);
+  exact_tdbem.Run(pulse, far_output);
+  const Sample ratios[2] = {0.2, 0.3};
+  const Sample max_errors[2] = {0.01, 0.05};
+  for (Int r = 0; r < 2; ++r) {
+    TdBem far_tdbem(&room, &source, &mic, sampling_frequency, 0.1, 5.0,
+                    ratios[r]);
+    ASSERT(!far_tdbem.clusters_.empty());
+    ASSERT(far_tdbem.element_taps_.num_taps() <
+           0.8 * exact_tdbem.element_taps_.num_taps());
+    far_tdbem.Run(pulse, far_output);
+    Sample error = 0.0;
+    Sample energy = 0.0;
+    for (Int i = 0; i < exact_tdbem.num_elements_; ++i) {
+      for (Int delay = 1; delay <= num_far_samples; ++delay) {
+        error += pow(
+            far_tdbem.Pressure(i, delay) - exact_tdbem.Pressure(i, delay), 2.0);
+        energy += pow(exact_tdbem.Pressure(i, delay), 2.0);
+      }
+    }
+    ASSERT(sqrt(error / energy) < max_errors[r]);
+  }
+
+  return true;
+}
+
 bool TdBem::SimulationTime() {
   Time sampling_frequency = 4000;
 
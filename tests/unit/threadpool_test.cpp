@@ -0,0 +1,64 @@
+/*
+ Spatial Audio Library (SAL)
+ Copyright (c) 2024, Enzo De Sena
+ All rights reserved.
+
+ Authors: Enzo De Sena, enzodesena@gmail.com
+ */
+
+#include <atomic>
+
+#include "threadpool.h"
+
+namespace sal {
+
+bool ThreadPool::Test() {
+  ThreadPool pool(4);
+  ASSERT(pool.num_threads() == 4);
+
+  // Every index is visited exactly once, over many consecutive loops
+  std::vector<Int> counts(103, 0);
+  for (Int repetition = 0; repetition < 50; ++repetition) {
+    pool.ParallelFor(0, (Int)counts.size(),
+                     [&counts](const Int begin, const Int end) {
+                       for (Int i = begin; i < end; ++i) {
+                         counts[i]++;
+                       }
+                     });
+  }
+  for (const Int count : counts) {
+    ASSERT(count == 50);
+  }
+
+  // Ranges are contiguous and cover [begin, end), also with fewer indices
+  // than threads
+  std::atomic<Int> num_ranges(0);
+  std::atomic<Int> total_length(0);
+  pool.ParallelFor(5, 7, [&](const Int begin, const Int end) {
+    ASSERT(begin >= 5 && end <= 7 && end > begin);
+    num_ranges++;
+    total_length += end - begin;
+  });
+  ASSERT(num_ranges == 2);
+  ASSERT(total_length == 2);
+
+  // Empty range
+  pool.ParallelFor(3, 3, [](const Int, const Int) { ASSERT(false); });
+
+  // A single thread runs the whole range in the calling thread
+  ThreadPool serial_pool(1);
+  ASSERT(serial_pool.num_threads() == 1);
+  Int num_calls = 0;
+  serial_pool.ParallelFor(0, 10, [&num_calls](const Int begin, const Int end) {
+    ASSERT(begin == 0 && end == 10);
+    num_calls++;
+  });
+  ASSERT(num_calls == 1);
+
+  ThreadPool default_pool;
+  ASSERT(default_pool.num_threads() >= 1);
+
+  return true;
+}
+
+}  // namespace sal